@@ -0,0 +1,241 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dbus.h"
+
+namespace dbus {
+    std::string encode(const Message& message, const std::string& body) {
+        std::string out;
+        Writer writer(out);
+        writer.byte('l');
+        writer.byte(message.type);
+        writer.byte(message.flags);
+        writer.byte(1);
+        writer.u32(static_cast<uint32_t>(body.size()));
+        writer.u32(message.serial);
+        size_t fields = writer.open_array(8);
+        auto field = [&](uint8_t code, const char* type, const std::string& value) {
+            if (value.empty()) return;
+            writer.align(8);
+            writer.byte(code);
+            writer.signature(type);
+            if (type[0] == 'g') {
+                writer.signature(value);
+            } else {
+                writer.string(value);
+            }
+        };
+        field(1, "o", message.path);
+        field(2, "s", message.interface);
+        field(3, "s", message.member);
+        field(4, "s", message.error_name);
+        if (message.reply_serial != 0) {
+            writer.align(8);
+            writer.byte(5);
+            writer.signature("u");
+            writer.u32(message.reply_serial);
+        }
+        field(6, "s", message.destination);
+        field(8, "g", message.signature);
+        writer.close_array(fields, 8);
+        writer.align(8);
+        return out + body;
+    }
+
+    // Size of the first message in 'data': 0 when incomplete, SIZE_MAX when
+    // it can't be a message at all
+    size_t message_size(const std::string& data) {
+        if (data.size() < 16) return 0;
+        if (data[0] != 'l' && data[0] != 'B') return SIZE_MAX;
+        Reader reader(data, 4, data[0] == 'B');
+        size_t body = reader.u32();
+        reader.u32();
+        size_t fields = reader.u32();
+        size_t total = (16 + fields + 7) / 8 * 8 + body;
+        if (total > MAX_MESSAGE_SIZE) return SIZE_MAX;
+        return data.size() >= total ? total : 0;
+    }
+
+    bool decode(std::string data, Message& message) {
+        message = Message();
+        message.big_endian = data[0] == 'B';
+        message.data = std::move(data);
+        Reader reader(message.data, 1, message.big_endian);
+        message.type = reader.byte();
+        message.flags = reader.byte();
+        reader.byte();
+        reader.u32();
+        message.serial = reader.u32();
+        size_t end = 16 + reader.u32();
+        while (reader.ok && reader.pos < end) {
+            reader.align(8);
+            uint8_t code = reader.byte();
+            std::string type = reader.signature();
+            if (type == "u") {
+                uint32_t value = reader.u32();
+                if (code == 5) message.reply_serial = value;
+            } else if (type == "s" || type == "o" || type == "g") {
+                std::string value = type == "g" ? reader.signature() : reader.string();
+                std::string* targets[] = {nullptr, &message.path, &message.interface, &message.member,
+                                          &message.error_name, nullptr, &message.destination, &message.sender,
+                                          &message.signature};
+                if (code < 9 && targets[code] != nullptr) *targets[code] = value;
+            } else {
+                return false;
+            }
+        }
+        message.body_offset = (end + 7) / 8 * 8;
+        return reader.ok;
+    }
+
+    // Connect to the first usable unix: address, authenticate and say
+    // Hello. Errors are reported on stderr.
+    bool Connection::open(const std::string& address) {
+        std::istringstream entries(address);
+        std::string entry;
+        while (socket_fd < 0 && std::getline(entries, entry, ';')) {
+            if (entry.compare(0, 5, "unix:") == 0) socket_fd = connect_unix(entry.substr(5));
+        }
+        if (socket_fd < 0) {
+            std::cerr << "Error: Could not connect to the bus at '" << address << "'" << std::endl;
+            return false;
+        }
+        if (!authenticate()) {
+            std::cerr << "Error: The bus refused authentication" << std::endl;
+            return false;
+        }
+        Message reply;
+        if (!call("Hello", "", "", reply) || !reply.body().ok) return false;
+        unique_name = reply.body().string();
+        return true;
+    }
+
+    uint32_t Connection::send(Message message, const std::string& body) {
+        message.serial = ++last_serial;
+        std::string data = encode(message, body);
+        for (size_t sent = 0; sent < data.size();) {
+            ssize_t n = ::send(socket_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return 0;
+            sent += static_cast<size_t>(n);
+        }
+        return message.serial;
+    }
+
+    // Method call on the bus itself, waiting for its reply. Anything
+    // else arriving meanwhile is dropped; this is only used before the
+    // name is owned.
+    bool Connection::call(const std::string& member, const std::string& signature, const std::string& body, Message& reply) {
+        Message message;
+        message.type = METHOD_CALL;
+        message.path = "/org/freedesktop/DBus";
+        message.interface = "org.freedesktop.DBus";
+        message.destination = "org.freedesktop.DBus";
+        message.member = member;
+        message.signature = signature;
+        uint32_t serial = send(message, body);
+        while (serial != 0) {
+            while (next(reply)) {
+                if (reply.reply_serial != serial) continue;
+                if (reply.type == ERROR) {
+                    std::cerr << "Error: " << member << " failed: " << reply.error_name << std::endl;
+                    return false;
+                }
+                return true;
+            }
+            struct pollfd pfd = {socket_fd, POLLIN, 0};
+            if ((poll(&pfd, 1, -1) < 0 && errno != EINTR) || !fill()) break;
+        }
+        std::cerr << "Error: Lost the bus during " << member << std::endl;
+        return false;
+    }
+
+    // Take whatever the socket has; false once the bus is gone
+    bool Connection::fill() {
+        char buf[16384];
+        while (true) {
+            ssize_t n = recv(socket_fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n > 0) {
+                pending.append(buf, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+
+    // Next complete message received so far
+    bool Connection::next(Message& message) {
+        size_t size = message_size(pending);
+        if (size == 0) return false;
+        if (size == SIZE_MAX || !decode(pending.substr(0, size), message)) {
+            // Out of sync with the stream, nothing after this can be trusted
+            pending.clear();
+            ::shutdown(socket_fd, SHUT_RDWR);
+            return false;
+        }
+        pending.erase(0, size);
+        return true;
+    }
+
+    int Connection::connect_unix(const std::string& options) {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        socklen_t length = 0;
+        std::istringstream pairs(options);
+        std::string pair;
+        while (std::getline(pairs, pair, ',')) {
+            size_t eq = pair.find('=');
+            std::string key = pair.substr(0, eq);
+            if (eq == std::string::npos || (key != "path" && key != "abstract")) continue;
+            // Values are %-escaped
+            std::string value;
+            for (size_t i = eq + 1; i < pair.size(); ++i) {
+                if (pair[i] == '%' && i + 2 < pair.size()) {
+                    value.push_back(static_cast<char>(std::stoi(pair.substr(i + 1, 2), nullptr, 16)));
+                    i += 2;
+                } else {
+                    value.push_back(pair[i]);
+                }
+            }
+            size_t offset = key == "abstract" ? 1 : 0;
+            if (value.size() + offset >= sizeof(addr.sun_path)) return -1;
+            std::memcpy(addr.sun_path + offset, value.data(), value.size());
+            // One more byte for the path's NUL or the abstract name's leading one
+            length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + value.size() + 1);
+        }
+        if (length == 0) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<struct sockaddr*>(&addr), length) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    // A NUL byte, then AUTH EXTERNAL with our uid hex-encoded as text
+    bool Connection::authenticate() {
+        std::string uid = std::to_string(getuid()), hex;
+        char digits[3];
+        for (char c : uid) {
+            std::snprintf(digits, sizeof(digits), "%02x", static_cast<unsigned char>(c));
+            hex += digits;
+        }
+        std::string request = std::string(1, '\0') + "AUTH EXTERNAL " + hex + "\r\n";
+        if (::send(socket_fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+            return false;
+        }
+        std::string line;
+        char c;
+        while (line.size() < 512 && ::recv(socket_fd, &c, 1, 0) == 1 && c != '\n') line.push_back(c);
+        const std::string begin = "BEGIN\r\n";
+        return line.compare(0, 3, "OK ") == 0 &&
+               ::send(socket_fd, begin.data(), begin.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(begin.size());
+    }
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unistd.h>
+
+// Just enough of the D-Bus wire protocol to own a name and answer method
+// calls: EXTERNAL authentication over a Unix socket and marshalling of the
+// basic types, arrays, dicts and variants
+namespace dbus {
+    enum MessageType : uint8_t { METHOD_CALL = 1, METHOD_RETURN = 2, ERROR = 3, SIGNAL = 4 };
+    const uint8_t NO_REPLY_EXPECTED = 0x1;
+    // The specification's limit on a single message
+    const size_t MAX_MESSAGE_SIZE = 128 * 1024 * 1024;
+
+    // Appends little endian values at their natural alignment. Offsets are
+    // relative to the start of the message, which 'out' must be.
+    class Writer {
+    public:
+        explicit Writer(std::string& out) : out(out) {}
+
+        void align(size_t n) { out.resize((out.size() + n - 1) / n * n, '\0'); }
+        void byte(uint8_t value) { out.push_back(static_cast<char>(value)); }
+        void u32(uint32_t value) {
+            align(4);
+            for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+        void boolean(bool value) { u32(value ? 1 : 0); }
+        void string(const std::string& value) {
+            u32(static_cast<uint32_t>(value.size()));
+            out += value;
+            out.push_back('\0');
+        }
+        void signature(const std::string& value) {
+            byte(static_cast<uint8_t>(value.size()));
+            out += value;
+            out.push_back('\0');
+        }
+
+        // Arrays are a length followed by padding to the element alignment;
+        // open returns the length's offset for close to fill in
+        size_t open_array(size_t element_align) {
+            align(4);
+            size_t at = out.size();
+            u32(0);
+            align(element_align);
+            return at;
+        }
+        void close_array(size_t at, size_t element_align) {
+            size_t start = (at + 4 + element_align - 1) / element_align * element_align;
+            uint32_t length = static_cast<uint32_t>(out.size() - start);
+            for (int i = 0; i < 4; ++i) out[at + static_cast<size_t>(i)] = static_cast<char>((length >> (8 * i)) & 0xff);
+        }
+
+        // One {sv} dict entry with a string value
+        void entry(const std::string& key, const std::string& value) {
+            align(8);
+            string(key);
+            signature("s");
+            string(value);
+        }
+
+    private:
+        std::string& out;
+    };
+
+    // Reads values in either byte order; 'ok' drops to false on truncation
+    class Reader {
+    public:
+        Reader(const std::string& data, size_t pos, bool big_endian) : pos(pos), data(data), big_endian(big_endian) {}
+
+        void align(size_t n) {
+            pos = (pos + n - 1) / n * n;
+            if (pos > data.size()) ok = false;
+        }
+        uint8_t byte() {
+            if (pos >= data.size()) {
+                ok = false;
+                return 0;
+            }
+            return static_cast<uint8_t>(data[pos++]);
+        }
+        uint32_t u32() {
+            align(4);
+            if (!ok || pos + 4 > data.size()) {
+                ok = false;
+                return 0;
+            }
+            uint32_t value = 0;
+            for (int i = 0; i < 4; ++i) {
+                uint32_t b = static_cast<uint8_t>(data[pos + static_cast<size_t>(i)]);
+                value |= b << (big_endian ? 8 * (3 - i) : 8 * i);
+            }
+            pos += 4;
+            return value;
+        }
+        std::string string() { return text(u32()); }
+        std::string signature() { return text(byte()); }
+
+        size_t pos;
+        bool ok = true;
+
+    private:
+        std::string text(size_t length) {
+            if (!ok || pos + length + 1 > data.size()) {
+                ok = false;
+                return "";
+            }
+            std::string value = data.substr(pos, length);
+            pos += length + 1;
+            return value;
+        }
+
+        const std::string& data;
+        bool big_endian;
+    };
+
+    struct Message {
+        uint8_t type = 0;
+        uint8_t flags = 0;
+        uint32_t serial = 0;
+        uint32_t reply_serial = 0;
+        std::string path;
+        std::string interface;
+        std::string member;
+        std::string error_name;
+        std::string destination;
+        std::string sender;
+        std::string signature;
+        // Received messages keep their bytes for reading the body
+        std::string data;
+        size_t body_offset = 0;
+        bool big_endian = false;
+
+        Reader body() const { return Reader(data, body_offset, big_endian); }
+    };
+
+    std::string encode(const Message& message, const std::string& body);
+
+    // Size of the first message in 'data': 0 when incomplete, SIZE_MAX when
+    // it can't be a message at all
+    size_t message_size(const std::string& data);
+
+    bool decode(std::string data, Message& message);
+
+    class Connection {
+    public:
+        Connection() = default;
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+        ~Connection() {
+            if (socket_fd >= 0) ::close(socket_fd);
+        }
+
+        // Connect to the first usable unix: address, authenticate and say
+        // Hello. Errors are reported on stderr.
+        bool open(const std::string& address);
+
+        int fd() const { return socket_fd; }
+
+        uint32_t send(Message message, const std::string& body = "");
+
+        // Method call on the bus itself, waiting for its reply. Anything
+        // else arriving meanwhile is dropped; this is only used before the
+        // name is owned.
+        bool call(const std::string& member, const std::string& signature, const std::string& body, Message& reply);
+
+        // Take whatever the socket has; false once the bus is gone
+        bool fill();
+
+        // Next complete message received so far
+        bool next(Message& message);
+
+        std::string unique_name;
+
+    private:
+        int connect_unix(const std::string& options);
+
+        // A NUL byte, then AUTH EXTERNAL with our uid hex-encoded as text
+        bool authenticate();
+
+        int socket_fd = -1;
+        uint32_t last_serial = 0;
+        std::string pending;
+    };
+}
+
+
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "samsung-cli.h"
+
+class HelpCommand : public Command {
+public:
+    explicit HelpCommand(const std::map<std::string, std::unique_ptr<Command>>& cmds)
+        : commands(cmds) {}
+
+    bool execute(const std::vector<std::string>&) override {
+        print_help();
+        return true;
+    }
+
+    std::string get_help() const override {
+        return "  help          Show this help message";
+    }
+
+private:
+    void print_help() {
+        std::cout << "Usage: samsung-cli <command> [<args>]\n"
+                  << "CLI tool to control Samsung Galaxy Book features.\n\n"
+                  << "Commands:\n";
+
+        // Get help text from all commands
+        for (const auto& [name, cmd] : commands) {
+            std::cout << cmd->get_help() << "\n";
+        }
+    }
+
+    const std::map<std::string, std::unique_ptr<Command>>& commands;
+};
+
+int main(int argc, char* argv[]) {
+    if (!file_ops::configure_backend()) return 1;
+
+    std::map<std::string, std::unique_ptr<Command>> commands;
+
+    // Create all other commands first
+    register_commands(commands);
+
+    // Create help command last since it needs reference to all commands
+    commands["help"] = std::make_unique<HelpCommand>(commands);
+
+    if (argc < 2) {
+        commands["help"]->execute({});
+        return 1;
+    }
+
+    std::string command = argv[1];
+    std::vector<std::string> args(argv + 1, argv + argc);  // Skip program name
+
+    auto it = commands.find(command);
+    if (it == commands.end()) {
+        std::cerr << "Error: Unknown command '" << command << "'" << std::endl;
+        commands["help"]->execute({});
+        return 1;
+    }
+
+    return it->second->execute(args) ? 0 : 1;
+}
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <poll.h>
+
+#include "dbus.h"
+#include "samsung-cli.h"
+
+// power-profiles-daemon's interface served on top of the platform profile,
+// so desktops can switch modes without a second agent writing it. Served
+// under both the original and the UPower names. Changes made behind our
+// back (the Fn+F11 hotkey, 'perf set') arrive as sysfs POLLPRI
+// notifications.
+class PowerProfilesService {
+public:
+    bool run(const std::string& address) {
+        std::string choices;
+        if (!profiles::read_choices(choices)) return false;
+        ladder = profiles::ladder(choices);
+        if (std::find(ladder.begin(), ladder.end(), "balanced") == ladder.end()) {
+            std::cerr << "Error: power-profiles-daemon clients need a 'balanced' mode, have '" << choices << "'"
+                      << std::endl;
+            return false;
+        }
+        std::string mode;
+        int err = current.open(profiles::current_path());
+        if (err == 0) err = current.read(mode);
+        if (err != 0) {
+            std::cerr << "Error: Could not read " << profiles::current_path() << ": " << std::strerror(err) << std::endl;
+            return false;
+        }
+        active = selected = to_ppd(mode);
+
+        if (!bus.open(address)) return false;
+        for (const auto& object : OBJECTS) {
+            std::string body;
+            dbus::Writer writer(body);
+            writer.string(object.name);
+            writer.u32(4);  // DBUS_NAME_FLAG_DO_NOT_QUEUE
+            dbus::Message reply;
+            if (!bus.call("RequestName", "su", body, reply)) return false;
+            if (reply.body().u32() != 1) {
+                std::cerr << "Error: " << object.name << " is already owned (is power-profiles-daemon running?)"
+                          << std::endl;
+                return false;
+            }
+        }
+        // Holds end with the connection of whoever took them
+        std::string match;
+        dbus::Writer(match).string("type='signal',sender='org.freedesktop.DBus',member='NameOwnerChanged'");
+        dbus::Message reply;
+        if (!bus.call("AddMatch", "s", match, reply)) return false;
+        std::cout << "Serving " << OBJECTS[0].name << " as " << bus.unique_name << ", active profile " << active
+                  << std::endl;
+
+        signals::install_stop_handlers();
+        struct pollfd fds[2] = {{bus.fd(), POLLIN, 0}, {current.poll_fd(), POLLPRI | POLLERR, 0}};
+        nfds_t count = current.poll_fd() >= 0 ? 2 : 1;
+        bool ok = true;
+        while (!signals::stop_requested) {
+            int ready = poll(fds, count, accounting::checkpoint_timeout_ms());
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "Error: poll failed: " << std::strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+            accounting::tick();
+            if (ready == 0) continue;
+            if (fds[0].revents != 0) {
+                bool connected = bus.fill();
+                dbus::Message message;
+                while (bus.next(message)) handle(message);
+                if (!connected) {
+                    std::cerr << "Error: Lost the connection to the bus" << std::endl;
+                    ok = false;
+                    break;
+                }
+            }
+            if (count > 1 && (fds[1].revents & (POLLPRI | POLLERR)) != 0) refresh();
+        }
+        accounting::tick(true);
+        return ok;
+    }
+
+private:
+    struct Object {
+        const char* name;
+        const char* path;
+    };
+    static constexpr Object OBJECTS[] = {{"net.hadess.PowerProfiles", "/net/hadess/PowerProfiles"},
+                                         {"org.freedesktop.UPower.PowerProfiles", "/org/freedesktop/UPower/PowerProfiles"}};
+    static constexpr const char* PROPERTIES = "org.freedesktop.DBus.Properties";
+
+    struct Hold {
+        uint32_t cookie;
+        std::string profile;
+        std::string reason;
+        std::string application_id;
+        std::string owner;
+    };
+
+    dbus::Connection bus;
+    file_ops::Attribute current;
+    std::vector<std::string> ladder;
+    // power-profiles-daemon names: the one in effect, and the one chosen
+    // through ActiveProfile that comes back when the last hold is released
+    std::string active;
+    std::string selected;
+    std::vector<Hold> holds;
+    uint32_t next_cookie = 1;
+
+    static std::string to_ppd(const std::string& mode) {
+        int rank = profiles::rank(mode), balanced = profiles::rank("balanced");
+        if (rank < 0 || rank == balanced) return "balanced";
+        return rank < balanced ? "power-saver" : "performance";
+    }
+
+    std::string to_platform(const std::string& profile) const {
+        if (profile == "power-saver") return ladder.front();
+        if (profile == "performance" && std::find(ladder.begin(), ladder.end(), "performance") != ladder.end()) {
+            return "performance";
+        }
+        return profile == "performance" ? ladder.back() : "balanced";
+    }
+
+    std::vector<std::string> available() const {
+        std::vector<std::string> result;
+        if (to_ppd(ladder.front()) == "power-saver") result.push_back("power-saver");
+        result.push_back("balanced");
+        if (to_ppd(ladder.back()) == "performance") result.push_back("performance");
+        return result;
+    }
+
+    const Object* object_at(const std::string& path) const {
+        for (const auto& object : OBJECTS) {
+            if (path == object.path) return &object;
+        }
+        return nullptr;
+    }
+
+    // Variant holding the named property; false if there is no such property
+    bool write_property(dbus::Writer& writer, const std::string& name) const {
+        if (name == "ActiveProfile" || name == "PerformanceInhibited" || name == "PerformanceDegraded" ||
+            name == "Version") {
+            writer.signature("s");
+            writer.string(name == "ActiveProfile" ? active : name == "Version" ? "samsung-cli" : "");
+        } else if (name == "Actions") {
+            writer.signature("as");
+            writer.close_array(writer.open_array(4), 4);
+        } else if (name == "Profiles" || name == "ActiveProfileHolds") {
+            writer.signature("aa{sv}");
+            size_t outer = writer.open_array(4);
+            if (name == "Profiles") {
+                for (const auto& profile : available()) {
+                    size_t inner = writer.open_array(8);
+                    writer.entry("Profile", profile);
+                    writer.entry("PlatformDriver", "samsung-cli");
+                    writer.entry("Driver", "samsung-cli");
+                    writer.close_array(inner, 8);
+                }
+            } else {
+                for (const auto& hold : holds) {
+                    size_t inner = writer.open_array(8);
+                    writer.entry("Profile", hold.profile);
+                    writer.entry("Reason", hold.reason);
+                    writer.entry("ApplicationId", hold.application_id);
+                    writer.close_array(inner, 8);
+                }
+            }
+            writer.close_array(outer, 4);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void emit_changed(const std::vector<std::string>& names) {
+        for (const auto& object : OBJECTS) {
+            std::string body;
+            dbus::Writer writer(body);
+            writer.string(object.name);
+            size_t changed = writer.open_array(8);
+            for (const auto& name : names) {
+                writer.align(8);
+                writer.string(name);
+                write_property(writer, name);
+            }
+            writer.close_array(changed, 8);
+            writer.close_array(writer.open_array(4), 4);
+            dbus::Message signal;
+            signal.type = dbus::SIGNAL;
+            signal.path = object.path;
+            signal.interface = PROPERTIES;
+            signal.member = "PropertiesChanged";
+            signal.signature = "sa{sv}as";
+            bus.send(signal, body);
+        }
+    }
+
+    void emit_released(uint32_t cookie) {
+        for (const auto& object : OBJECTS) {
+            std::string body;
+            dbus::Writer(body).u32(cookie);
+            dbus::Message signal;
+            signal.type = dbus::SIGNAL;
+            signal.path = object.path;
+            signal.interface = object.name;
+            signal.member = "ProfileReleased";
+            signal.signature = "u";
+            bus.send(signal, body);
+        }
+    }
+
+    void reply(const dbus::Message& call, const std::string& signature = "", const std::string& body = "") {
+        if (call.flags & dbus::NO_REPLY_EXPECTED) return;
+        dbus::Message message;
+        message.type = dbus::METHOD_RETURN;
+        message.reply_serial = call.serial;
+        message.destination = call.sender;
+        message.signature = signature;
+        bus.send(message, body);
+    }
+
+    void reply_error(const dbus::Message& call, const std::string& name, const std::string& text) {
+        if (call.flags & dbus::NO_REPLY_EXPECTED) return;
+        dbus::Message message;
+        message.type = dbus::ERROR;
+        message.reply_serial = call.serial;
+        message.destination = call.sender;
+        message.error_name = name;
+        message.signature = "s";
+        std::string body;
+        dbus::Writer(body).string(text);
+        bus.send(message, body);
+    }
+
+    // Same path as 'perf set', which notes the change for the accounting
+    bool switch_to(const std::string& profile) {
+        if (profile == active) return true;
+        if (!profiles::apply(to_platform(profile))) return false;
+        active = profile;
+        std::cout << timestamp_now() << " ActiveProfile " << active << " (" << to_platform(active) << ")" << std::endl;
+        emit_changed({"ActiveProfile"});
+        return true;
+    }
+
+    // A power-saver hold wins over performance holds
+    bool apply_holds() {
+        if (holds.empty()) return switch_to(selected);
+        bool saver = std::any_of(holds.begin(), holds.end(), [](const Hold& h) { return h.profile == "power-saver"; });
+        return switch_to(saver ? "power-saver" : "performance");
+    }
+
+    void release(std::vector<Hold>::iterator hold) {
+        uint32_t cookie = hold->cookie;
+        std::cout << timestamp_now() << " Released " << hold->profile << " hold " << cookie << " of "
+                  << hold->application_id << std::endl;
+        holds.erase(hold);
+        emit_released(cookie);
+    }
+
+    // The mode changed in sysfs; reading also re-arms the notification
+    void refresh() {
+        std::string mode;
+        if (current.read(mode) != 0 || to_ppd(mode) == active) return;
+        active = to_ppd(mode);
+        accounting::enter(mode);
+        if (holds.empty()) selected = active;
+        std::cout << timestamp_now() << " ActiveProfile " << active << " (" << mode << ", changed outside)" << std::endl;
+        emit_changed({"ActiveProfile"});
+    }
+
+    void handle(const dbus::Message& message) {
+        if (message.type == dbus::SIGNAL) {
+            if (message.member == "NameOwnerChanged" && message.sender == "org.freedesktop.DBus" &&
+                message.signature == "sss") {
+                dbus::Reader reader = message.body();
+                std::string name = reader.string(), old_owner = reader.string(), new_owner = reader.string();
+                size_t before = holds.size();
+                for (auto hold = holds.begin(); hold != holds.end();) {
+                    if (reader.ok && new_owner.empty() && hold->owner == name) {
+                        release(hold);
+                        hold = holds.begin();
+                    } else {
+                        ++hold;
+                    }
+                }
+                if (holds.size() != before) {
+                    apply_holds();
+                    emit_changed({"ActiveProfileHolds"});
+                }
+            }
+            return;
+        }
+        if (message.type != dbus::METHOD_CALL) return;
+
+        const Object* object = object_at(message.path);
+        if (object == nullptr) {
+            reply_error(message, "org.freedesktop.DBus.Error.UnknownObject", "No object at " + message.path);
+            return;
+        }
+        dbus::Reader args = message.body();
+        const std::string& member = message.member;
+        const std::string& interface = message.interface;
+        if (interface == "org.freedesktop.DBus.Introspectable" && member == "Introspect") {
+            std::string body;
+            dbus::Writer(body).string(introspection(object->name));
+            reply(message, "s", body);
+        } else if (interface == "org.freedesktop.DBus.Peer" && member == "Ping") {
+            reply(message);
+        } else if (interface == PROPERTIES && member == "Get" && message.signature == "ss") {
+            std::string owner = args.string(), name = args.string();
+            std::string body;
+            dbus::Writer writer(body);
+            if (owner == object->name && write_property(writer, name)) {
+                reply(message, "v", body);
+            } else {
+                reply_error(message, "org.freedesktop.DBus.Error.UnknownProperty", "No property " + name);
+            }
+        } else if (interface == PROPERTIES && member == "GetAll" && message.signature == "s") {
+            std::string body;
+            dbus::Writer writer(body);
+            size_t all = writer.open_array(8);
+            if (args.string() == object->name) {
+                for (const char* name : {"ActiveProfile", "PerformanceInhibited", "PerformanceDegraded", "Profiles",
+                                         "Actions", "ActiveProfileHolds", "Version"}) {
+                    writer.align(8);
+                    writer.string(name);
+                    write_property(writer, name);
+                }
+            }
+            writer.close_array(all, 8);
+            reply(message, "a{sv}", body);
+        } else if (interface == PROPERTIES && member == "Set" && message.signature == "ssv") {
+            std::string owner = args.string(), name = args.string(), type = args.signature();
+            std::string profile = type == "s" ? args.string() : "";
+            auto profiles = available();
+            if (owner != object->name || name != "ActiveProfile") {
+                reply_error(message, "org.freedesktop.DBus.Error.PropertyReadOnly", name + " is read-only");
+            } else if (std::find(profiles.begin(), profiles.end(), profile) == profiles.end()) {
+                reply_error(message, "org.freedesktop.DBus.Error.InvalidArgs", "Invalid profile '" + profile + "'");
+            } else {
+                // An explicit choice ends every hold
+                bool had_holds = !holds.empty();
+                while (!holds.empty()) release(holds.begin());
+                selected = profile;
+                if (!switch_to(profile)) {
+                    reply_error(message, "org.freedesktop.DBus.Error.Failed", "Could not switch to " + profile);
+                    return;
+                }
+                if (had_holds) emit_changed({"ActiveProfileHolds"});
+                reply(message);
+            }
+        } else if (interface == object->name && member == "HoldProfile" && message.signature == "sss") {
+            Hold hold;
+            hold.profile = args.string();
+            hold.reason = args.string();
+            hold.application_id = args.string();
+            hold.owner = message.sender;
+            auto profiles = available();
+            if (hold.profile == "balanced" || std::find(profiles.begin(), profiles.end(), hold.profile) == profiles.end()) {
+                reply_error(message, "org.freedesktop.DBus.Error.InvalidArgs", "Cannot hold '" + hold.profile + "'");
+                return;
+            }
+            if (holds.empty()) selected = active;
+            hold.cookie = next_cookie++;
+            holds.push_back(hold);
+            std::cout << timestamp_now() << " " << hold.application_id << " holds " << hold.profile << ": "
+                      << hold.reason << std::endl;
+            apply_holds();
+            emit_changed({"ActiveProfileHolds"});
+            std::string body;
+            dbus::Writer(body).u32(hold.cookie);
+            reply(message, "u", body);
+        } else if (interface == object->name && member == "ReleaseProfile" && message.signature == "u") {
+            uint32_t cookie = args.u32();
+            auto hold = std::find_if(holds.begin(), holds.end(), [&](const Hold& h) { return h.cookie == cookie; });
+            if (hold == holds.end()) {
+                reply_error(message, "org.freedesktop.DBus.Error.InvalidArgs", "No hold with cookie " + std::to_string(cookie));
+                return;
+            }
+            release(hold);
+            apply_holds();
+            emit_changed({"ActiveProfileHolds"});
+            reply(message);
+        } else {
+            reply_error(message, "org.freedesktop.DBus.Error.UnknownMethod",
+                        "No method " + interface + "." + member + " with signature '" + message.signature + "'");
+        }
+    }
+
+    static std::string introspection(const std::string& name) {
+        return "<!DOCTYPE node PUBLIC \"-//freedesktop//DTD D-BUS Object Introspection 1.0//EN\"\n"
+               " \"http://www.freedesktop.org/standards/dbus/1.0/introspect.dtd\">\n"
+               "<node>\n"
+               "  <interface name=\"" + name + "\">\n"
+               "    <method name=\"HoldProfile\"><arg name=\"profile\" type=\"s\" direction=\"in\"/>"
+               "<arg name=\"reason\" type=\"s\" direction=\"in\"/><arg name=\"application_id\" type=\"s\" direction=\"in\"/>"
+               "<arg name=\"cookie\" type=\"u\" direction=\"out\"/></method>\n"
+               "    <method name=\"ReleaseProfile\"><arg name=\"cookie\" type=\"u\" direction=\"in\"/></method>\n"
+               "    <signal name=\"ProfileReleased\"><arg name=\"cookie\" type=\"u\"/></signal>\n"
+               "    <property name=\"ActiveProfile\" type=\"s\" access=\"readwrite\"/>\n"
+               "    <property name=\"PerformanceInhibited\" type=\"s\" access=\"read\"/>\n"
+               "    <property name=\"PerformanceDegraded\" type=\"s\" access=\"read\"/>\n"
+               "    <property name=\"Profiles\" type=\"aa{sv}\" access=\"read\"/>\n"
+               "    <property name=\"Actions\" type=\"as\" access=\"read\"/>\n"
+               "    <property name=\"ActiveProfileHolds\" type=\"aa{sv}\" access=\"read\"/>\n"
+               "    <property name=\"Version\" type=\"s\" access=\"read\"/>\n"
+               "  </interface>\n"
+               "  <interface name=\"org.freedesktop.DBus.Properties\">\n"
+               "    <method name=\"Get\"><arg type=\"s\" direction=\"in\"/><arg type=\"s\" direction=\"in\"/>"
+               "<arg type=\"v\" direction=\"out\"/></method>\n"
+               "    <method name=\"GetAll\"><arg type=\"s\" direction=\"in\"/><arg type=\"a{sv}\" direction=\"out\"/></method>\n"
+               "    <method name=\"Set\"><arg type=\"s\" direction=\"in\"/><arg type=\"s\" direction=\"in\"/>"
+               "<arg type=\"v\" direction=\"in\"/></method>\n"
+               "    <signal name=\"PropertiesChanged\"><arg type=\"s\"/><arg type=\"a{sv}\"/><arg type=\"as\"/></signal>\n"
+               "  </interface>\n"
+               "  <interface name=\"org.freedesktop.DBus.Introspectable\">\n"
+               "    <method name=\"Introspect\"><arg type=\"s\" direction=\"out\"/></method>\n"
+               "  </interface>\n"
+               "</node>\n";
+    }
+};
+
+bool serve_power_profiles(const std::string& address) {
+    PowerProfilesService service;
+    return service.run(address);
+}
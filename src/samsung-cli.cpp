@@ -1,492 +1,6107 @@
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <stdexcept>
+#include <sstream>
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <cstddef>
+#include <cctype>
+#include <cinttypes>
 #include <unistd.h> // For getopt
 #include <sys/stat.h>
+#include <grp.h>
 #include <map>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <functional>
+#include <tuple>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <cerrno>
+#include <algorithm>
 #include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <csignal>
+#include <ctime>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
+#include <linux/input.h>
+
+#include "dbus.h"
+#include "samsung-cli.h"
 
 const std::string POWER_PATH = "/sys/class/power_supply/BAT1/charge_control_end_threshold";
 const std::string FAN_PATH = "/sys/bus/acpi/devices/PNP0C0B:00/fan_speed_rpm";
 const std::string PLATFORM_PROFILE_PATH = "/sys/firmware/acpi/platform_profile";
 const std::string PLATFORM_PROFILE_CHOICES_PATH = "/sys/firmware/acpi/platform_profile_choices";
+const std::string BATTERY_POWER_NOW_PATH = "/sys/class/power_supply/BAT1/power_now";
+const std::string BATTERY_ENERGY_NOW_PATH = "/sys/class/power_supply/BAT1/energy_now";
+const std::string BATTERY_STATUS_PATH = "/sys/class/power_supply/BAT1/status";
+const std::string BATTERY_ENERGY_FULL_PATH = "/sys/class/power_supply/BAT1/energy_full";
+const std::string BATTERY_CAPACITY_PATH = "/sys/class/power_supply/BAT1/capacity";
+const std::string POWER_SUPPLY_PATH = "/sys/class/power_supply";
+const std::string POWERCAP_PATH = "/sys/class/powercap";
+const std::string CPU_PATH = "/sys/devices/system/cpu";
+const std::string CGROUP_ROOT = "/sys/fs/cgroup";
+const std::string STATE_DIR = "/var/lib/samsung-cli";
+const std::string PLATFORM_PROFILE_CLASS_PATH = "/sys/class/platform-profile";
+const std::string FIRMWARE_ATTRIBUTES_PATH = "/sys/class/firmware-attributes/samsung-galaxybook/attributes";
+const std::string ACPI_DEVICES_PATH = "/sys/bus/acpi/devices";
+const std::string HWMON_PATH = "/sys/class/hwmon";
+const std::string IIO_DEVICES_PATH = "/sys/bus/iio/devices";
+const std::string INPUT_DEVICES_PATH = "/dev/input";
+const std::string EXTRA_BUTTONS_NAME = "Samsung Galaxy Book";
+const std::string UDEV_RULES_PATH = "/etc/udev/rules.d/70-samsung-cli.rules";
+const std::string TMPFILES_PATH = "/etc/tmpfiles.d/samsung-cli.conf";
+const std::string UDEV_LINKS_PATH = "/dev/samsung-galaxybook";
 const std::string KBD_BACKLIGHT_PATH = "/sys/class/leds/samsung-galaxybook::kbd_backlight/brightness";
 
-// Note: The keyboard backlight is affected by:
-// 1. Ambient light sensor (automatically adjusts based on lighting conditions)
-// 2. GNOME's automatic backlight control (reduces brightness after idle)
-// 3. Manual control through this tool (values 0-3)
+// Note: The keyboard backlight is affected by:
+// 1. Ambient light sensor (automatically adjusts based on lighting conditions)
+// 2. GNOME's automatic backlight control (reduces brightness after idle)
+// 3. Manual control through this tool (values 0-3)
+
+// Where each driver feature lives. The upstream samsung-galaxybook driver
+// exposes the settings as firmware attributes (with allow_recording inverted
+// as block_recording) and registers its profile in the platform-profile class.
+struct FeaturePaths {
+    std::string allow_recording;
+    std::string start_on_lid_open;
+    std::string usb_charge;
+    bool recording_inverted = false;
+    // The legacy platform_profile exists and fans a write out to every handler
+    bool legacy_profile = false;
+    // Directory of every platform-profile class handler
+    std::vector<std::string> profile_handlers;
+};
+
+// Directory every sysfs and device path is resolved under, from
+// SAMSUNG_CLI_ROOT, so commands can run against a fake tree. Empty normally.
+const std::string& root_prefix() {
+    static const std::string prefix = std::getenv("SAMSUNG_CLI_ROOT") != nullptr ? std::getenv("SAMSUNG_CLI_ROOT") : "";
+    return prefix;
+}
+
+// Names of the entries in a directory, empty if it doesn't exist
+std::vector<std::string> list_directory(const std::string& path) {
+    std::vector<std::string> names;
+    DIR* dir = opendir((root_prefix() + path).c_str());
+    if (dir == nullptr) return names;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+struct FeatureNames {
+    const char* name;
+    const char* upstream_name;
+    std::string FeaturePaths::*path;
+};
+
+const FeatureNames FEATURES[] = {
+    {"allow_recording", "block_recording", &FeaturePaths::allow_recording},
+    {"start_on_lid_open", "power_on_lid_open", &FeaturePaths::start_on_lid_open},
+    {"usb_charge", "usb_charging", &FeaturePaths::usb_charge},
+};
+
+const std::string GALAXYBOOK_DRIVER_PATH = "/sys/bus/platform/drivers/samsung-galaxybook";
+
+// Every platform-profile class handler, and whether the legacy
+// platform_profile is there to fan a write out to all of them. Kernels
+// before the class have only the legacy file.
+void detect_profile_paths(FeaturePaths& paths) {
+    for (const auto& name : list_directory(PLATFORM_PROFILE_CLASS_PATH)) {
+        paths.profile_handlers.push_back(PLATFORM_PROFILE_CLASS_PATH + "/" + name);
+    }
+    paths.legacy_profile = paths.profile_handlers.empty() || access((root_prefix() + PLATFORM_PROFILE_PATH).c_str(), F_OK) == 0;
+}
+
+// Resolve all features with one listing of each candidate location instead
+// of probing every feature at every location
+FeaturePaths detect_feature_paths() {
+    FeaturePaths paths;
+    const std::string& driver_path = GALAXYBOOK_DRIVER_PATH;
+    std::vector<std::string> udev = list_directory(UDEV_LINKS_PATH);
+    std::vector<std::string> firmware = list_directory(FIRMWARE_ATTRIBUTES_PATH);
+    std::vector<std::string> device;
+    std::string device_path;
+    for (const auto& name : list_directory(driver_path)) {
+        if (name.compare(0, 3, "SAM") == 0) {
+            device_path = driver_path + "/" + name;
+            device = list_directory(device_path);
+            break;
+        }
+    }
+    auto contains = [](const std::vector<std::string>& names, const std::string& name) {
+        return std::binary_search(names.begin(), names.end(), name);
+    };
+
+    for (const auto& feature : FEATURES) {
+        std::string& path = paths.*feature.path;
+        // Try the udev rule path first, then the upstream firmware attributes
+        // and the out-of-tree platform driver, falling back to the ACPI path
+        if (contains(udev, feature.name)) {
+            path = UDEV_LINKS_PATH + "/" + feature.name;
+        } else if (contains(firmware, feature.upstream_name)) {
+            path = FIRMWARE_ATTRIBUTES_PATH + "/" + feature.upstream_name + "/current_value";
+            if (feature.path == &FeaturePaths::allow_recording) paths.recording_inverted = true;
+        } else if (contains(device, feature.name)) {
+            path = device_path + "/" + feature.name;
+        } else {
+            path = "/sys/bus/acpi/devices/SCAI:00/" + std::string(feature.name);
+        }
+    }
+
+    detect_profile_paths(paths);
+    return paths;
+}
+
+// Detected on first use and cached for the rest of the run
+const FeaturePaths& feature_paths() {
+    static const FeaturePaths paths = detect_feature_paths();
+    return paths;
+}
+
+// Helper functions for file operations
+namespace file_ops {
+    // Backend that talks to the real attribute files
+    class SysfsBackend : public Backend {
+    public:
+        int access(const std::string& path, bool write) override {
+            return ::access((root_prefix() + path).c_str(), write ? W_OK : R_OK) == 0 ? 0 : errno;
+        }
+
+        int read(const std::string& path, std::string& value) override {
+            int fd = ::open((root_prefix() + path).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return errno;
+            // sysfs attributes never exceed a page
+            char buf[4096];
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            int err = n < 0 ? errno : 0;
+            ::close(fd);
+            if (err != 0) return err;
+            value.assign(buf, static_cast<size_t>(n));
+            // Keep only the first line, like std::getline did
+            size_t newline = value.find('\n');
+            if (newline != std::string::npos) value.resize(newline);
+            return 0;
+        }
+
+        int write(const std::string& path, const std::string& value) override {
+            int fd = ::open((root_prefix() + path).c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+            if (fd < 0) return errno;
+            ssize_t n = ::write(fd, value.data(), value.size());
+            int err = n < 0 ? errno : 0;
+            if (::close(fd) != 0 && err == 0) err = errno;
+            return err;
+        }
+
+        int open_handle(const std::string& path, bool write, int& handle) override {
+            handle = ::open((root_prefix() + path).c_str(), (write ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+            return handle < 0 ? errno : 0;
+        }
+
+        // sysfs regenerates the value on every read at offset 0
+        int read_handle(int handle, char* buf, size_t size, size_t& length) override {
+            ssize_t n = ::pread(handle, buf, size, 0);
+            if (n < 0) return errno;
+            length = static_cast<size_t>(n);
+            return 0;
+        }
+
+        int write_handle(int handle, const char* buf, size_t length) override {
+            return ::pwrite(handle, buf, length, 0) < 0 ? errno : 0;
+        }
+
+        void close_handle(int handle) override {
+            ::close(handle);
+        }
+
+        int poll_fd(int handle) override { return handle; }
+    };
+
+    // Random latency used by the simulator, e.g. "fixed:5", "uniform:1:20",
+    // "normal:10:3" or "exp:8" (all values in milliseconds)
+    class LatencyDistribution {
+    public:
+        static bool parse(const std::string& spec, LatencyDistribution& dist) {
+            std::vector<double> params;
+            size_t colon = spec.find(':');
+            std::string kind = spec.substr(0, colon);
+            while (colon != std::string::npos) {
+                size_t next = spec.find(':', colon + 1);
+                try {
+                    params.push_back(std::stod(spec.substr(colon + 1, next - colon - 1)));
+                } catch (...) {
+                    return false;
+                }
+                colon = next;
+            }
+            for (double p : params) {
+                if (p < 0) return false;
+            }
+
+            if (kind == "none" && params.empty()) {
+                dist.kind = Kind::None;
+            } else if (kind == "fixed" && params.size() == 1) {
+                dist.kind = Kind::Fixed;
+            } else if (kind == "uniform" && params.size() == 2 && params[0] <= params[1]) {
+                dist.kind = Kind::Uniform;
+            } else if (kind == "normal" && params.size() == 2) {
+                dist.kind = Kind::Normal;
+            } else if (kind == "exp" && params.size() == 1 && params[0] > 0) {
+                dist.kind = Kind::Exponential;
+            } else {
+                return false;
+            }
+            params.resize(2, 0.0);
+            dist.a = params[0];
+            dist.b = params[1];
+            return true;
+        }
+
+        std::chrono::nanoseconds sample(std::mt19937& rng) const {
+            double ms = 0.0;
+            switch (kind) {
+                case Kind::None: break;
+                case Kind::Fixed: ms = a; break;
+                case Kind::Uniform: ms = std::uniform_real_distribution<double>(a, b)(rng); break;
+                case Kind::Normal: ms = std::max(0.0, std::normal_distribution<double>(a, b)(rng)); break;
+                case Kind::Exponential: ms = std::exponential_distribution<double>(1.0 / a)(rng); break;
+            }
+            return std::chrono::nanoseconds(static_cast<int64_t>(ms * 1e6));
+        }
+
+    private:
+        enum class Kind { None, Fixed, Uniform, Normal, Exponential };
+        Kind kind = Kind::None;
+        double a = 0.0;
+        double b = 0.0;
+    };
+
+    // In-process model of the EC and its attributes. Attributes are matched
+    // by file name so the simulator works whatever path detection picked.
+    class SimulatedBackend : public Backend {
+    public:
+        struct Options {
+            uint32_t seed = 1;
+            double ebusy_rate = 0.0;         // Probability of EBUSY per operation
+            double eio_rate = 0.0;           // Probability of EIO per operation
+            LatencyDistribution acpi_latency; // SCAI method calls (toggles, profile, kbd)
+            LatencyDistribution fan_latency;  // Fan _FST evaluation
+            double fan_tau = 4.0;            // Fan time constant in seconds
+            bool virtual_clock = false;      // Advance a virtual clock instead of sleeping
+            std::string profile = "balanced";
+        };
+
+        // Parse a comma separated option list such as
+        // "seed=7,ebusy=0.05,eio=0.01,latency=exp:8,fan_latency=fixed:2,clock=virtual"
+        static bool parse_options(const std::string& spec, Options& opts) {
+            size_t start = 0;
+            while (start < spec.size()) {
+                size_t end = spec.find(',', start);
+                if (end == std::string::npos) end = spec.size();
+                std::string item = spec.substr(start, end - start);
+                start = end + 1;
+                if (item.empty()) continue;
+
+                size_t eq = item.find('=');
+                if (eq == std::string::npos) {
+                    std::cerr << "Error: Invalid simulator option '" << item << "'" << std::endl;
+                    return false;
+                }
+                std::string key = item.substr(0, eq);
+                std::string value = item.substr(eq + 1);
+                bool ok = true;
+                try {
+                    if (key == "seed") {
+                        opts.seed = static_cast<uint32_t>(std::stoul(value));
+                    } else if (key == "ebusy") {
+                        opts.ebusy_rate = std::stod(value);
+                        ok = opts.ebusy_rate >= 0 && opts.ebusy_rate <= 1;
+                    } else if (key == "eio") {
+                        opts.eio_rate = std::stod(value);
+                        ok = opts.eio_rate >= 0 && opts.eio_rate <= 1;
+                    } else if (key == "latency") {
+                        ok = LatencyDistribution::parse(value, opts.acpi_latency);
+                    } else if (key == "fan_latency") {
+                        ok = LatencyDistribution::parse(value, opts.fan_latency);
+                    } else if (key == "fan_tau") {
+                        opts.fan_tau = std::stod(value);
+                        ok = opts.fan_tau > 0;
+                    } else if (key == "clock") {
+                        ok = value == "real" || value == "virtual";
+                        opts.virtual_clock = value == "virtual";
+                    } else if (key == "profile") {
+                        opts.profile = value;
+                        ok = fan_target(value) >= 0;
+                    } else {
+                        ok = false;
+                    }
+                } catch (...) {
+                    ok = false;
+                }
+                if (!ok) {
+                    std::cerr << "Error: Invalid simulator option '" << item << "'" << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        explicit SimulatedBackend(const Options& options)
+            : opts(options), rng(options.seed), start(std::chrono::steady_clock::now()) {
+            values["charge_control_end_threshold"] = "80";
+            values["platform_profile"] = opts.profile;
+            values["platform_profile_choices"] = "low-power quiet balanced performance";
+            values["brightness"] = "1";
+            values["max_brightness"] = "3";
+            values["allow_recording"] = "1";
+            values["start_on_lid_open"] = "0";
+            values["usb_charge"] = "1";
+            values["online"] = "1";
+            values["capacity"] = "75";
+            values["status"] = "Charging";
+            fan_from = fan_target(opts.profile);
+            profile_value = values.find("platform_profile");
+        }
+
+        int access(const std::string& path, bool write) override {
+            std::string name = attribute_name(path);
+            if (name == "fan_speed_rpm") return write ? EACCES : 0;
+            if (!values.count(name)) return ENOENT;
+            bool read_only = name == "platform_profile_choices" || name == "max_brightness" || name == "online" ||
+                             name == "capacity" || name == "status";
+            return write && read_only ? EACCES : 0;
+        }
+
+        int read(const std::string& path, std::string& value) override {
+            std::string name = attribute_name(path);
+            if (name == "fan_speed_rpm") {
+                delay(opts.fan_latency);
+                if (int err = inject_fault()) return err;
+                value = std::to_string(fan_rpm());
+                return 0;
+            }
+
+            auto it = values.find(name);
+            if (it == values.end()) return ENOENT;
+            if (is_acpi_backed(name)) {
+                delay(opts.acpi_latency);
+                if (int err = inject_fault()) return err;
+            }
+            value = it->second;
+            return 0;
+        }
+
+        int write(const std::string& path, const std::string& value) override {
+            std::string name = attribute_name(path);
+            auto it = values.find(name);
+            if (it == values.end()) return ENOENT;
+            if (access(path, true) != 0) return EACCES;
+            if (!is_valid(name, value)) return EINVAL;
+            if (is_acpi_backed(name)) {
+                delay(opts.acpi_latency);
+                if (int err = inject_fault()) return err;
+            }
+
+            if (name == "platform_profile" && value != it->second) {
+                // The fan starts ramping towards the new target from where it is now
+                fan_from = fan_rpm();
+                fan_since = now();
+            }
+            it->second = value;
+            return 0;
+        }
+
+        // Handles resolve the attribute name once, so reads through them do
+        // no string work or allocation, like pread on real sysfs
+        int open_handle(const std::string& path, bool write, int& handle) override {
+            if (int err = access(path, write)) return err;
+            handle = static_cast<int>(handle_paths.size());
+            handle_paths.push_back(attribute_name(path));
+            return 0;
+        }
+
+        int read_handle(int handle, char* buf, size_t size, size_t& length) override {
+            const std::string& name = handle_paths[static_cast<size_t>(handle)];
+            if (name == "fan_speed_rpm") {
+                delay(opts.fan_latency);
+                if (int err = inject_fault()) return err;
+                int n = std::snprintf(buf, size, "%d", fan_rpm());
+                length = std::min(static_cast<size_t>(std::max(n, 0)), size);
+                return 0;
+            }
+            auto it = values.find(name);
+            if (it == values.end()) return ENOENT;
+            if (is_acpi_backed(name)) {
+                delay(opts.acpi_latency);
+                if (int err = inject_fault()) return err;
+            }
+            length = std::min(it->second.size(), size);
+            std::memcpy(buf, it->second.data(), length);
+            return 0;
+        }
+
+    private:
+        static std::string attribute_name(const std::string& path) {
+            size_t slash = path.rfind('/');
+            return slash == std::string::npos ? path : path.substr(slash + 1);
+        }
+
+        static bool is_acpi_backed(const std::string& name) {
+            return name == "allow_recording" || name == "start_on_lid_open" || name == "usb_charge" ||
+                   name == "platform_profile" || name == "brightness";
+        }
+
+        // Steady-state fan speed for each profile, -1 for unknown profiles
+        static int fan_target(const std::string& profile) {
+            if (profile == "low-power") return 0;
+            if (profile == "quiet") return 1800;
+            if (profile == "balanced") return 2800;
+            if (profile == "performance") return 4300;
+            return -1;
+        }
+
+        bool is_valid(const std::string& name, const std::string& value) const {
+            if (name == "platform_profile") return fan_target(value) >= 0;
+            int val;
+            try {
+                size_t pos;
+                val = std::stoi(value, &pos);
+                if (pos != value.size()) return false;
+            } catch (...) {
+                return false;
+            }
+            if (name == "charge_control_end_threshold") return val >= 1 && val <= 100;
+            if (name == "brightness") return val >= 0 && val <= 3;
+            return val == 0 || val == 1;
+        }
+
+        std::chrono::nanoseconds now() const {
+            if (opts.virtual_clock) return virtual_now;
+            return std::chrono::steady_clock::now() - start;
+        }
+
+        void delay(const LatencyDistribution& dist) {
+            std::chrono::nanoseconds latency = dist.sample(rng);
+            if (latency.count() == 0) return;
+            if (opts.virtual_clock) {
+                virtual_now += latency;
+            } else {
+                std::this_thread::sleep_for(latency);
+            }
+        }
+
+        int inject_fault() {
+            double roll = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+            if (roll < opts.ebusy_rate) return EBUSY;
+            if (roll < opts.ebusy_rate + opts.eio_rate) return EIO;
+            return 0;
+        }
+
+        // First-order lag towards the current profile's target plus a little
+        // deterministic jitter, so polling sees a realistic ramp
+        int fan_rpm() {
+            double target = fan_target(profile_value->second);
+            double elapsed = std::chrono::duration<double>(now() - fan_since).count();
+            double rpm = target + (fan_from - target) * std::exp(-elapsed / opts.fan_tau);
+            if (rpm > 0) rpm += std::normal_distribution<double>(0.0, 15.0)(rng);
+            return std::max(0, static_cast<int>(std::lround(rpm)));
+        }
+
+        Options opts;
+        std::mt19937 rng;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds virtual_now{0};
+        std::map<std::string, std::string> values;
+        std::map<std::string, std::string>::iterator profile_value;
+        double fan_from = 0.0;
+        std::chrono::nanoseconds fan_since{0};
+    };
+
+    // A single captured attribute access
+    struct TraceRecord {
+        enum class Op : uint8_t { Access = 1, AccessWrite = 2, Read = 3, Write = 4 };
+        Op op;
+        std::string path;
+        int64_t time_ns;     // CLOCK_REALTIME when the operation started
+        int64_t latency_ns;  // Time the backend took to complete it
+        int err;
+        std::string value;   // Value read or written
+    };
+
+    // Compact binary trace format. After the magic, the file is a sequence of
+    // tagged entries; integers are LEB128 varints. Each process appends its
+    // own session, so path ids and time deltas restart with every session:
+    //   0x01 session   u64 start time (ns, little endian)
+    //   0x02 path      id, length, bytes
+    //   0x10+op        path id, delta to previous op (ns), latency (ns),
+    //                  errno, value length, value bytes
+    namespace trace {
+        const char MAGIC[8] = {'S', 'G', 'B', 'T', 'R', 'C', '0', '1'};
+        const uint8_t TAG_SESSION = 0x01;
+        const uint8_t TAG_PATH = 0x02;
+        const uint8_t TAG_OP = 0x10;
+
+        void put_varint(std::string& out, uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        bool get_varint(const std::string& in, size_t& pos, uint64_t& value) {
+            value = 0;
+            for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(in[pos++]);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) return true;
+            }
+            return false;
+        }
+
+        bool load(const std::string& path, std::vector<TraceRecord>& records) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open()) {
+                std::cerr << "Error: Could not open " << path << std::endl;
+                return false;
+            }
+            std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (data.size() < sizeof(MAGIC) || data.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0) {
+                std::cerr << "Error: " << path << " is not a samsung-cli trace" << std::endl;
+                return false;
+            }
+
+            std::vector<std::string> paths;
+            int64_t time = 0;
+            size_t pos = sizeof(MAGIC);
+            while (pos < data.size()) {
+                uint8_t tag = static_cast<uint8_t>(data[pos++]);
+                bool ok = true;
+                if (tag == TAG_SESSION) {
+                    ok = pos + 8 <= data.size();
+                    if (ok) {
+                        uint64_t start = 0;
+                        for (int i = 7; i >= 0; --i) start = (start << 8) | static_cast<uint8_t>(data[pos + i]);
+                        time = static_cast<int64_t>(start);
+                        pos += 8;
+                        paths.clear();
+                    }
+                } else if (tag == TAG_PATH) {
+                    uint64_t id, len;
+                    ok = get_varint(data, pos, id) && get_varint(data, pos, len) &&
+                         id == paths.size() && pos + len <= data.size();
+                    if (ok) {
+                        paths.push_back(data.substr(pos, len));
+                        pos += len;
+                    }
+                } else if (tag > TAG_OP && tag <= TAG_OP + 4) {
+                    uint64_t id, delta, latency, err, len;
+                    ok = get_varint(data, pos, id) && get_varint(data, pos, delta) &&
+                         get_varint(data, pos, latency) && get_varint(data, pos, err) &&
+                         get_varint(data, pos, len) && id < paths.size() && pos + len <= data.size();
+                    if (ok) {
+                        time += static_cast<int64_t>(delta);
+                        records.push_back({static_cast<TraceRecord::Op>(tag - TAG_OP), paths[id], time,
+                                           static_cast<int64_t>(latency), static_cast<int>(err),
+                                           data.substr(pos, len)});
+                        pos += len;
+                    }
+                } else {
+                    ok = false;
+                }
+                if (!ok) {
+                    std::cerr << "Error: Corrupt trace " << path << " at offset " << pos << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    // Wraps another backend and appends every operation, with its timing,
+    // to a trace file
+    class TraceRecorder : public Backend {
+    public:
+        TraceRecorder(std::unique_ptr<Backend> inner_backend, const std::string& path)
+            : inner(std::move(inner_backend)),
+              session_start(std::chrono::steady_clock::now()) {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                open_error = errno;
+                return;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size == 0) buffer.append(trace::MAGIC, sizeof(trace::MAGIC));
+
+            uint64_t start = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count());
+            buffer.push_back(static_cast<char>(trace::TAG_SESSION));
+            for (int i = 0; i < 8; ++i) buffer.push_back(static_cast<char>((start >> (8 * i)) & 0xff));
+        }
+
+        ~TraceRecorder() override {
+            flush();
+            if (fd >= 0) ::close(fd);
+        }
+
+        // 0 if the trace file is open, otherwise the errno from opening it
+        int error() const { return open_error; }
+
+        int access(const std::string& path, bool write) override {
+            auto begin = std::chrono::steady_clock::now();
+            int err = inner->access(path, write);
+            append(write ? TraceRecord::Op::AccessWrite : TraceRecord::Op::Access, path, begin, err, "");
+            return err;
+        }
+
+        int read(const std::string& path, std::string& value) override {
+            auto begin = std::chrono::steady_clock::now();
+            int err = inner->read(path, value);
+            append(TraceRecord::Op::Read, path, begin, err, err == 0 ? value : "");
+            return err;
+        }
+
+        int write(const std::string& path, const std::string& value) override {
+            auto begin = std::chrono::steady_clock::now();
+            int err = inner->write(path, value);
+            append(TraceRecord::Op::Write, path, begin, err, value);
+            return err;
+        }
+
+        int open_handle(const std::string& path, bool write, int& handle) override {
+            auto begin = std::chrono::steady_clock::now();
+            int err = inner->open_handle(path, write, handle);
+            append(write ? TraceRecord::Op::AccessWrite : TraceRecord::Op::Access, path, begin, err, "");
+            if (err == 0) handle_paths_by_id[handle] = path;
+            return err;
+        }
+
+        int read_handle(int handle, char* buf, size_t size, size_t& length) override {
+            auto begin = std::chrono::steady_clock::now();
+            int err = inner->read_handle(handle, buf, size, length);
+            std::string value = err == 0 ? std::string(buf, length) : "";
+            size_t newline = value.find('\n');
+            if (newline != std::string::npos) value.resize(newline);
+            append(TraceRecord::Op::Read, handle_paths_by_id[handle], begin, err, value);
+            return err;
+        }
+
+        int write_handle(int handle, const char* buf, size_t length) override {
+            auto begin = std::chrono::steady_clock::now();
+            int err = inner->write_handle(handle, buf, length);
+            append(TraceRecord::Op::Write, handle_paths_by_id[handle], begin, err, std::string(buf, length));
+            return err;
+        }
+
+        void close_handle(int handle) override {
+            inner->close_handle(handle);
+            handle_paths_by_id.erase(handle);
+        }
+
+        int poll_fd(int handle) override { return inner->poll_fd(handle); }
+
+    private:
+        void append(TraceRecord::Op op, const std::string& path,
+                    std::chrono::steady_clock::time_point begin, int err, const std::string& value) {
+            auto end = std::chrono::steady_clock::now();
+            auto it = path_ids.find(path);
+            if (it == path_ids.end()) {
+                it = path_ids.emplace(path, path_ids.size()).first;
+                buffer.push_back(static_cast<char>(trace::TAG_PATH));
+                trace::put_varint(buffer, it->second);
+                trace::put_varint(buffer, path.size());
+                buffer += path;
+            }
+
+            int64_t offset = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - session_start).count();
+            buffer.push_back(static_cast<char>(trace::TAG_OP + static_cast<uint8_t>(op)));
+            trace::put_varint(buffer, it->second);
+            trace::put_varint(buffer, static_cast<uint64_t>(offset - last_offset));
+            trace::put_varint(buffer, static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()));
+            trace::put_varint(buffer, static_cast<uint64_t>(err));
+            trace::put_varint(buffer, value.size());
+            buffer += value;
+            last_offset = offset;
+
+            if (buffer.size() >= 64 * 1024) flush();
+        }
+
+        void flush() {
+            if (fd < 0 || buffer.empty()) return;
+            // O_APPEND keeps concurrent sessions from interleaving within a write
+            if (::write(fd, buffer.data(), buffer.size()) < 0) {
+                std::cerr << "Warning: Could not write trace: " << std::strerror(errno) << std::endl;
+            }
+            buffer.clear();
+        }
+
+        std::unique_ptr<Backend> inner;
+        std::chrono::steady_clock::time_point session_start;
+        int64_t last_offset = 0;
+        int fd = -1;
+        int open_error = 0;
+        std::string buffer;
+        std::map<std::string, uint64_t> path_ids;
+        std::map<int, std::string> handle_paths_by_id;
+    };
+
+    // Serves a recorded trace back to the commands. With a positive speed,
+    // a read returns the latest value recorded at or before the scaled
+    // elapsed time and waits out the recorded latency; with speed 0 reads
+    // consume the recorded values in order as fast as possible. Writes are
+    // acknowledged with the recorded result but do not change later reads.
+    class ReplayBackend : public Backend {
+    public:
+        ReplayBackend(std::vector<TraceRecord> trace_records, double replay_speed)
+            : records(std::move(trace_records)), speed(replay_speed),
+              start(std::chrono::steady_clock::now()) {
+            if (!records.empty()) first_time = records.front().time_ns;
+            for (size_t i = 0; i < records.size(); ++i) {
+                const TraceRecord& record = records[i];
+                index[{record.op, record.path}].push_back(i);
+                std::string name = record.path.substr(record.path.rfind('/') + 1);
+                index[{record.op, name}].push_back(i);
+            }
+        }
+
+        int access(const std::string& path, bool write) override {
+            const TraceRecord* record = next(write ? TraceRecord::Op::AccessWrite : TraceRecord::Op::Access, path);
+            if (record != nullptr) return record->err;
+            // Paths that were read in the trace exist even without access records
+            return next(TraceRecord::Op::Read, path, false) != nullptr ? 0 : ENOENT;
+        }
+
+        int read(const std::string& path, std::string& value) override {
+            const TraceRecord* record = next(TraceRecord::Op::Read, path);
+            if (record == nullptr) return ENOENT;
+            if (record->err == 0) value = record->value;
+            return record->err;
+        }
+
+        int write(const std::string& path, const std::string&) override {
+            const TraceRecord* record = next(TraceRecord::Op::Write, path);
+            return record != nullptr ? record->err : 0;
+        }
+
+    private:
+        using Key = std::pair<TraceRecord::Op, std::string>;
+
+        // Pick the record for this access, falling back to a match on the
+        // attribute name when detection resolved a different path
+        const TraceRecord* next(TraceRecord::Op op, const std::string& path, bool consume = true) {
+            auto it = index.find({op, path});
+            if (it == index.end()) it = index.find({op, path.substr(path.rfind('/') + 1)});
+            if (it == index.end()) return nullptr;
+            const std::vector<size_t>& candidates = it->second;
+
+            size_t& cursor = cursors[it->first];
+            const TraceRecord* record;
+            if (speed > 0) {
+                // Latest record not after the replay clock
+                int64_t now = first_time + static_cast<int64_t>(
+                    std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() * speed);
+                while (cursor + 1 < candidates.size() && records[candidates[cursor + 1]].time_ns <= now) ++cursor;
+                record = &records[candidates[cursor]];
+            } else {
+                record = &records[candidates[std::min(cursor, candidates.size() - 1)]];
+                if (consume && cursor < candidates.size()) ++cursor;
+            }
+
+            if (consume && speed > 0 && record->latency_ns > 0) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(
+                    static_cast<int64_t>(record->latency_ns / speed)));
+            }
+            return record;
+        }
+
+        std::vector<TraceRecord> records;
+        double speed;
+        std::chrono::steady_clock::time_point start;
+        int64_t first_time = 0;
+        std::map<Key, std::vector<size_t>> index;
+        std::map<Key, size_t> cursors;
+    };
+
+    std::unique_ptr<Backend>& active_backend() {
+        static std::unique_ptr<Backend> backend = std::make_unique<SysfsBackend>();
+        return backend;
+    }
+
+    Backend& backend() {
+        return *active_backend();
+    }
+
+    void set_backend(std::unique_ptr<Backend> backend) {
+        active_backend() = std::move(backend);
+    }
+
+    // Select the backend from SAMSUNG_CLI_BACKEND ("sysfs", "sim" or
+    // "replay"). The simulator is tuned through SAMSUNG_CLI_SIM, replay reads
+    // SAMSUNG_CLI_REPLAY at SAMSUNG_CLI_REPLAY_SPEED, and SAMSUNG_CLI_TRACE
+    // records every operation of the selected backend.
+    bool configure_backend() {
+        const char* name = std::getenv("SAMSUNG_CLI_BACKEND");
+        if (name == nullptr || std::strcmp(name, "sysfs") == 0) {
+            // Keep the default backend
+        } else if (std::strcmp(name, "sim") == 0) {
+            SimulatedBackend::Options opts;
+            const char* spec = std::getenv("SAMSUNG_CLI_SIM");
+            if (spec != nullptr && !SimulatedBackend::parse_options(spec, opts)) return false;
+            set_backend(std::make_unique<SimulatedBackend>(opts));
+        } else if (std::strcmp(name, "replay") == 0) {
+            const char* trace_path = std::getenv("SAMSUNG_CLI_REPLAY");
+            if (trace_path == nullptr) {
+                std::cerr << "Error: SAMSUNG_CLI_REPLAY must name a trace file" << std::endl;
+                return false;
+            }
+            double speed = 1.0;
+            if (const char* value = std::getenv("SAMSUNG_CLI_REPLAY_SPEED")) {
+                try {
+                    speed = std::stod(value);
+                } catch (...) {
+                    speed = -1.0;
+                }
+                if (speed < 0) {
+                    std::cerr << "Error: Invalid replay speed '" << value << "'" << std::endl;
+                    return false;
+                }
+            }
+            std::vector<TraceRecord> records;
+            if (!trace::load(trace_path, records)) return false;
+            set_backend(std::make_unique<ReplayBackend>(std::move(records), speed));
+        } else {
+            std::cerr << "Error: Unknown backend '" << name << "'. Use 'sysfs', 'sim' or 'replay'." << std::endl;
+            return false;
+        }
+
+        if (const char* trace_path = std::getenv("SAMSUNG_CLI_TRACE")) {
+            auto recorder = std::make_unique<TraceRecorder>(std::move(active_backend()), trace_path);
+            if (recorder->error() != 0) {
+                std::cerr << "Error: Could not open trace " << trace_path << ": " << std::strerror(recorder->error()) << std::endl;
+                return false;
+            }
+            set_backend(std::move(recorder));
+        }
+        return true;
+    }
+
+    bool check_permissions(const std::string& path, bool write = false) {
+        if (backend().access(path, write) != 0) {
+            std::cerr << "Error: Permission denied. Run with sudo, or let a group change settings with"
+                      << " 'sudo samsung-cli install-udev'." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool read_file(const std::string& path, std::string& value) {
+        int err = backend().read(path, value);
+        if (err != 0) {
+            std::cerr << "Error: Could not open " << path << ": " << std::strerror(err) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool write_file(const std::string& path, const std::string& value) {
+        if (!check_permissions(path, true)) return false;
+
+        int err = backend().write(path, value);
+        if (err != 0) {
+            std::cerr << "Error: Could not write to " << path << ": " << std::strerror(err) << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+// Owns a file descriptor and closes it when it goes out of scope
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd = -1) : fd(fd) {}
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+    ~FileDescriptor() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    int get() const { return fd; }
+
+    // Close the descriptor early
+    void reset() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+private:
+    int fd;
+};
+
+// Stop flag for long running modes, set by SIGINT and SIGTERM. The handler
+// is installed without SA_RESTART so blocking waits return with EINTR.
+namespace signals {
+    volatile sig_atomic_t stop_requested = 0;
+
+    void install_stop_handlers() {
+        struct sigaction action = {};
+        action.sa_handler = [](int) { stop_requested = 1; };
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+}
+
+// Time and energy spent in each platform profile, kept in a small state file
+// that survives reboots. Mode changes are only noted in memory; long-running
+// commands merge them into the file on a timer and at exit. Every checkpoint
+// is a locked read-modify-write followed by an atomic rename that credits
+// only time after the file's last update, so several running commands can
+// checkpoint without double counting.
+namespace accounting {
+    struct ProfileTotals {
+        double seconds = 0.0;
+        double package_j = 0.0;  // RAPL package energy
+        double battery_j = 0.0;  // Battery energy drained while discharging
+    };
+
+    struct Checkpoint {
+        std::string boot_id;
+        double updated = 0.0;  // CLOCK_MONOTONIC of the last update in that boot
+        std::string current;
+        std::map<std::string, ProfileTotals> profiles;
+    };
+
+    std::string state_dir() {
+        const char* dir = std::getenv("SAMSUNG_CLI_STATE_DIR");
+        return dir != nullptr ? dir : STATE_DIR;
+    }
+
+    std::string state_path() {
+        return state_dir() + "/profile-stats";
+    }
+
+    // Read directly rather than through the backend, it is not a hardware attribute
+    std::string boot_id() {
+        std::ifstream file("/proc/sys/kernel/random/boot_id");
+        std::string value;
+        std::getline(file, value);
+        return value;
+    }
+
+    // Monotonic time excludes suspend, so sleeping laptops don't accrue time
+    double monotonic_now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+    // A missing state file is an empty checkpoint
+    bool load(const std::string& path, Checkpoint& checkpoint) {
+        std::ifstream file(path);
+        if (!file.is_open()) return errno == ENOENT;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string key;
+            fields >> key;
+            if (key == "boot") {
+                fields >> checkpoint.boot_id;
+            } else if (key == "updated") {
+                fields >> checkpoint.updated;
+            } else if (key == "current") {
+                fields >> checkpoint.current;
+            } else if (key == "profile") {
+                std::string name;
+                ProfileTotals totals;
+                if (fields >> name >> totals.seconds >> totals.package_j >> totals.battery_j) {
+                    checkpoint.profiles[name] = totals;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool save(const std::string& path, const Checkpoint& checkpoint) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3)
+            << "boot " << checkpoint.boot_id << "\n"
+            << "updated " << checkpoint.updated << "\n"
+            << "current " << checkpoint.current << "\n";
+        for (const auto& [name, totals] : checkpoint.profiles) {
+            out << "profile " << name << " " << totals.seconds << " " << totals.package_j << " "
+                << totals.battery_j << "\n";
+        }
+        std::string data = out.str();
+
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        bool ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()) && fsync(fd) == 0;
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // A mode and the CLOCK_MONOTONIC time it was entered
+    struct Segment {
+        double start;
+        std::string profile;
+    };
+
+    // Modes entered since the last checkpoint, oldest first
+    std::vector<Segment> segments;
+    double last_checkpoint = 0.0;
+    const double CHECKPOINT_INTERVAL_S = 300.0;
+
+    // Note a mode change; no I/O
+    void enter(const std::string& profile) {
+        if (!segments.empty() && segments.back().profile == profile) return;
+        segments.push_back({monotonic_now(), profile});
+        if (last_checkpoint == 0.0) last_checkpoint = segments.back().start;
+    }
+
+    // Merge the noted modes and the energy measured per profile into the
+    // state file. Time before the first noted change goes to the mode the
+    // file has as current, and time the file already covers is skipped.
+    bool checkpoint(const std::map<std::string, ProfileTotals>& energy = {}) {
+        if (segments.empty() && energy.empty()) return true;
+        std::string path = state_path();
+        // install-udev makes the directory group writable for non-root use;
+        // files are replaced by rename, so only the directory needs it
+        mkdir(path.substr(0, path.rfind('/')).c_str(), 0775);
+        int lock = ::open((path + ".lock").c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0664);
+        if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+            if (lock >= 0) ::close(lock);
+            return false;
+        }
+
+        Checkpoint checkpoint;
+        bool ok = load(path, checkpoint);
+        if (ok) {
+            double now = monotonic_now();
+            std::string boot = boot_id();
+            // Time before a reboot was credited by the last update of that boot
+            double covered = checkpoint.boot_id == boot ? checkpoint.updated : 0.0;
+            double first = segments.empty() ? now : segments.front().start;
+            if (covered > 0.0 && !checkpoint.current.empty() && first > covered) {
+                checkpoint.profiles[checkpoint.current].seconds += first - covered;
+            }
+            for (size_t i = 0; i < segments.size(); ++i) {
+                double start = std::max(segments[i].start, covered);
+                double end = i + 1 < segments.size() ? segments[i + 1].start : now;
+                if (end > start) checkpoint.profiles[segments[i].profile].seconds += end - start;
+            }
+            for (const auto& [name, totals] : energy) {
+                checkpoint.profiles[name].package_j += totals.package_j;
+                checkpoint.profiles[name].battery_j += totals.battery_j;
+            }
+            checkpoint.boot_id = boot;
+            checkpoint.updated = now;
+            if (!segments.empty()) checkpoint.current = segments.back().profile;
+            ok = save(path, checkpoint);
+            if (ok) {
+                if (!segments.empty()) segments = {{now, segments.back().profile}};
+                last_checkpoint = now;
+            }
+        }
+        ::close(lock);
+        return ok;
+    }
+
+    // Poll timeout until the next timed checkpoint, -1 with nothing noted
+    int checkpoint_timeout_ms() {
+        if (segments.empty()) return -1;
+        double due = last_checkpoint + CHECKPOINT_INTERVAL_S - monotonic_now();
+        return static_cast<int>(std::max(0.0, due * 1000.0));
+    }
+
+    // Checkpoint when the interval is up, or always with 'at_exit'. A
+    // state file that can't be written is reported once per run.
+    void tick(bool at_exit) {
+        static bool warned = false;
+        if (!at_exit && checkpoint_timeout_ms() != 0) return;
+        if (checkpoint()) return;
+        // Retry on the next interval rather than on every tick
+        last_checkpoint = monotonic_now();
+        if (!warned) {
+            std::cerr << "Warning: Could not update " << state_path() << std::endl;
+            warned = true;
+        }
+    }
+}
+
+// Helpers for platform_profile choices
+namespace profiles {
+    // Position of a profile from lowest to highest power, -1 if unknown
+    int rank(const char* name, size_t length) {
+        static const char* const order[] = {"low-power", "cool", "quiet", "balanced", "balanced-performance",
+                                            "performance"};
+        for (int i = 0; i < 6; ++i) {
+            if (std::strlen(order[i]) == length && std::strncmp(name, order[i], length) == 0) return i;
+        }
+        return -1;
+    }
+
+    int rank(const std::string& name) { return rank(name.data(), name.size()); }
+
+    // The known choices from platform_profile_choices, lowest power first
+    std::vector<std::string> ladder(const std::string& choices) {
+        std::vector<std::string> result;
+        std::istringstream words(choices);
+        std::string word;
+        while (words >> word) {
+            if (rank(word) >= 0) result.push_back(word);
+        }
+        std::sort(result.begin(), result.end(),
+                  [](const std::string& a, const std::string& b) { return rank(a) < rank(b); });
+        return result;
+    }
+
+    // Attribute holding the current mode: the legacy file, or the first
+    // class handler when the legacy interface is missing
+    std::string current_path() {
+        const FeaturePaths& paths = feature_paths();
+        return paths.legacy_profile ? PLATFORM_PROFILE_PATH : paths.profile_handlers[0] + "/profile";
+    }
+
+    // Attributes a mode is written to: the legacy file, or every handler
+    std::vector<std::string> targets() {
+        const FeaturePaths& paths = feature_paths();
+        if (paths.legacy_profile) return {PLATFORM_PROFILE_PATH};
+        std::vector<std::string> result;
+        for (const auto& handler : paths.profile_handlers) result.push_back(handler + "/profile");
+        return result;
+    }
+
+    // Modes every handler supports; the legacy choices already are that
+    // intersection
+    bool read_choices(std::string& choices) {
+        const FeaturePaths& paths = feature_paths();
+        if (paths.legacy_profile) return file_ops::read_file(PLATFORM_PROFILE_CHOICES_PATH, choices);
+        std::vector<std::string> common;
+        for (size_t i = 0; i < paths.profile_handlers.size(); ++i) {
+            std::string value;
+            if (!file_ops::read_file(paths.profile_handlers[i] + "/choices", value)) return false;
+            std::istringstream words(value);
+            std::vector<std::string> modes{std::istream_iterator<std::string>(words), std::istream_iterator<std::string>()};
+            if (i > 0) {
+                modes.erase(std::remove_if(modes.begin(), modes.end(), [&](const std::string& mode) {
+                    return std::find(common.begin(), common.end(), mode) == common.end();
+                }), modes.end());
+            }
+            common = modes;
+        }
+        choices.clear();
+        for (const auto& mode : common) choices += (choices.empty() ? "" : " ") + mode;
+        return true;
+    }
+
+    // Switch profile and note it for the accounting. A write to
+    // the legacy platform_profile makes the kernel apply the mode to every
+    // class handler under its lock, so they stay consistent. Without it,
+    // every handler is opened first and then written in one tight pass.
+    bool apply(const std::string& mode) {
+        const FeaturePaths& paths = feature_paths();
+        if (paths.legacy_profile) {
+            if (!file_ops::write_file(PLATFORM_PROFILE_PATH, mode)) return false;
+        } else {
+            std::vector<file_ops::Attribute> handlers(paths.profile_handlers.size());
+            for (size_t i = 0; i < handlers.size(); ++i) {
+                if (int err = handlers[i].open(paths.profile_handlers[i] + "/profile", true)) {
+                    std::cerr << "Error: Could not write to " << handlers[i].path() << ": " << std::strerror(err) << std::endl;
+                    return false;
+                }
+            }
+            for (auto& handler : handlers) {
+                if (int err = handler.write(mode)) {
+                    std::cerr << "Error: Could not write to " << handler.path() << ": " << std::strerror(err) << std::endl;
+                    return false;
+                }
+            }
+        }
+        accounting::enter(mode);
+        return true;
+    }
+}
+
+// Intel RAPL energy counters exposed through the powercap class
+namespace rapl {
+    struct Domain {
+        std::string name;  // Zone name, subzones as "package-0/core"
+        file_ops::Attribute energy;
+        uint64_t max_range_uj = 0;
+        uint64_t last_uj = 0;
+    };
+
+    // Find every zone with an energy counter in a single directory scan and
+    // keep its energy_uj open for sampling
+    bool discover(std::vector<Domain>& domains, bool quiet = false) {
+        DIR* dir = opendir((root_prefix() + POWERCAP_PATH).c_str());
+        if (dir == nullptr) {
+            if (!quiet) std::cerr << "Error: RAPL is not available (" << POWERCAP_PATH << " not found)" << std::endl;
+            return false;
+        }
+        std::vector<std::string> zones;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            // Zones are intel-rapl:N or intel-rapl:N:M; intel-rapl itself is the control type
+            if (strncmp(entry->d_name, "intel-rapl", 10) == 0 && std::strchr(entry->d_name, ':') != nullptr) {
+                zones.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(zones.begin(), zones.end());
+
+        std::map<std::string, std::string> names;
+        for (const auto& zone : zones) {
+            std::string base = POWERCAP_PATH + "/" + zone + "/";
+            Domain domain;
+            std::string name, max_range;
+            if (file_ops::backend().read(base + "name", name) != 0 ||
+                file_ops::backend().read(base + "max_energy_range_uj", max_range) != 0) {
+                continue;
+            }
+            names[zone] = name;
+            size_t last_colon = zone.rfind(':');
+            auto parent = names.find(zone.substr(0, last_colon));
+            domain.name = (last_colon != zone.find(':') && parent != names.end()) ? parent->second + "/" + name : name;
+            try {
+                domain.max_range_uj = std::stoull(max_range);
+            } catch (...) {
+                continue;
+            }
+
+            int err = domain.energy.open(base + "energy_uj");
+            if (err == 0) err = domain.energy.read_u64(domain.last_uj);
+            if (err != 0) {
+                if (!quiet) {
+                    std::cerr << "Error: Could not read " << base << "energy_uj: " << std::strerror(err)
+                              << (err == EACCES ? ". Run with sudo." : "") << std::endl;
+                }
+                return false;
+            }
+            domains.push_back(std::move(domain));
+        }
+        if (domains.empty()) {
+            if (!quiet) std::cerr << "Error: No RAPL domains found under " << POWERCAP_PATH << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Energy used since the previous update. The counter wraps at
+    // max_energy_range_uj, which takes minutes on a busy package.
+    int update(Domain& domain, uint64_t& delta_uj) {
+        uint64_t now;
+        if (int err = domain.energy.read_u64(now)) return err;
+        delta_uj = now >= domain.last_uj ? now - domain.last_uj : now + domain.max_range_uj - domain.last_uj;
+        domain.last_uj = now;
+        return 0;
+    }
+}
+
+// Every fan speed source: the ACPI fan devices, whose fan_speed_rpm
+// evaluates _FST on each read, and hwmon fan*_input files. Each fan is read
+// from its cheapest source, measured once per boot and cached.
+namespace fans {
+    struct Source {
+        std::string fan;  // ACPI device for ACPI fans and their hwmon, else hwmonN/fanK
+        std::string path;
+        long cost_ns;
+    };
+
+    std::string cache_path() {
+        return accounting::state_dir() + "/fans";
+    }
+
+    // Cheapest of three reads, so a cold first read doesn't decide
+    long measure(const std::string& path) {
+        file_ops::Attribute attribute;
+        if (attribute.open(path) != 0) return -1;
+        long best = -1;
+        for (int i = 0; i < 3; ++i) {
+            uint64_t rpm;
+            auto start = std::chrono::steady_clock::now();
+            if (attribute.read_u64(rpm) != 0) return -1;
+            long ns = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                            std::chrono::steady_clock::now() - start).count());
+            if (best < 0 || ns < best) best = ns;
+        }
+        return best;
+    }
+
+    // One listing of the ACPI devices and of hwmon, then one of each hwmon
+    // device. An hwmon device whose parent is an ACPI fan reports that fan.
+    std::vector<Source> discover() {
+        std::vector<Source> sources;
+        auto add = [&](const std::string& fan, const std::string& path) {
+            long cost = measure(path);
+            if (cost >= 0) sources.push_back({fan, path, cost});
+        };
+        for (const auto& name : list_directory(ACPI_DEVICES_PATH)) {
+            if (name.compare(0, 8, "PNP0C0B:") == 0) add(name, ACPI_DEVICES_PATH + "/" + name + "/fan_speed_rpm");
+        }
+        for (const auto& hwmon : list_directory(HWMON_PATH)) {
+            std::string dir = HWMON_PATH + "/" + hwmon;
+            char target[PATH_MAX];
+            ssize_t n = readlink((root_prefix() + dir + "/device").c_str(), target, sizeof(target) - 1);
+            std::string parent = n > 0 ? std::string(target, static_cast<size_t>(n)) : "";
+            parent = parent.substr(parent.rfind('/') + 1);
+            bool acpi_fan = parent.compare(0, 8, "PNP0C0B:") == 0;
+            for (const auto& name : list_directory(dir)) {
+                if (name.compare(0, 3, "fan") != 0 || name.size() < 10 ||
+                    name.compare(name.size() - 6, 6, "_input") != 0) {
+                    continue;
+                }
+                std::string fan = hwmon + "/" + name.substr(0, name.size() - 6);
+                add(acpi_fan && name == "fan1_input" ? parent : fan, dir + "/" + name);
+            }
+        }
+        return sources;
+    }
+
+    // The cheapest source of each fan, ordered by fan so the first ACPI fan
+    // comes first
+    std::vector<Source> choose(const std::vector<Source>& sources) {
+        std::map<std::string, Source> best;
+        for (const auto& source : sources) {
+            auto it = best.find(source.fan);
+            if (it == best.end() || source.cost_ns < it->second.cost_ns) best[source.fan] = source;
+        }
+        std::vector<Source> chosen;
+        for (const auto& [fan, source] : best) chosen.push_back(source);
+        return chosen;
+    }
+
+    // Cached choices for this boot, hwmon numbering can change across boots
+    bool load(std::vector<Source>& chosen) {
+        std::ifstream file(cache_path());
+        std::string key, boot;
+        if (!(file >> key >> boot) || key != "boot" || boot != accounting::boot_id()) return false;
+        Source source;
+        while (file >> key >> source.fan >> source.path >> source.cost_ns) {
+            if (key != "fan") return false;
+            chosen.push_back(source);
+        }
+        return !chosen.empty();
+    }
+
+    void save(const std::vector<Source>& chosen) {
+        std::string path = cache_path();
+        mkdir(path.substr(0, path.rfind('/')).c_str(), 0775);
+        std::ofstream file(path + ".tmp");
+        file << "boot " << accounting::boot_id() << "\n";
+        for (const auto& source : chosen) file << "fan " << source.fan << " " << source.path << " " << source.cost_ns << "\n";
+        file.close();
+        if (!file || rename((path + ".tmp").c_str(), path.c_str()) != 0) unlink((path + ".tmp").c_str());
+    }
+
+    // Other backends don't serve the discovered paths, so they are neither
+    // taken from nor written to the cache
+    bool cacheable() {
+        const char* name = std::getenv("SAMSUNG_CLI_BACKEND");
+        return name == nullptr || std::strcmp(name, "sysfs") == 0;
+    }
+
+    const std::vector<Source>& all() {
+        static const std::vector<Source> chosen = []() {
+            std::vector<Source> result;
+            if (cacheable() && load(result)) return result;
+            result = choose(discover());
+            if (cacheable() && !result.empty()) save(result);
+            return result;
+        }();
+        return chosen;
+    }
+
+    // FAN_PATH when nothing was found, so errors name the usual file
+    const std::string& primary_path() {
+        return all().empty() ? FAN_PATH : all().front().path;
+    }
+}
+
+// Industrial I/O light sensors, read through their triggered buffer
+namespace iio {
+    bool parse_scan_type(const std::string& spec, ScanType& type) {
+        char endian[3] = {}, sign = 0;
+        if (std::sscanf(spec.c_str(), "%2s:%c%d/%d>>%d", endian, &sign, &type.real_bits, &type.storage_bits,
+                        &type.shift) != 5) {
+            return false;
+        }
+        type.big_endian = std::strcmp(endian, "be") == 0;
+        type.is_signed = sign == 's';
+        return (sign == 's' || sign == 'u') && type.real_bits > 0 && type.real_bits <= 64 &&
+               (type.storage_bits == 8 || type.storage_bits == 16 || type.storage_bits == 32 ||
+                type.storage_bits == 64);
+    }
+
+    int64_t decode(const unsigned char* data, const ScanType& type) {
+        int bytes = type.storage_bits / 8;
+        uint64_t raw = 0;
+        for (int i = 0; i < bytes; ++i) {
+            raw |= static_cast<uint64_t>(data[type.big_endian ? bytes - 1 - i : i]) << (8 * i);
+        }
+        raw >>= type.shift;
+        if (type.real_bits < 64) {
+            raw &= (1ull << type.real_bits) - 1;
+            if (type.is_signed && (raw >> (type.real_bits - 1)) & 1) raw |= ~0ull << type.real_bits;
+        }
+        return static_cast<int64_t>(raw);
+    }
+
+    // First device with a buffered illuminance channel. Returns its sysfs
+    // directory and sets 'channel' to the scan element prefix.
+    std::string find_light_sensor(std::string& channel) {
+        for (const auto& name : list_directory(IIO_DEVICES_PATH)) {
+            if (name.compare(0, 10, "iio:device") != 0) continue;
+            std::string dir = IIO_DEVICES_PATH + "/" + name;
+            for (const auto& element : list_directory(dir + "/scan_elements")) {
+                if (element.compare(0, 14, "in_illuminance") == 0 && element.size() > 3 &&
+                    element.compare(element.size() - 3, 3, "_en") == 0) {
+                    channel = element.substr(0, element.size() - 3);
+                    return dir;
+                }
+            }
+        }
+        return "";
+    }
+}
+
+// Local wall clock time with milliseconds for event logs
+std::string timestamp_now() {
+    auto now = std::chrono::system_clock::now();
+    std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char buf[32];
+    size_t length = strftime(buf, sizeof(buf), "%H:%M:%S", &local);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+    snprintf(buf + length, sizeof(buf) - length, ".%03d", static_cast<int>(ms));
+    return buf;
+}
+
+// Command implementations
+class PowerCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing power subcommand. Use 'read' or 'set'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        if (subcommand == "read") {
+            return read_power();
+        } else if (subcommand == "set") {
+            if (args.size() < 3) {
+                std::cerr << "Error: Missing value for 'power set'" << std::endl;
+                return false;
+            }
+            return set_power(args[2]);
+        }
+        std::cerr << "Error: Unknown power subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  power read    Read the charge threshold\n"
+               "  power set <value>  Set the charge threshold (0-100)";
+    }
+
+private:
+    bool read_power() {
+        std::string value;
+        if (!file_ops::read_file(POWER_PATH, value)) return false;
+        std::cout << "Current charge threshold: " << value << "%" << std::endl;
+        return true;
+    }
+
+    bool set_power(const std::string& value) {
+        int val;
+        try {
+            val = std::stoi(value);
+            if (val < 0 || val > 100) {
+                std::cerr << "Error: Value must be between 0 and 100" << std::endl;
+                return false;
+            }
+        } catch (...) {
+            std::cerr << "Error: Invalid value '" << value << "'" << std::endl;
+            return false;
+        }
+        if (!file_ops::write_file(POWER_PATH, std::to_string(val))) return false;
+        std::cout << "Set charge threshold to " << val << "%" << std::endl;
+        return true;
+    }
+};
+
+class FanCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing fan subcommand. Use 'read', 'sources' or 'cap'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];  // args[0] is the command name "fan"
+        if (subcommand == "read") {
+            return read_fan();
+        } else if (subcommand == "sources") {
+            return list_sources();
+        } else if (subcommand == "cap") {
+            if (args.size() < 3) {
+                std::cerr << "Error: Missing RPM for 'fan cap'" << std::endl;
+                return false;
+            }
+            return cap_fan(args);
+        }
+        std::cerr << "Error: Unknown fan subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  fan read      Read current fan speed in RPM, of every fan if there are several\n"
+               "  fan sources   Measure each fan's sources and cache the cheapest for this boot\n"
+               "  fan cap <rpm> [interval-ms] [--bench <s>]  Keep the fan under <rpm> by lowering\n"
+               "               the performance mode; --bench measures the throughput cost";
+    }
+
+private:
+    // Acoustic cap tuning: the fan reading is smoothed with this time
+    // constant, a step up needs the smoothed speed below the cap minus the
+    // hysteresis for STEP_UP_DWELL, and a step down waits STEP_DOWN_DWELL
+    // after the previous change so the fan can respond
+    static constexpr double SMOOTHING_S = 4.0;
+    static constexpr double HYSTERESIS = 0.10;
+    static constexpr double STEP_UP_DWELL_S = 30.0;
+    static constexpr double STEP_DOWN_DWELL_S = 10.0;
+
+    struct CapStats {
+        double seconds = 0.0;
+        double rpm_sum = 0.0;
+        int samples = 0;
+        double over_cap_s = 0.0;
+        int switches = 0;
+    };
+
+    bool read_fan() {
+        const auto& all = fans::all();
+        std::string value;
+        if (all.size() < 2) {
+            if (!file_ops::read_file(fans::primary_path(), value)) return false;
+            std::cout << "Current fan speed: " << value << " RPM" << std::endl;
+            return true;
+        }
+        for (const auto& fan : all) {
+            if (!file_ops::read_file(fan.path, value)) return false;
+            std::cout << "Fan " << fan.fan << ": " << value << " RPM" << std::endl;
+        }
+        return true;
+    }
+
+    // Always measured afresh, unlike the cached choice 'read' uses
+    bool list_sources() {
+        std::vector<fans::Source> sources = fans::discover();
+        if (sources.empty()) {
+            std::cerr << "Error: No readable fan under " << ACPI_DEVICES_PATH << " or " << HWMON_PATH << std::endl;
+            return false;
+        }
+        std::vector<fans::Source> chosen = fans::choose(sources);
+        for (const auto& source : sources) {
+            bool best = std::any_of(chosen.begin(), chosen.end(),
+                                    [&](const fans::Source& c) { return c.path == source.path; });
+            std::cout << (best ? "* " : "  ") << std::left << std::setw(16) << source.fan << std::right
+                      << std::setw(10) << std::fixed << std::setprecision(1) << source.cost_ns / 1000.0 << " us  "
+                      << source.path << std::endl;
+        }
+        std::cout.unsetf(std::ios::fixed);
+        if (fans::cacheable()) fans::save(chosen);
+        return true;
+    }
+
+    bool cap_fan(const std::vector<std::string>& args) {
+        int cap = 0, interval_ms = 2000, bench_s = 0;
+        try {
+            cap = std::stoi(args[2]);
+            for (size_t i = 3; i < args.size(); ++i) {
+                if (args[i] == "--bench" && i + 1 < args.size()) {
+                    bench_s = std::stoi(args[++i]);
+                } else {
+                    interval_ms = std::stoi(args[i]);
+                }
+            }
+        } catch (...) {
+            std::cerr << "Error: Invalid value for 'fan cap'" << std::endl;
+            return false;
+        }
+        if (cap <= 0 || interval_ms < 100 || bench_s < 0) {
+            std::cerr << "Error: Cap must be positive and the interval at least 100 ms" << std::endl;
+            return false;
+        }
+
+        std::string choices, original;
+        if (!profiles::read_choices(choices)) return false;
+        if (!file_ops::read_file(profiles::current_path(), original)) return false;
+        std::vector<std::string> ladder = profiles::ladder(choices);
+        if (ladder.size() < 2) {
+            std::cerr << "Error: Need at least two performance modes to cap the fan" << std::endl;
+            return false;
+        }
+        file_ops::Attribute fan;
+        if (int err = fan.open(fans::primary_path())) {
+            std::cerr << "Error: Could not open " << fans::primary_path() << ": " << std::strerror(err) << std::endl;
+            return false;
+        }
+
+        signals::install_stop_handlers();
+        bool ok;
+        if (bench_s > 0) {
+            ok = benchmark(fan, ladder, cap, interval_ms, bench_s);
+        } else {
+            std::cout << "Capping fan at " << cap << " RPM (Ctrl+C to stop)" << std::endl;
+            CapStats stats;
+            ok = control(fan, ladder, cap, true, interval_ms, 0, stats);
+        }
+        if (!profiles::apply(original)) ok = false;
+        accounting::tick(true);
+        return ok;
+    }
+
+    // Start at the highest mode and step down while the smoothed fan speed
+    // is over the cap, back up once it has stayed clearly below it. Without
+    // 'enforce' only the statistics are collected.
+    bool control(file_ops::Attribute& fan, const std::vector<std::string>& ladder, int cap, bool enforce,
+                 int interval_ms, int duration_s, CapStats& stats) {
+        size_t level = ladder.size() - 1;
+        if (!profiles::apply(ladder[level])) return false;
+
+        double interval_s = interval_ms / 1000.0;
+        double alpha = 1.0 - std::exp(-interval_s / SMOOTHING_S);
+        double filtered = -1.0;
+        // A fan that is already loud may be stepped down right away
+        double since_change = STEP_DOWN_DWELL_S;
+        double below_for = 0.0;
+        auto next = std::chrono::steady_clock::now();
+        while (!signals::stop_requested && (duration_s == 0 || stats.seconds < duration_s)) {
+            next += std::chrono::milliseconds(interval_ms);
+            std::this_thread::sleep_until(next);
+            accounting::tick();
+            uint64_t rpm;
+            if (int err = fan.read_u64(rpm)) {
+                // A busy EC is retried on the next tick
+                if (err == EBUSY || err == EAGAIN) continue;
+                std::cerr << "Error: Could not read " << fan.path() << ": " << std::strerror(err) << std::endl;
+                return false;
+            }
+
+            filtered = filtered < 0 ? rpm : filtered + alpha * (rpm - filtered);
+            stats.seconds += interval_s;
+            stats.rpm_sum += rpm;
+            stats.samples++;
+            if (rpm > static_cast<uint64_t>(cap)) stats.over_cap_s += interval_s;
+            since_change += interval_s;
+            below_for = filtered < cap * (1.0 - HYSTERESIS) ? below_for + interval_s : 0.0;
+
+            // The raw reading must agree with the filter so a fan that is
+            // still spinning down isn't stepped down twice
+            size_t next_level = level;
+            if (enforce && filtered > cap && rpm > static_cast<uint64_t>(cap) && level > 0 &&
+                since_change >= STEP_DOWN_DWELL_S) {
+                next_level = level - 1;
+            } else if (enforce && below_for >= STEP_UP_DWELL_S && level + 1 < ladder.size()) {
+                next_level = level + 1;
+            }
+            if (next_level != level) {
+                std::cout << "Fan " << std::lround(filtered) << " RPM, switching to " << ladder[next_level] << std::endl;
+                if (!profiles::apply(ladder[next_level])) return false;
+                level = next_level;
+                stats.switches++;
+                since_change = 0.0;
+                below_for = 0.0;
+                // Restart the filter so the old mode's speed doesn't linger
+                filtered = -1.0;
+            }
+        }
+        return true;
+    }
+
+    // Run a CPU bound workload on every core for bench_s seconds uncapped and
+    // then capped, and report the throughput lost to the cap
+    bool benchmark(file_ops::Attribute& fan, const std::vector<std::string>& ladder, int cap, int interval_ms,
+                   int bench_s) {
+        CapStats uncapped, capped;
+        double uncapped_rate, capped_rate;
+        std::cout << "Benchmark: " << bench_s << " s uncapped, then " << bench_s << " s capped at " << cap
+                  << " RPM" << std::endl;
+        if (!run_workload([&]() { return control(fan, ladder, cap, false, interval_ms, bench_s, uncapped); },
+                          uncapped_rate) ||
+            !run_workload([&]() { return control(fan, ladder, cap, true, interval_ms, bench_s, capped); },
+                          capped_rate)) {
+            return false;
+        }
+
+        auto report = [](const char* label, double rate, const CapStats& stats) {
+            std::cout << std::fixed << std::setprecision(1) << label << std::setw(10) << rate / 1e6
+                      << " Mops/s, fan avg " << std::setw(6) << stats.rpm_sum / std::max(stats.samples, 1)
+                      << " RPM, over cap " << std::setw(5) << stats.over_cap_s << " s, "
+                      << stats.switches << " mode switches" << std::endl;
+        };
+        report("Uncapped:", uncapped_rate, uncapped);
+        report("Capped:  ", capped_rate, capped);
+        std::cout << "Throughput loss: " << std::setprecision(1)
+                  << (uncapped_rate > 0 ? 100.0 * (1.0 - capped_rate / uncapped_rate) : 0.0) << "%" << std::endl;
+        return !signals::stop_requested;
+    }
+
+    // Keep all cores busy while 'body' runs and return operations per second
+    static bool run_workload(const std::function<bool()>& body, double& rate) {
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> total{0};
+        std::vector<std::thread> workers;
+        unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < count; ++i) {
+            workers.emplace_back([&stop, &total, i]() {
+                uint64_t x = 0x9e3779b97f4a7c15ull + i;
+                uint64_t ops = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    for (int j = 0; j < 4096; ++j) {
+                        x ^= x << 13;
+                        x ^= x >> 7;
+                        x ^= x << 17;
+                    }
+                    ops += 4096;
+                }
+                total += ops + (x == 0);
+            });
+        }
+        bool ok = body();
+        stop = true;
+        for (auto& worker : workers) worker.join();
+        rate = total / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+};
+
+class PerformanceCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing performance subcommand. Use 'read', 'set', or 'list'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        if (subcommand == "read") {
+            return read_performance_mode();
+        } else if (subcommand == "set") {
+            if (args.size() < 3) {
+                std::cerr << "Error: Missing mode for 'perf set'" << std::endl;
+                return false;
+            }
+            return set_performance_mode(args[2]);
+        } else if (subcommand == "list") {
+            return list_performance_modes();
+        } else if (subcommand == "stats") {
+            return show_stats();
+        } else if (subcommand == "serve") {
+            return serve(args);
+        } else if (subcommand == "track") {
+            int checkpoint_s = 300;
+            int sample_s = 30;
+            try {
+                if (args.size() > 2) checkpoint_s = std::stoi(args[2]);
+                if (args.size() > 3) sample_s = std::stoi(args[3]);
+            } catch (...) {
+                std::cerr << "Error: Invalid checkpoint or sample interval" << std::endl;
+                return false;
+            }
+            if (checkpoint_s < 1 || sample_s < 1) {
+                std::cerr << "Error: Intervals must be positive" << std::endl;
+                return false;
+            }
+            return track(checkpoint_s, sample_s);
+        }
+        std::cerr << "Error: Unknown performance subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  perf read     Read current performance mode\n"
+               "  perf set <mode>  Set performance mode (low-power/balanced/performance)\n"
+               "  perf list     List available performance modes\n"
+               "  perf stats    Show time and energy spent in each performance mode\n"
+               "  perf track [checkpoint-s] [sample-s]  Account mode changes and energy until stopped\n"
+               "  perf serve [--session | --address <bus>]  Provide the power-profiles-daemon D-Bus service";
+    }
+
+private:
+    bool read_performance_mode() {
+        std::string value;
+        if (!file_ops::read_file(profiles::current_path(), value)) return false;
+        std::cout << "Current performance mode: " << value << std::endl;
+        // With several handlers (e.g. the driver and amd-pmf) show each one
+        const std::vector<std::string>& handlers = feature_paths().profile_handlers;
+        if (handlers.size() > 1) {
+            for (const auto& handler : handlers) {
+                std::string name, profile;
+                if (file_ops::read_file(handler + "/name", name) && file_ops::read_file(handler + "/profile", profile)) {
+                    std::cout << "  " << name << ": " << profile << std::endl;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool set_performance_mode(const std::string& mode) {
+        // Check if the mode is valid. If 'mode' is not in the list of available modes, return false
+        std::string available_modes;
+        if (!profiles::read_choices(available_modes)) return false;
+        if (available_modes.find(mode) == std::string::npos) {
+            std::cerr << "Error: Invalid performance mode '" << mode << "'" << std::endl;
+            return false;
+        }
+
+        if (!profiles::apply(mode)) return false;
+        std::cout << "Set performance mode to " << mode << std::endl;
+        // Save the change now, there is no later checkpoint in a one-off run.
+        // A state file that can't be written only costs the accounting.
+        accounting::tick(true);
+        return true;
+    }
+
+    bool serve(const std::vector<std::string>& args) {
+        const char* system_bus = std::getenv("DBUS_SYSTEM_BUS_ADDRESS");
+        std::string address = system_bus != nullptr ? system_bus : "unix:path=/run/dbus/system_bus_socket";
+        if (args.size() == 3 && args[2] == "--session") {
+            const char* session_bus = std::getenv("DBUS_SESSION_BUS_ADDRESS");
+            address = session_bus != nullptr ? session_bus : "";
+        } else if (args.size() == 4 && args[2] == "--address") {
+            address = args[3];
+        } else if (args.size() != 2) {
+            std::cerr << "Error: Use 'perf serve [--session | --address <bus>]'" << std::endl;
+            return false;
+        }
+        return serve_power_profiles(address);
+    }
+
+    bool list_performance_modes() {
+        std::string value;
+        if (!profiles::read_choices(value)) return false;
+        std::cout << "Available performance modes: " << value << std::endl;
+        return true;
+    }
+
+    // Totals come straight from the checkpoint; only the time since the last
+    // update is added for the current mode
+    bool show_stats() {
+        std::string path = accounting::state_path();
+        accounting::Checkpoint checkpoint;
+        if (!accounting::load(path, checkpoint)) {
+            std::cerr << "Error: Could not open " << path << std::endl;
+            return false;
+        }
+        if (checkpoint.current.empty()) {
+            std::cout << "No performance mode statistics recorded yet" << std::endl;
+            return true;
+        }
+        double now = accounting::monotonic_now();
+        if (checkpoint.boot_id == accounting::boot_id() && now > checkpoint.updated) {
+            checkpoint.profiles[checkpoint.current].seconds += now - checkpoint.updated;
+        }
+
+        std::cout << std::left << std::setw(14) << "Mode" << std::right << std::setw(10) << "Time"
+                  << std::setw(14) << "Package" << std::setw(14) << "Battery" << "\n"
+                  << std::fixed << std::setprecision(2);
+        for (const auto& [name, totals] : checkpoint.profiles) {
+            std::cout << std::left << std::setw(14) << name << std::right
+                      << std::setw(8) << totals.seconds / 3600.0 << " h"
+                      << std::setw(11) << totals.package_j / 3600.0 << " Wh"
+                      << std::setw(11) << totals.battery_j / 3600.0 << " Wh\n";
+        }
+        std::cout << "Current performance mode: " << checkpoint.current << std::endl;
+        return true;
+    }
+
+    // Follow mode changes through POLLPRI on platform_profile, integrate RAPL
+    // package and battery energy every sample_s and on a mode change, and
+    // checkpoint every checkpoint_s
+    bool track(int checkpoint_s, int sample_s) {
+        file_ops::Attribute profile_attr;
+        std::string current;
+        int err = profile_attr.open(profiles::current_path());
+        if (err == 0) err = profile_attr.read(current);
+        if (err != 0) {
+            std::cerr << "Error: Could not open " << profile_attr.path() << ": " << std::strerror(err) << std::endl;
+            return false;
+        }
+        accounting::enter(current);
+        if (!accounting::checkpoint()) {
+            std::cerr << "Error: Could not update " << accounting::state_path() << std::endl;
+            return false;
+        }
+
+        std::vector<rapl::Domain> domains;
+        rapl::Domain* package = nullptr;
+        if (rapl::discover(domains, true)) {
+            for (auto& domain : domains) {
+                if (package == nullptr && domain.name.compare(0, 7, "package") == 0) package = &domain;
+            }
+        }
+        file_ops::Attribute energy_now, status;
+        uint64_t last_battery_uwh = 0;
+        bool have_battery = energy_now.open(BATTERY_ENERGY_NOW_PATH) == 0 && status.open(BATTERY_STATUS_PATH) == 0 &&
+                            energy_now.read_u64(last_battery_uwh) == 0;
+
+        std::map<std::string, accounting::ProfileTotals> pending;
+        auto sample_energy = [&]() {
+            uint64_t delta_uj;
+            if (package != nullptr && rapl::update(*package, delta_uj) == 0) {
+                pending[current].package_j += delta_uj / 1e6;
+            }
+            uint64_t battery_uwh;
+            std::string state;
+            if (have_battery && energy_now.read_u64(battery_uwh) == 0) {
+                if (status.read(state) == 0 && state == "Discharging" && battery_uwh < last_battery_uwh) {
+                    pending[current].battery_j += (last_battery_uwh - battery_uwh) * 3.6e-3;
+                }
+                last_battery_uwh = battery_uwh;
+            }
+        };
+
+        std::cout << "Tracking performance mode " << current << " in " << accounting::state_path() << std::endl;
+        signals::install_stop_handlers();
+        int fd = profile_attr.poll_fd();
+        auto next_sample = std::chrono::steady_clock::now() + std::chrono::seconds(sample_s);
+        auto next_checkpoint = std::chrono::steady_clock::now() + std::chrono::seconds(checkpoint_s);
+        while (!signals::stop_requested) {
+            auto wake = std::min(next_sample, next_checkpoint);
+            if (fd >= 0) {
+                auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wake - std::chrono::steady_clock::now());
+                struct pollfd pfd = {fd, POLLPRI | POLLERR, 0};
+                poll(&pfd, 1, static_cast<int>(std::max<int64_t>(0, timeout.count())));
+            } else {
+                std::this_thread::sleep_until(wake);
+            }
+            if (signals::stop_requested) break;
+
+            std::string profile;
+            bool changed = profile_attr.read(profile) == 0 && profile != current;
+            auto now = std::chrono::steady_clock::now();
+            if (changed || now >= next_sample) {
+                sample_energy();
+                next_sample = now + std::chrono::seconds(sample_s);
+            }
+            if (changed) {
+                std::cout << "Performance mode changed to " << profile << std::endl;
+                current = profile;
+                accounting::enter(current);
+            }
+            if (now >= next_checkpoint) {
+                if (accounting::checkpoint(pending)) {
+                    pending.clear();
+                } else {
+                    std::cerr << "Warning: Could not update " << accounting::state_path() << std::endl;
+                }
+                next_checkpoint = now + std::chrono::seconds(checkpoint_s);
+            }
+        }
+
+        sample_energy();
+        return accounting::checkpoint(pending);
+    }
+};
+
+class RecordingCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing recording subcommand. Use 'read' or 'set'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        if (subcommand == "read") {
+            return read_recording_status();
+        } else if (subcommand == "set") {
+            if (args.size() < 3) {
+                std::cerr << "Error: Missing value for 'record set'" << std::endl;
+                return false;
+            }
+            return set_recording_status(args[2]);
+        }
+        std::cerr << "Error: Unknown recording subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  record read   Read recording permission status\n"
+               "  record set <value>  Set recording permission (0/1, on/off, true/false, yes/no)";
+    }
+
+private:
+    bool read_recording_status() {
+        std::string value;
+        if (!file_ops::read_file(feature_paths().allow_recording, value)) return false;
+        // block_recording holds the inverse
+        bool enabled = (value == "1") != feature_paths().recording_inverted;
+        std::cout << "Recording permission: " << (enabled ? "Enabled" : "Disabled") << std::endl;
+        return true;
+    }
+
+    bool set_recording_status(const std::string& value) {
+        std::string normalized_value;
+        // Convert various input formats to "0" or "1"
+        if (value == "0" || value == "off" || value == "false" || value == "no") {
+            normalized_value = "0";
+        } else if (value == "1" || value == "on" || value == "true" || value == "yes") {
+            normalized_value = "1";
+        } else {
+            std::cerr << "Error: Value must be one of: 0/1, on/off, true/false, yes/no" << std::endl;
+            return false;
+        }
+        
+        bool enabled = normalized_value == "1";
+        if (feature_paths().recording_inverted) normalized_value = enabled ? "0" : "1";
+        if (!file_ops::write_file(feature_paths().allow_recording, normalized_value)) return false;
+        std::cout << "Set recording permission to " << (enabled ? "Enabled" : "Disabled") << std::endl;
+        return true;
+    }
+};
+
+class KeyboardCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing keyboard subcommand. Use 'read', 'set', 'watch' or 'ambient'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        if (subcommand == "read") {
+            return read_keyboard_backlight();
+        } else if (subcommand == "set") {
+            if (args.size() < 3) {
+                std::cerr << "Error: Missing value for 'kbd set'" << std::endl;
+                return false;
+            }
+            return set_keyboard_backlight(args[2]);
+        } else if (subcommand == "watch") {
+            return watch_keyboard_backlight();
+        } else if (subcommand == "ambient") {
+            return ambient_keyboard_backlight(args);
+        }
+        std::cerr << "Error: Unknown keyboard subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  kbd read      Read keyboard backlight level\n"
+               "  kbd set <0-3> Set keyboard backlight level (0=off, 1-3=brightness)\n"
+               "               Note: Backlight may be affected by ambient light sensor\n"
+               "               and GNOME's automatic backlight control\n"
+               "  kbd watch     Report every backlight change as it happens (hotkey, sensor or software)\n"
+               "  kbd ambient [--thresholds <lux,lux,lux>] [--batch <n>] [--iio <dir>] [--device <node>]\n"
+               "               Set the backlight from the ambient light sensor";
+    }
+
+private:
+    bool read_keyboard_backlight() {
+        std::string value;
+        if (!file_ops::read_file(KBD_BACKLIGHT_PATH, value)) return false;
+        std::cout << "Keyboard backlight level: " << value << std::endl;
+        return true;
+    }
+
+    bool set_keyboard_backlight(const std::string& value) {
+        // The LED reports its own range; 3 levels when it can't be read
+        int levels = 3;
+        std::string max_brightness;
+        if (file_ops::backend().read(KBD_BACKLIGHT_PATH.substr(0, KBD_BACKLIGHT_PATH.rfind('/')) + "/max_brightness",
+                                     max_brightness) == 0) {
+            levels = std::atoi(max_brightness.c_str());
+        }
+        if (levels <= 0) {
+            std::cerr << "Error: This model has no keyboard backlight levels" << std::endl;
+            return false;
+        }
+        int val;
+        try {
+            val = std::stoi(value);
+            if (val < 0 || val > levels) {
+                std::cerr << "Error: Value must be between 0 and " << levels << std::endl;
+                return false;
+            }
+        } catch (...) {
+            std::cerr << "Error: Invalid value '" << value << "'" << std::endl;
+            return false;
+        }
+        if (!file_ops::write_file(KBD_BACKLIGHT_PATH, std::to_string(val))) return false;
+        std::cout << "Set keyboard backlight level to " << val << std::endl;
+        return true;
+    }
+
+    // The LED core raises POLLPRI on brightness_hw_changed when the firmware
+    // changes the level (Fn hotkeys, ambient light sensor). Other changes are
+    // software writes, seen through POLLPRI on brightness where the kernel
+    // notifies it, or when the level read at the next wakeup differs.
+    bool watch_keyboard_backlight() {
+        std::string led_path = KBD_BACKLIGHT_PATH.substr(0, KBD_BACKLIGHT_PATH.rfind('/'));
+        file_ops::Attribute brightness, hw_changed;
+        int err = brightness.open(KBD_BACKLIGHT_PATH);
+        if (err == 0) err = hw_changed.open(led_path + "/brightness_hw_changed");
+        if (err != 0) {
+            std::cerr << "Error: Could not open the keyboard backlight in " << led_path << ": " << std::strerror(err)
+                      << std::endl;
+            return false;
+        }
+        if (brightness.poll_fd() < 0 || hw_changed.poll_fd() < 0) {
+            std::cerr << "Error: The selected backend does not support change notification" << std::endl;
+            return false;
+        }
+
+        // Reading arms the notification; brightness_hw_changed fails with
+        // ENODATA until the first hardware change
+        uint64_t level = 0, hw_level = 0;
+        if (int read_err = brightness.read_u64(level)) {
+            std::cerr << "Error: Could not read " << KBD_BACKLIGHT_PATH << ": " << std::strerror(read_err) << std::endl;
+            return false;
+        }
+        hw_changed.read_u64(hw_level);
+        std::cout << timestamp_now() << " initial  " << level << std::endl;
+
+        signals::install_stop_handlers();
+        struct pollfd fds[2] = {{hw_changed.poll_fd(), POLLPRI | POLLERR, 0}, {brightness.poll_fd(), POLLPRI | POLLERR, 0}};
+        while (!signals::stop_requested) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "Error: poll failed: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            std::string stamp = timestamp_now();
+            bool hardware = (fds[0].revents & (POLLPRI | POLLERR)) != 0 && hw_changed.read_u64(hw_level) == 0;
+            uint64_t current;
+            if (brightness.read_u64(current) != 0) continue;
+            if (hardware) {
+                std::cout << stamp << " hardware " << hw_level << std::endl;
+                level = hw_level;
+            }
+            if (current != level) {
+                std::cout << stamp << " software " << current << std::endl;
+                level = current;
+            }
+        }
+        return true;
+    }
+
+    // Drive the backlight from the ambient light sensor: one read per batch
+    // of buffered samples, an exponential filter on lux, and a level change
+    // only when the filtered value clears a threshold by the hysteresis
+    bool ambient_keyboard_backlight(const std::vector<std::string>& args) {
+        std::string dir, device;
+        double thresholds[3] = {5.0, 50.0, 300.0};
+        int batch = 16;
+        try {
+            for (size_t i = 2; i < args.size(); ++i) {
+                if (i + 1 >= args.size()) throw std::invalid_argument(args[i]);
+                if (args[i] == "--iio") {
+                    dir = args[++i];
+                } else if (args[i] == "--device") {
+                    device = args[++i];
+                } else if (args[i] == "--batch") {
+                    batch = std::stoi(args[++i]);
+                } else if (args[i] == "--thresholds") {
+                    if (std::sscanf(args[++i].c_str(), "%lf,%lf,%lf", &thresholds[0], &thresholds[1],
+                                    &thresholds[2]) != 3) {
+                        throw std::invalid_argument(args[i]);
+                    }
+                } else {
+                    throw std::invalid_argument(args[i]);
+                }
+            }
+        } catch (...) {
+            std::cerr << "Error: Invalid option for 'kbd ambient'" << std::endl;
+            return false;
+        }
+        if (batch < 1 || !(thresholds[0] < thresholds[1] && thresholds[1] < thresholds[2])) {
+            std::cerr << "Error: Batch must be positive and thresholds increasing" << std::endl;
+            return false;
+        }
+
+        std::string channel = "in_illuminance";
+        if (dir.empty()) dir = iio::find_light_sensor(channel);
+        if (dir.empty()) {
+            std::cerr << "Error: No buffered ambient light sensor under " << IIO_DEVICES_PATH << std::endl;
+            return false;
+        }
+        if (device.empty()) device = "/dev/" + dir.substr(dir.rfind('/') + 1);
+
+        // lux = (raw + offset) * scale, where the driver provides them
+        std::string spec, value;
+        iio::ScanType type;
+        if (!file_ops::read_file(dir + "/scan_elements/" + channel + "_type", spec) ||
+            !iio::parse_scan_type(spec, type)) {
+            std::cerr << "Error: Unsupported scan type '" << spec << "'" << std::endl;
+            return false;
+        }
+        double scale = 1.0, offset = 0.0;
+        if (file_ops::backend().read(dir + "/" + channel + "_scale", value) == 0) scale = std::atof(value.c_str());
+        if (file_ops::backend().read(dir + "/" + channel + "_offset", value) == 0) offset = std::atof(value.c_str());
+
+        if (!configure_buffer(dir, channel, batch)) return false;
+        int fd = ::open(device.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        file_ops::Attribute kbd;
+        uint64_t level = 0;
+        int err = fd < 0 ? errno : kbd.open(KBD_BACKLIGHT_PATH, true);
+        if (err == 0) {
+            file_ops::Attribute reader;
+            err = reader.open(KBD_BACKLIGHT_PATH);
+            if (err == 0) err = reader.read_u64(level);
+        }
+        if (err != 0) {
+            std::cerr << "Error: Could not open " << (fd < 0 ? device : KBD_BACKLIGHT_PATH) << ": "
+                      << std::strerror(err) << std::endl;
+            if (fd >= 0) ::close(fd);
+            file_ops::write_file(dir + "/buffer/enable", "0");
+            return false;
+        }
+        std::cout << "Following ambient light from " << dir << " (thresholds " << thresholds[0] << "/"
+                  << thresholds[1] << "/" << thresholds[2] << " lux)" << std::endl;
+
+        signals::install_stop_handlers();
+        size_t sample_size = static_cast<size_t>(type.storage_bits / 8);
+        std::vector<unsigned char> buf(sample_size * static_cast<size_t>(batch));
+        size_t pending = 0;
+        double lux = -1.0;
+        bool ok = true;
+        while (!signals::stop_requested) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            int ready = poll(&pfd, 1, -1);
+            if (ready < 0 && errno == EINTR) continue;
+            ssize_t n = ready > 0 ? ::read(fd, buf.data() + pending, buf.size() - pending) : -1;
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if (n == 0) break;
+            if (n < 0) {
+                std::cerr << "Error: Could not read " << device << ": " << std::strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+
+            pending += static_cast<size_t>(n);
+            size_t complete = pending / sample_size;
+            for (size_t i = 0; i < complete; ++i) {
+                double sample = (iio::decode(buf.data() + i * sample_size, type) + offset) * scale;
+                lux = lux < 0 ? sample : lux + 0.2 * (sample - lux);
+            }
+            // Keep a partial sample for the next read
+            std::memmove(buf.data(), buf.data() + complete * sample_size, pending - complete * sample_size);
+            pending -= complete * sample_size;
+
+            uint64_t next = level_for(lux, level, thresholds);
+            if (complete > 0 && next != level) {
+                std::string text = std::to_string(next);
+                if (int write_err = kbd.write(text)) {
+                    std::cerr << "Error: Could not write to " << KBD_BACKLIGHT_PATH << ": " << std::strerror(write_err)
+                              << std::endl;
+                } else {
+                    std::cout << timestamp_now() << " " << std::lround(lux) << " lux, keyboard backlight " << next
+                              << std::endl;
+                    level = next;
+                }
+            }
+        }
+
+        ::close(fd);
+        file_ops::write_file(dir + "/buffer/enable", "0");
+        return ok;
+    }
+
+    // Enable only the illuminance channel and let the buffer wake us once
+    // per 'batch' samples
+    static bool configure_buffer(const std::string& dir, const std::string& channel, int batch) {
+        file_ops::write_file(dir + "/buffer/enable", "0");
+        for (const auto& element : list_directory(dir + "/scan_elements")) {
+            if (element.size() > 3 && element.compare(element.size() - 3, 3, "_en") == 0) {
+                if (!file_ops::write_file(dir + "/scan_elements/" + element, element == channel + "_en" ? "1" : "0")) {
+                    return false;
+                }
+            }
+        }
+
+        // Triggered buffers need a trigger; the device's own one is named <name>-dev<N>
+        std::string trigger, name;
+        if (file_ops::backend().read(dir + "/trigger/current_trigger", trigger) == 0 && trigger.empty() &&
+            file_ops::backend().read(dir + "/name", name) == 0) {
+            std::string wanted = name + "-dev" + dir.substr(dir.rfind("device") + 6);
+            for (const auto& entry : list_directory(IIO_DEVICES_PATH)) {
+                std::string trigger_name;
+                if (entry.compare(0, 7, "trigger") == 0 &&
+                    file_ops::backend().read(IIO_DEVICES_PATH + "/" + entry + "/name", trigger_name) == 0 &&
+                    trigger_name == wanted) {
+                    file_ops::write_file(dir + "/trigger/current_trigger", trigger_name);
+                }
+            }
+        }
+
+        std::string batch_text = std::to_string(batch);
+        file_ops::write_file(dir + "/buffer/length", std::to_string(batch * 4));
+        // Older kernels have no watermark and wake per sample
+        file_ops::backend().write(dir + "/buffer/watermark", batch_text);
+        return file_ops::write_file(dir + "/buffer/enable", "1");
+    }
+
+    // Level 3 below thresholds[0] lux, 2 below [1], 1 below [2], else 0.
+    // Crossing a boundary needs 20% margin so flicker near it is ignored.
+    static uint64_t level_for(double lux, uint64_t level, const double thresholds[3]) {
+        const double hysteresis = 0.2;
+        int current = static_cast<int>(std::min<uint64_t>(level, 3));
+        while (current > 0 && lux >= thresholds[3 - current] * (1.0 + hysteresis)) current--;
+        while (current < 3 && lux < thresholds[2 - current] * (1.0 - hysteresis)) current++;
+        return static_cast<uint64_t>(current);
+    }
+};
+
+class StartOnLidOpenCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing start-on-lid-open subcommand. Use 'read' or 'set'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        if (subcommand == "read") {
+            return read_status();
+        } else if (subcommand == "set") {
+            if (args.size() < 3) {
+                std::cerr << "Error: Missing value for 'start-on-lid-open set'" << std::endl;
+                return false;
+            }
+            return set_status(args[2]);
+        }
+        std::cerr << "Error: Unknown start-on-lid-open subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  start-on-lid-open read   Read start on lid open status\n"
+               "  start-on-lid-open set <value>  Set start on lid open (0/1, on/off, true/false, yes/no)";
+    }
+
+private:
+    bool read_status() {
+        std::string value;
+        if (!file_ops::read_file(feature_paths().start_on_lid_open, value)) return false;
+        std::cout << "Start on lid open: " << (value == "1" ? "Enabled" : "Disabled") << std::endl;
+        return true;
+    }
+
+    bool set_status(const std::string& value) {
+        std::string normalized_value;
+        // Convert various input formats to "0" or "1"
+        if (value == "0" || value == "off" || value == "false" || value == "no") {
+            normalized_value = "0";
+        } else if (value == "1" || value == "on" || value == "true" || value == "yes") {
+            normalized_value = "1";
+        } else {
+            std::cerr << "Error: Value must be one of: 0/1, on/off, true/false, yes/no" << std::endl;
+            return false;
+        }
+        
+        if (!file_ops::write_file(feature_paths().start_on_lid_open, normalized_value)) return false;
+        std::cout << "Set start on lid open to " << (normalized_value == "1" ? "Enabled" : "Disabled") << std::endl;
+        return true;
+    }
+};
+
+class UsbChargeCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing usb-charge subcommand. Use 'read' or 'set'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        if (subcommand == "read") {
+            return read_status();
+        } else if (subcommand == "set") {
+            if (args.size() < 3) {
+                std::cerr << "Error: Missing value for 'usb-charge set'" << std::endl;
+                return false;
+            }
+            return set_status(args[2]);
+        }
+        std::cerr << "Error: Unknown usb-charge subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  usb-charge read   Read USB charge status\n"
+               "  usb-charge set <value>  Set USB charge (0/1, on/off, true/false, yes/no)";
+    }
+
+private:
+    bool read_status() {
+        std::string value;
+        if (!file_ops::read_file(feature_paths().usb_charge, value)) return false;
+        std::cout << "USB charge: " << (value == "1" ? "Enabled" : "Disabled") << std::endl;
+        return true;
+    }
+
+    bool set_status(const std::string& value) {
+        std::string normalized_value;
+        // Convert various input formats to "0" or "1"
+        if (value == "0" || value == "off" || value == "false" || value == "no") {
+            normalized_value = "0";
+        } else if (value == "1" || value == "on" || value == "true" || value == "yes") {
+            normalized_value = "1";
+        } else {
+            std::cerr << "Error: Value must be one of: 0/1, on/off, true/false, yes/no" << std::endl;
+            return false;
+        }
+        
+        if (!file_ops::write_file(feature_paths().usb_charge, normalized_value)) return false;
+        std::cout << "Set USB charge to " << (normalized_value == "1" ? "Enabled" : "Disabled") << std::endl;
+        return true;
+    }
+};
+
+class EnergyCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing energy subcommand. Use 'read', 'sample' or 'watch'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        int interval_ms = subcommand == "watch" ? 1000 : 100;
+        int count = 10;
+        try {
+            if (args.size() > 2) interval_ms = std::stoi(args[2]);
+            if (args.size() > 3) count = std::stoi(args[3]);
+        } catch (...) {
+            std::cerr << "Error: Invalid interval or count" << std::endl;
+            return false;
+        }
+        if (interval_ms < 1 || count < 1) {
+            std::cerr << "Error: Interval and count must be positive" << std::endl;
+            return false;
+        }
+
+        if (subcommand == "read") {
+            return sample(interval_ms, 1, false);
+        } else if (subcommand == "sample") {
+            return sample(interval_ms, count, true);
+        } else if (subcommand == "watch") {
+            return sample(interval_ms, 0, true);
+        }
+        std::cerr << "Error: Unknown energy subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  energy read [interval-ms]  Read RAPL power per domain over a short interval\n"
+               "  energy sample <interval-ms> <count>  Print power per sample and the average\n"
+               "  energy watch [interval-ms]  Print power continuously with a running average";
+    }
+
+private:
+    // Sample every domain count times (0 for forever). Counters stay open and
+    // are read with pread, so even 100 Hz sampling is cheap.
+    bool sample(int interval_ms, int count, bool per_sample) {
+        std::vector<rapl::Domain> domains;
+        if (!rapl::discover(domains)) return false;
+
+        std::vector<double> total_j(domains.size(), 0.0);
+        auto start = std::chrono::steady_clock::now();
+        auto previous = start;
+        auto next = start;
+        for (int i = 0; count == 0 || i < count; ++i) {
+            next += std::chrono::milliseconds(interval_ms);
+            std::this_thread::sleep_until(next);
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - previous).count();
+            double since_start = std::chrono::duration<double>(now - start).count();
+            previous = now;
+
+            std::ostringstream line;
+            line << std::fixed << std::setprecision(2);
+            if (per_sample) line << std::setw(8) << since_start << "s";
+            for (size_t d = 0; d < domains.size(); ++d) {
+                uint64_t delta_uj;
+                if (int err = rapl::update(domains[d], delta_uj)) {
+                    std::cerr << "Error: Could not read " << domains[d].energy.path() << ": "
+                              << std::strerror(err) << std::endl;
+                    return false;
+                }
+                total_j[d] += delta_uj / 1e6;
+                if (per_sample) {
+                    line << "  " << domains[d].name << " " << delta_uj / 1e6 / elapsed << " W";
+                    if (count == 0) line << " (avg " << total_j[d] / since_start << ")";
+                } else {
+                    line << domains[d].name << ": " << delta_uj / 1e6 / elapsed << " W"
+                         << " (counter " << domains[d].last_uj / 1e6 << " J)\n";
+                }
+            }
+            std::cout << line.str() << (per_sample ? "\n" : "") << std::flush;
+        }
+
+        if (per_sample) {
+            double since_start = std::chrono::duration<double>(previous - start).count();
+            std::cout << "Average over " << std::fixed << std::setprecision(2) << since_start << "s:\n";
+            for (size_t d = 0; d < domains.size(); ++d) {
+                std::cout << "  " << domains[d].name << ": " << total_j[d] / since_start << " W, "
+                          << total_j[d] << " J\n";
+            }
+        }
+        return true;
+    }
+};
+
+// Kernel uevents from the NETLINK_KOBJECT_UEVENT multicast group
+namespace uevent {
+    // Non-blocking socket for epoll loops, -1 with errno set on failure
+    int open_socket() {
+        int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+        if (fd < 0) return -1;
+        struct sockaddr_nl addr = {};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = 1;  // Kernel events, not udev's re-broadcasts
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            return -1;
+        }
+        return fd;
+    }
+
+    // Receive one queued event as KEY=VALUE properties; false when the
+    // queue is empty
+    bool receive(int fd, std::map<std::string, std::string>& properties) {
+        char buf[8192];
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) return false;
+        buf[n] = '\0';
+        properties.clear();
+        // The header is ACTION@DEVPATH, followed by NUL separated properties
+        for (size_t pos = std::strlen(buf) + 1; pos < static_cast<size_t>(n); pos += std::strlen(buf + pos) + 1) {
+            const char* eq = std::strchr(buf + pos, '=');
+            if (eq != nullptr) properties[std::string(buf + pos, static_cast<size_t>(eq - (buf + pos)))] = eq + 1;
+        }
+        return true;
+    }
+}
+
+// AC adapter and battery state from the power_supply class
+namespace power_supply {
+    // The AC adapter's online attribute. Its name varies between models
+    // (ADP1, AC, ACAD), so look for the first supply of type Mains.
+    std::string find_mains_online() {
+        DIR* dir = opendir((root_prefix() + POWER_SUPPLY_PATH).c_str());
+        if (dir != nullptr) {
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                if (entry->d_name[0] == '.') continue;
+                std::string base = POWER_SUPPLY_PATH + "/" + entry->d_name + "/";
+                std::string type;
+                if (file_ops::backend().read(base + "type", type) == 0 && type == "Mains") {
+                    closedir(dir);
+                    return base + "online";
+                }
+            }
+            closedir(dir);
+        }
+        return POWER_SUPPLY_PATH + "/ADP1/online";
+    }
+
+    bool read_int(file_ops::Attribute& attribute, int& value) {
+        uint64_t raw;
+        if (attribute.read_u64(raw) != 0) return false;
+        value = static_cast<int>(raw);
+        return true;
+    }
+}
+
+class RunWhenCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        Conditions conditions;
+        size_t i = 1;
+        try {
+            for (; i < args.size() && args[i] != "--"; ++i) {
+                if (args[i] == "--ac") {
+                    conditions.ac = true;
+                } else if (args[i] == "--battery-min" && i + 1 < args.size()) {
+                    conditions.battery_min = std::stoi(args[++i]);
+                } else if (args[i] == "--profile" && i + 1 < args.size()) {
+                    conditions.profile = args[++i];
+                } else {
+                    std::cerr << "Error: Unknown run-when option '" << args[i] << "'" << std::endl;
+                    return false;
+                }
+            }
+        } catch (...) {
+            std::cerr << "Error: Invalid value for --battery-min" << std::endl;
+            return false;
+        }
+        if (i + 1 >= args.size()) {
+            std::cerr << "Error: Missing command. Use 'run-when [options] -- <command>'" << std::endl;
+            return false;
+        }
+        if (conditions.battery_min < 0 || conditions.battery_min > 100) {
+            std::cerr << "Error: Value must be between 0 and 100" << std::endl;
+            return false;
+        }
+        return run(conditions, std::vector<std::string>(args.begin() + i + 1, args.end()));
+    }
+
+    std::string get_help() const override {
+        return "  run-when [--ac] [--battery-min <pct>] [--profile <mode>] -- <command>\n"
+               "               Run <command> once the conditions hold, stopping it while they don't";
+    }
+
+private:
+    struct Conditions {
+        bool ac = false;
+        int battery_min = 0;
+        std::string profile;
+    };
+
+    // ACPI batteries normally report capacity changes through uevents; this
+    // slow recheck only guards against firmware that doesn't
+    static constexpr int CAPACITY_RECHECK_MS = 60000;
+
+    file_ops::Attribute ac_online;
+    file_ops::Attribute capacity;
+
+    bool conditions_hold(const Conditions& conditions) {
+        int value;
+        if (conditions.ac && !(power_supply::read_int(ac_online, value) && value == 1)) return false;
+        if (conditions.battery_min > 0 &&
+            !(power_supply::read_int(capacity, value) && value >= conditions.battery_min)) {
+            return false;
+        }
+        return true;
+    }
+
+    bool run(const Conditions& conditions, const std::vector<std::string>& command) {
+        std::string original;
+        if (!conditions.profile.empty()) {
+            std::string choices;
+            if (!profiles::read_choices(choices)) return false;
+            std::vector<std::string> available = profiles::ladder(choices);
+            if (std::find(available.begin(), available.end(), conditions.profile) == available.end()) {
+                std::cerr << "Error: Invalid performance mode '" << conditions.profile << "'" << std::endl;
+                return false;
+            }
+            if (!file_ops::read_file(profiles::current_path(), original)) return false;
+        }
+        if (conditions.ac && ac_online.open(power_supply::find_mains_online()) != 0) {
+            std::cerr << "Error: Could not find the AC adapter under " << POWER_SUPPLY_PATH << std::endl;
+            return false;
+        }
+        if (conditions.battery_min > 0 && capacity.open(BATTERY_CAPACITY_PATH) != 0) {
+            std::cerr << "Error: Could not open " << BATTERY_CAPACITY_PATH << std::endl;
+            return false;
+        }
+
+        // Everything the loop waits for arrives through one epoll set.
+        // SIGTTOU is only blocked, so handing the terminal over works.
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigset_t blocked = mask;
+        sigaddset(&blocked, SIGTTOU);
+        BlockedSignals guard(blocked);
+        FileDescriptor signal_fd(signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK));
+        FileDescriptor uevent_fd(uevent::open_socket());
+        FileDescriptor epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+        if (signal_fd.get() < 0 || uevent_fd.get() < 0 || epoll_fd.get() < 0) {
+            std::cerr << "Error: Could not set up event monitoring: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        for (int fd : {signal_fd.get(), uevent_fd.get()}) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, fd, &event) != 0) {
+                std::cerr << "Error: Could not set up event monitoring: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+        }
+        // Started from an interactive shell, the job gets the terminal while
+        // it runs, so it can read input and Ctrl+C reaches it directly
+        int terminal = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp() ? STDIN_FILENO : -1;
+
+        pid_t child = -1;
+        bool stopped = false;
+        int status = 0;
+        bool ok = true;
+        bool interrupted = false;
+        bool waiting = false;
+        bool recheck = true;
+        while (true) {
+            bool holds = recheck && conditions_hold(conditions);
+            if (holds && (child < 0 || stopped)) {
+                if (!conditions.profile.empty() && !profiles::apply(conditions.profile)) {
+                    ok = false;
+                    break;
+                }
+                if (child < 0) {
+                    child = spawn(command, guard.previous(), terminal);
+                    if (child < 0) {
+                        ok = false;
+                        break;
+                    }
+                    std::cerr << "run-when: Conditions met, started " << command[0] << std::endl;
+                } else {
+                    if (terminal >= 0) tcsetpgrp(terminal, child);
+                    kill(-child, SIGCONT);
+                    stopped = false;
+                    std::cerr << "run-when: Conditions met again, resumed " << command[0] << std::endl;
+                }
+            } else if (recheck && !holds && child >= 0 && !stopped) {
+                // Stop the whole process group, builds and backups fork
+                kill(-child, SIGSTOP);
+                stopped = true;
+                if (terminal >= 0) tcsetpgrp(terminal, getpgrp());
+                std::cerr << "run-when: Conditions lapsed, suspended " << command[0] << std::endl;
+                if (!original.empty()) profiles::apply(original);
+            } else if (recheck && !holds && child < 0 && !waiting) {
+                std::cerr << "run-when: Waiting for conditions" << std::endl;
+                waiting = true;
+            }
+
+            int timeout = accounting::checkpoint_timeout_ms();
+            if (conditions.battery_min > 0 && (timeout < 0 || timeout > CAPACITY_RECHECK_MS)) {
+                timeout = CAPACITY_RECHECK_MS;
+            }
+            struct epoll_event events[4];
+            int n = epoll_wait(epoll_fd.get(), events, 4, timeout);
+            if (n < 0 && errno != EINTR) {
+                ok = false;
+                break;
+            }
+            accounting::tick();
+            // Only power supply events and the capacity timer can change
+            // the conditions
+            recheck = n == 0;
+            bool child_exited = false;
+            for (int e = 0; e < n; ++e) {
+                if (events[e].data.fd == uevent_fd.get()) {
+                    std::map<std::string, std::string> properties;
+                    while (uevent::receive(uevent_fd.get(), properties)) {
+                        if (properties["SUBSYSTEM"] == "power_supply") recheck = true;
+                    }
+                } else {
+                    struct signalfd_siginfo info;
+                    while (::read(signal_fd.get(), &info, sizeof(info)) == sizeof(info)) {
+                        if (info.ssi_signo == SIGCHLD) {
+                            child_exited = child >= 0 && waitpid(child, &status, WNOHANG) == child;
+                        } else if (child >= 0) {
+                            // Pass Ctrl+C and SIGTERM on, a stopped job has to run to see them
+                            kill(-child, static_cast<int>(info.ssi_signo));
+                            if (stopped) kill(-child, SIGCONT);
+                            stopped = false;
+                        } else {
+                            interrupted = true;
+                        }
+                    }
+                }
+            }
+            if (child_exited || interrupted) break;
+        }
+
+        if (terminal >= 0) tcsetpgrp(terminal, getpgrp());
+        if (!original.empty() && child >= 0) profiles::apply(original);
+        accounting::tick(true);
+        if (!ok || interrupted) return false;
+
+        if (WIFEXITED(status)) {
+            std::cerr << "run-when: " << command[0] << " exited with status " << WEXITSTATUS(status) << std::endl;
+            return WEXITSTATUS(status) == 0;
+        }
+        std::cerr << "run-when: " << command[0] << " killed by signal " << WTERMSIG(status) << std::endl;
+        return false;
+    }
+
+    // Blocks signals for its lifetime and then restores the mask it found
+    class BlockedSignals {
+    public:
+        explicit BlockedSignals(const sigset_t& signals) { sigprocmask(SIG_BLOCK, &signals, &saved); }
+        BlockedSignals(const BlockedSignals&) = delete;
+        BlockedSignals& operator=(const BlockedSignals&) = delete;
+        ~BlockedSignals() { sigprocmask(SIG_SETMASK, &saved, nullptr); }
+
+        const sigset_t& previous() const { return saved; }
+
+    private:
+        sigset_t saved;
+    };
+
+    // Start the command in its own process group, in the terminal's
+    // foreground when there is one, with the signal mask run-when started with
+    static pid_t spawn(const std::vector<std::string>& command, const sigset_t& original_mask, int terminal) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "Error: Could not start " << command[0] << ": " << std::strerror(errno) << std::endl;
+            return -1;
+        }
+        if (pid == 0) {
+            setpgid(0, 0);
+            // SIGTTOU is still blocked here, so this can't stop the child
+            if (terminal >= 0) tcsetpgrp(terminal, getpid());
+            sigprocmask(SIG_SETMASK, &original_mask, nullptr);
+            std::vector<char*> argv;
+            for (const auto& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+            argv.push_back(nullptr);
+            execvp(argv[0], argv.data());
+            std::cerr << "Error: Could not run " << command[0] << ": " << std::strerror(errno) << std::endl;
+            _exit(127);
+        }
+        // Also set both here so kill(-pid) works, and the terminal is handed
+        // over, before the child gets scheduled
+        setpgid(pid, pid);
+        if (terminal >= 0) tcsetpgrp(terminal, pid);
+        return pid;
+    }
+};
+
+// Metrics in the Prometheus text exposition format. Files are replaced
+// atomically so a node_exporter textfile collector never sees a partial one.
+namespace metrics {
+    struct Sample {
+        std::string name;
+        std::string help;
+        std::string type;  // "gauge" or "counter"
+        double value;
+    };
+
+    bool write_textfile(const std::string& path, const std::vector<Sample>& samples) {
+        std::ostringstream out;
+        for (const auto& sample : samples) {
+            out << "# HELP " << sample.name << " " << sample.help << "\n"
+                << "# TYPE " << sample.name << " " << sample.type << "\n"
+                << sample.name << " " << sample.value << "\n";
+        }
+        std::string data = out.str();
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        bool ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+}
+
+// Limits CPU use of cgroup v2 groups while running on battery. The state is
+// re-evaluated on power_supply uevents and limits are only written when the
+// throttle level changes, all groups in one pass over pre-opened files.
+class CgroupThrottleCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        std::vector<std::string> groups;
+        std::string metrics_path;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (i + 1 >= args.size()) {
+                std::cerr << "Error: Missing value for '" << args[i] << "'" << std::endl;
+                return false;
+            }
+            const std::string& option = args[i];
+            const std::string& value = args[++i];
+            if (option == "--group") {
+                groups.push_back(value[0] == '/' ? value : CGROUP_ROOT + "/" + value);
+            } else if (option == "--metrics") {
+                metrics_path = value;
+            } else if (option == "--on-battery") {
+                Level level;
+                if (!parse_limits(value, level)) return false;
+                levels[0] = level;
+            } else if (option == "--below") {
+                Level level;
+                size_t colon = value.find(':');
+                try {
+                    level.below = std::stoi(value.substr(0, colon));
+                } catch (...) {
+                    level.below = -1;
+                }
+                if (colon == std::string::npos || level.below < 1 || level.below > 100 ||
+                    !parse_limits(value.substr(colon + 1), level)) {
+                    std::cerr << "Error: Invalid threshold '" << value << "'. Use <pct>:<limits>" << std::endl;
+                    return false;
+                }
+                levels.push_back(level);
+            } else {
+                std::cerr << "Error: Unknown cgroup-throttle option '" << option << "'" << std::endl;
+                return false;
+            }
+        }
+        if (groups.empty()) {
+            std::cerr << "Error: Missing --group" << std::endl;
+            return false;
+        }
+        // Deeper thresholds come later so the last match wins
+        std::sort(levels.begin() + 1, levels.end(), [](const Level& a, const Level& b) { return a.below > b.below; });
+        return run(groups, metrics_path);
+    }
+
+    std::string get_help() const override {
+        return "  cgroup-throttle --group <cgroup>... [--on-battery <limits>] [--below <pct>:<limits>]...\n"
+               "               [--metrics <file>]  Limit cgroup v2 CPU use while on battery, restore on AC\n"
+               "               <limits> is max=<quota-us>[/<period-us>],weight=<1-10000>";
+    }
+
+private:
+    // Limits for one throttle level; empty values leave the file alone.
+    // levels[0] applies on battery, the rest below a capacity threshold.
+    struct Level {
+        int below = 101;
+        std::string cpu_max;
+        std::string cpu_weight;
+    };
+
+    struct Group {
+        std::string path;
+        file_ops::Attribute cpu_max;
+        file_ops::Attribute cpu_weight;
+        std::string original_max;
+        std::string original_weight;
+    };
+
+    std::vector<Level> levels = {Level()};
+
+    static constexpr int METRICS_REFRESH_MS = 60000;
+
+    static bool parse_limits(const std::string& spec, Level& level) {
+        std::istringstream items(spec);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            size_t eq = item.find('=');
+            std::string key = item.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+            bool ok = !value.empty() && value.find_first_not_of("0123456789/") == std::string::npos;
+            if (ok && key == "max") {
+                size_t slash = value.find('/');
+                level.cpu_max = slash == std::string::npos ? value + " 100000"
+                                                           : value.substr(0, slash) + " " + value.substr(slash + 1);
+            } else if (ok && key == "weight" && value.find('/') == std::string::npos) {
+                level.cpu_weight = value;
+            } else {
+                std::cerr << "Error: Invalid limit '" << item << "'" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 0 when unthrottled, otherwise 1 + index into levels
+    int desired_level(bool on_ac, int capacity) const {
+        if (on_ac) return 0;
+        int level = 0;
+        for (size_t i = 0; i < levels.size(); ++i) {
+            bool has_limits = !levels[i].cpu_max.empty() || !levels[i].cpu_weight.empty();
+            if (has_limits && capacity < levels[i].below) level = static_cast<int>(i) + 1;
+        }
+        return level;
+    }
+
+    bool apply(std::vector<Group>& groups, int level) {
+        bool ok = true;
+        for (auto& group : groups) {
+            const std::string& max = level > 0 && !levels[level - 1].cpu_max.empty() ? levels[level - 1].cpu_max
+                                                                                      : group.original_max;
+            const std::string& weight = level > 0 && !levels[level - 1].cpu_weight.empty()
+                                            ? levels[level - 1].cpu_weight
+                                            : group.original_weight;
+            for (auto [attribute, value] : {std::make_pair(&group.cpu_max, &max), std::make_pair(&group.cpu_weight, &weight)}) {
+                if (int err = attribute->write(*value)) {
+                    std::cerr << "Error: Could not write to " << attribute->path() << ": " << std::strerror(err) << std::endl;
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    }
+
+    bool run(const std::vector<std::string>& paths, const std::string& metrics_path) {
+        std::vector<Group> groups;
+        for (const auto& path : paths) {
+            Group group;
+            group.path = path;
+            file_ops::Attribute reader;
+            int err = 0;
+            for (auto [name, attribute, original] : {std::make_tuple("/cpu.max", &group.cpu_max, &group.original_max),
+                                                     std::make_tuple("/cpu.weight", &group.cpu_weight, &group.original_weight)}) {
+                if (err == 0) err = reader.open(path + name);
+                if (err == 0) err = reader.read(*original);
+                if (err == 0) err = attribute->open(path + name, true);
+                if (err != 0) {
+                    std::cerr << "Error: Could not open " << path << name << ": " << std::strerror(err)
+                              << (err == ENOENT ? " (is the cpu controller enabled?)" : "") << std::endl;
+                    return false;
+                }
+            }
+            groups.push_back(std::move(group));
+        }
+
+        file_ops::Attribute ac_online, capacity;
+        if (ac_online.open(power_supply::find_mains_online()) != 0 || capacity.open(BATTERY_CAPACITY_PATH) != 0) {
+            std::cerr << "Error: Could not open the AC adapter and battery under " << POWER_SUPPLY_PATH << std::endl;
+            return false;
+        }
+        int uevent_fd = uevent::open_socket();
+        if (uevent_fd < 0) {
+            std::cerr << "Error: Could not listen for uevents: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        signals::install_stop_handlers();
+        int level = 0;
+        int transitions = 0;
+        double throttled_s = 0.0;
+        int online = 1, percent = 100;
+        int written_level = -1, written_online = -1, written_percent = -1;
+        auto last = std::chrono::steady_clock::now();
+        auto written_at = last;
+        bool ok = true;
+        while (ok && !signals::stop_requested) {
+            auto now = std::chrono::steady_clock::now();
+            if (level > 0) throttled_s += std::chrono::duration<double>(now - last).count();
+            last = now;
+
+            power_supply::read_int(ac_online, online);
+            power_supply::read_int(capacity, percent);
+            int next = desired_level(online == 1, percent);
+            if (next != level) {
+                ok = apply(groups, next);
+                std::cout << (next == 0 ? "Restored CPU limits" : "Throttling at level " + std::to_string(next))
+                          << " (AC " << (online == 1 ? "online" : "offline") << ", battery " << percent << "%)"
+                          << std::endl;
+                level = next;
+                transitions++;
+            }
+            // Rewrite the file when a value in it changed; while throttled,
+            // the growing time counter is refreshed at most once a minute
+            bool changed = level != written_level || online != written_online || percent != written_percent;
+            bool stale = level > 0 && now - written_at >= std::chrono::milliseconds(METRICS_REFRESH_MS);
+            if (!metrics_path.empty() && (changed || stale)) {
+                if (metrics::write_textfile(metrics_path, {
+                        {"samsung_cli_cgroup_throttle_level", "Current cgroup throttle level, 0 when unthrottled",
+                         "gauge", static_cast<double>(level)},
+                        {"samsung_cli_cgroup_throttle_seconds_total", "Time spent throttled", "counter", throttled_s},
+                        {"samsung_cli_cgroup_throttle_transitions_total", "Throttle level changes", "counter",
+                         static_cast<double>(transitions)},
+                        {"samsung_cli_ac_online", "AC adapter online", "gauge", static_cast<double>(online)},
+                        {"samsung_cli_battery_capacity_percent", "Battery capacity", "gauge", static_cast<double>(percent)},
+                    })) {
+                    written_level = level;
+                    written_online = online;
+                    written_percent = percent;
+                    written_at = now;
+                } else {
+                    std::cerr << "Warning: Could not write metrics to " << metrics_path << std::endl;
+                }
+            }
+
+            // Wake on power_supply uevents; the timeout only refreshes the
+            // time-in-throttle metric
+            struct pollfd pfd = {uevent_fd, POLLIN, 0};
+            if (poll(&pfd, 1, METRICS_REFRESH_MS) > 0) {
+                std::map<std::string, std::string> properties;
+                while (uevent::receive(uevent_fd, properties)) {
+                }
+            }
+        }
+
+        ::close(uevent_fd);
+        if (level != 0 && !apply(groups, 0)) ok = false;
+        return ok;
+    }
+};
+
+// Thermal throttle counters for every CPU, reported next to the current
+// profile and fan speed so throughput drops can be attributed
+class ThrottleCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2) {
+            std::cerr << "Error: Missing throttle subcommand. Use 'read' or 'watch'." << std::endl;
+            return false;
+        }
+
+        std::string subcommand = args[1];
+        if (subcommand == "read") {
+            return discover() && sweep() && report_totals();
+        } else if (subcommand == "watch") {
+            int interval_ms = 1000;
+            try {
+                if (args.size() > 2) interval_ms = std::stoi(args[2]);
+            } catch (...) {
+                interval_ms = 0;
+            }
+            if (interval_ms < 10) {
+                std::cerr << "Error: Interval must be at least 10 ms" << std::endl;
+                return false;
+            }
+            return discover() && watch(interval_ms);
+        }
+        std::cerr << "Error: Unknown throttle subcommand '" << subcommand << "'" << std::endl;
+        return false;
+    }
+
+    std::string get_help() const override {
+        return "  throttle read Read thermal throttle counts and time for all CPUs\n"
+               "  throttle watch [interval-ms]  Report throttling per interval with mode and fan speed";
+    }
+
+private:
+    // One throttle_count/total_time_ms pair, kept open between sweeps
+    struct Counter {
+        file_ops::Attribute count;
+        file_ops::Attribute time_ms;
+        uint64_t last_count = 0;
+        uint64_t last_time_ms = 0;
+        uint64_t delta_count = 0;
+        uint64_t delta_time_ms = 0;
+    };
+
+    struct Cpu {
+        int id;
+        Counter core;
+    };
+
+    struct Package {
+        int id;
+        Counter counter;
+    };
+
+    std::vector<Cpu> cpus;
+    std::vector<Package> packages;
+    file_ops::Attribute profile;
+    file_ops::Attribute fan;
+
+    static int open_counter(Counter& counter, const std::string& prefix) {
+        if (int err = counter.count.open(prefix + "_throttle_count")) return err;
+        return counter.time_ms.open(prefix + "_throttle_total_time_ms");
+    }
+
+    // Open every counter once. Package counters are repeated under each of
+    // the package's CPUs, so only the first CPU of each package is kept.
+    bool discover() {
+        DIR* dir = opendir((root_prefix() + CPU_PATH).c_str());
+        if (dir == nullptr) {
+            std::cerr << "Error: Could not open " << CPU_PATH << std::endl;
+            return false;
+        }
+        std::vector<int> ids;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strncmp(entry->d_name, "cpu", 3) == 0 && std::isdigit(static_cast<unsigned char>(entry->d_name[3]))) {
+                ids.push_back(std::atoi(entry->d_name + 3));
+            }
+        }
+        closedir(dir);
+        std::sort(ids.begin(), ids.end());
+
+        int first_error = 0;
+        for (int id : ids) {
+            std::string base = CPU_PATH + "/cpu" + std::to_string(id);
+            Cpu cpu{id, {}};
+            if (int err = open_counter(cpu.core, base + "/thermal_throttle/core")) {
+                // Offline CPUs have no thermal_throttle directory
+                if (first_error == 0) first_error = err;
+                continue;
+            }
+            cpus.push_back(std::move(cpu));
+
+            std::string package_id;
+            int package = file_ops::backend().read(base + "/topology/physical_package_id", package_id) == 0
+                              ? std::atoi(package_id.c_str())
+                              : 0;
+            bool known = std::any_of(packages.begin(), packages.end(), [&](const Package& p) { return p.id == package; });
+            Package entry_package{package, {}};
+            if (!known && open_counter(entry_package.counter, base + "/thermal_throttle/package") == 0) {
+                packages.push_back(std::move(entry_package));
+            }
+        }
+        if (cpus.empty()) {
+            std::cerr << "Error: No thermal throttle counters under " << CPU_PATH << ": "
+                      << std::strerror(first_error != 0 ? first_error : ENOENT) << std::endl;
+            return false;
+        }
+        profile.open(profiles::current_path());
+        fan.open(fans::primary_path());
+        return true;
+    }
+
+    static bool update(Counter& counter) {
+        uint64_t count, time_ms;
+        if (counter.count.read_u64(count) != 0 || counter.time_ms.read_u64(time_ms) != 0) return false;
+        counter.delta_count = count - counter.last_count;
+        counter.delta_time_ms = time_ms - counter.last_time_ms;
+        counter.last_count = count;
+        counter.last_time_ms = time_ms;
+        return true;
+    }
+
+    // One pass over the open counters; each read is a single pread into a
+    // stack buffer, so the cost grows only with the number of CPUs
+    bool sweep() {
+        for (auto& cpu : cpus) {
+            if (!update(cpu.core)) {
+                std::cerr << "Error: Could not read " << cpu.core.count.path() << std::endl;
+                return false;
+            }
+        }
+        for (auto& package : packages) {
+            if (!update(package.counter)) {
+                std::cerr << "Error: Could not read " << package.counter.count.path() << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string context() {
+        std::string mode = "unknown";
+        uint64_t rpm = 0;
+        profile.read(mode);
+        bool have_fan = fan.read_u64(rpm) == 0;
+        return "mode " + mode + ", fan " + (have_fan ? std::to_string(rpm) + " RPM" : "unknown");
+    }
+
+    bool report_totals() {
+        std::cout << "Thermal throttling (" << context() << ")\n";
+        for (const auto& package : packages) {
+            std::cout << "  package " << package.id << ": " << package.counter.last_count << " events, "
+                      << package.counter.last_time_ms << " ms\n";
+        }
+        for (const auto& cpu : cpus) {
+            std::cout << "  cpu" << cpu.id << ": " << cpu.core.last_count << " events, "
+                      << cpu.core.last_time_ms << " ms\n";
+        }
+        std::cout << std::flush;
+        return true;
+    }
+
+    bool watch(int interval_ms) {
+        if (!sweep()) return false;
+        signals::install_stop_handlers();
+        auto start = std::chrono::steady_clock::now();
+        auto next = start;
+        std::ostringstream line;
+        while (!signals::stop_requested) {
+            next += std::chrono::milliseconds(interval_ms);
+            std::this_thread::sleep_until(next);
+            if (signals::stop_requested) break;
+            if (!sweep()) return false;
+
+            uint64_t events = 0, time_ms = 0;
+            for (const auto& cpu : cpus) {
+                events += cpu.core.delta_count;
+                time_ms += cpu.core.delta_time_ms;
+            }
+            line.str("");
+            line << std::fixed << std::setprecision(1)
+                 << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s "
+                 << context() << ": core " << events << " events " << time_ms << " ms";
+            for (const auto& package : packages) {
+                line << ", package " << package.id << " " << package.counter.delta_count << " events "
+                     << package.counter.delta_time_ms << " ms";
+            }
+            for (const auto& cpu : cpus) {
+                if (cpu.core.delta_count > 0) line << " [cpu" << cpu.id << " " << cpu.core.delta_time_ms << " ms]";
+            }
+            std::cout << line.str() << std::endl;
+        }
+        return true;
+    }
+};
+
+// Input devices under /dev/input
+namespace evdev {
+    bool test_bit(const std::vector<unsigned long>& bits, int bit) {
+        const int per_long = static_cast<int>(sizeof(unsigned long) * 8);
+        return (bits[static_cast<size_t>(bit / per_long)] >> (bit % per_long)) & 1;
+    }
+
+    // Whether the device reports 'code' for event 'type' (EV_SW, EV_KEY...)
+    bool has_code(int fd, int type, int code) {
+        const size_t per_long = sizeof(unsigned long) * 8;
+        std::vector<unsigned long> bits(static_cast<size_t>(KEY_MAX) / per_long + 1);
+        int n = ioctl(fd, EVIOCGBIT(type, static_cast<unsigned>(bits.size() * sizeof(unsigned long))), bits.data());
+        return n > 0 && code / 8 < n && test_bit(bits, code);
+    }
+
+    // Open the first event device that reports 'code', optionally only
+    // devices whose name contains 'name'. Returns -1 if there is none.
+    int open_device(int type, int code, const std::string& name, std::string& path) {
+        std::vector<std::string> entries = list_directory(INPUT_DEVICES_PATH);
+        std::sort(entries.begin(), entries.end());
+        for (const auto& entry : entries) {
+            if (entry.compare(0, 5, "event") != 0) continue;
+            std::string candidate = INPUT_DEVICES_PATH + "/" + entry;
+            int fd = ::open((root_prefix() + candidate).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0) continue;
+            char device_name[256] = {};
+            if (has_code(fd, type, code) &&
+                (name.empty() || (ioctl(fd, EVIOCGNAME(sizeof(device_name) - 1), device_name) >= 0 &&
+                                  std::strstr(device_name, name.c_str()) != nullptr))) {
+                path = candidate;
+                return fd;
+            }
+            ::close(fd);
+        }
+        return -1;
+    }
+
+    // Ask for event timestamps on CLOCK_MONOTONIC so latency can be measured
+    // against steady_clock. Returns the clock the timestamps are on.
+    clockid_t use_monotonic_clock(int fd) {
+        int clock = CLOCK_MONOTONIC;
+        return ioctl(fd, EVIOCSCLOCKID, &clock) == 0 ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+    }
+
+    // Microseconds from the event's timestamp to now
+    double age_us(const struct input_event& event, clockid_t clock) {
+        struct timespec now;
+        clock_gettime(clock, &now);
+        return (static_cast<double>(now.tv_sec) - static_cast<double>(event.input_event_sec)) * 1e6 +
+               (static_cast<double>(now.tv_nsec) / 1e3 - static_cast<double>(event.input_event_usec));
+    }
+}
+
+// Switches to a low power state the moment the lid closes or the AC adapter
+// is unplugged, and back when both are undone. The lid comes from the evdev
+// switch, the adapter from power_supply uevents; every setting is opened up
+// front and written in one pass when the state changes.
+class PowerEventsCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        std::string low = "kbd=0", high, lid_device;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (i + 1 >= args.size()) {
+                std::cerr << "Error: Missing value for '" << args[i] << "'" << std::endl;
+                return false;
+            }
+            if (args[i] == "--low") {
+                low = args[++i];
+            } else if (args[i] == "--high") {
+                high = args[++i];
+            } else if (args[i] == "--lid-device") {
+                lid_device = args[++i];
+            } else {
+                std::cerr << "Error: Unknown power-events option '" << args[i] << "'" << std::endl;
+                return false;
+            }
+        }
+        return parse_settings(low, true) && parse_settings(high, false) && run(lid_device);
+    }
+
+    std::string get_help() const override {
+        return "  power-events [--low <settings>] [--high <settings>] [--lid-device <node>]\n"
+               "               Apply <settings> instantly when the lid closes or AC is unplugged, restore after\n"
+               "               <settings> is profile=<mode>,usb=<0|1>,kbd=<0-3> (default low: lowest profile, kbd=0)";
+    }
+
+private:
+    // One attribute and its value in each state. Values missing from
+    // --high are the ones read at startup.
+    struct Setting {
+        std::string key;
+        std::string low;
+        std::string high;
+        std::vector<file_ops::Attribute> attributes;
+    };
+
+    Setting settings[3] = {{"profile", "", "", {}}, {"usb", "", "", {}}, {"kbd", "", "", {}}};
+
+    bool parse_settings(const std::string& spec, bool is_low) {
+        std::istringstream items(spec);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            size_t eq = item.find('=');
+            auto setting = std::find_if(std::begin(settings), std::end(settings),
+                                        [&](const Setting& s) { return s.key == item.substr(0, eq); });
+            if (eq == std::string::npos || eq + 1 == item.size() || setting == std::end(settings)) {
+                std::cerr << "Error: Invalid setting '" << item << "'. Use profile=, usb= or kbd=" << std::endl;
+                return false;
+            }
+            (is_low ? setting->low : setting->high) = item.substr(eq + 1);
+        }
+        return true;
+    }
+
+    std::vector<std::string> paths_for(const std::string& key) {
+        const FeaturePaths& paths = feature_paths();
+        if (key == "usb") return {paths.usb_charge};
+        if (key == "kbd") return {KBD_BACKLIGHT_PATH};
+        return profiles::targets();
+    }
+
+    // Open every attribute that changes and fill in the defaults
+    bool prepare() {
+        Setting& profile = settings[0];
+        if (profile.low.empty()) {
+            std::string choices;
+            if (!profiles::read_choices(choices) || profiles::ladder(choices).empty()) return false;
+            profile.low = profiles::ladder(choices).front();
+        }
+        for (auto& setting : settings) {
+            if (setting.low.empty() && setting.high.empty()) continue;
+            for (const auto& path : paths_for(setting.key)) {
+                if (path.empty()) {
+                    std::cerr << "Error: '" << setting.key << "' is not supported on this device" << std::endl;
+                    return false;
+                }
+                file_ops::Attribute reader, writer;
+                int err = 0;
+                if (setting.high.empty() || setting.low.empty()) {
+                    std::string& missing = setting.high.empty() ? setting.high : setting.low;
+                    err = reader.open(path);
+                    if (err == 0) err = reader.read(missing);
+                }
+                if (err == 0) err = writer.open(path, true);
+                if (err != 0) {
+                    std::cerr << "Error: Could not open " << path << ": " << std::strerror(err) << std::endl;
+                    return false;
+                }
+                setting.attributes.push_back(std::move(writer));
+            }
+        }
+        return true;
+    }
+
+    bool apply(bool low) {
+        bool ok = true;
+        for (auto& setting : settings) {
+            for (auto& attribute : setting.attributes) {
+                if (int err = attribute.write(low ? setting.low : setting.high)) {
+                    std::cerr << "Error: Could not write to " << attribute.path() << ": " << std::strerror(err) << std::endl;
+                    ok = false;
+                }
+            }
+        }
+        return ok;
+    }
+
+    bool run(const std::string& lid_device) {
+        if (!prepare()) return false;
+
+        std::string lid_path = lid_device;
+        FileDescriptor lid_fd(lid_device.empty() ? evdev::open_device(EV_SW, SW_LID, "", lid_path)
+                                                 : ::open(lid_device.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC));
+        if (lid_fd.get() < 0) {
+            std::cerr << "Warning: No lid switch found" << (lid_device.empty() ? "" : " at " + lid_device)
+                      << ", following AC only" << std::endl;
+        }
+        clockid_t lid_clock = lid_fd.get() >= 0 ? evdev::use_monotonic_clock(lid_fd.get()) : CLOCK_MONOTONIC;
+
+        file_ops::Attribute ac_online;
+        int online = 1;
+        if (ac_online.open(power_supply::find_mains_online()) != 0 || !power_supply::read_int(ac_online, online)) {
+            std::cerr << "Error: Could not read the AC adapter under " << POWER_SUPPLY_PATH << std::endl;
+            return false;
+        }
+        bool lid_closed = false;
+        if (lid_fd.get() >= 0) {
+            std::vector<unsigned long> switches(static_cast<size_t>(SW_MAX) / (sizeof(unsigned long) * 8) + 1);
+            if (ioctl(lid_fd.get(), EVIOCGSW(static_cast<unsigned>(switches.size() * sizeof(unsigned long))), switches.data()) >= 0) {
+                lid_closed = evdev::test_bit(switches, SW_LID);
+            }
+        }
+
+        FileDescriptor uevent_fd(uevent::open_socket());
+        FileDescriptor epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+        if (uevent_fd.get() < 0 || epoll_fd.get() < 0) {
+            std::cerr << "Error: Could not set up event monitoring: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        for (int fd : {lid_fd.get(), uevent_fd.get()}) {
+            if (fd < 0) continue;
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, fd, &event);
+        }
+
+        signals::install_stop_handlers();
+        bool low = lid_closed || online != 1;
+        bool ok = apply(low);
+        if (!settings[0].attributes.empty()) accounting::enter(low ? settings[0].low : settings[0].high);
+        std::cout << "Lid " << (lid_closed ? "closed" : "open") << ", AC " << (online == 1 ? "online" : "offline")
+                  << ": " << (low ? "low" : "high") << " power" << std::endl;
+        int transitions = 0;
+        double total_us = 0.0, worst_us = 0.0;
+        while (!signals::stop_requested) {
+            struct epoll_event events[2];
+            int n = epoll_wait(epoll_fd.get(), events, 2, accounting::checkpoint_timeout_ms());
+            if (n < 0 && errno != EINTR) {
+                ok = false;
+                break;
+            }
+            accounting::tick();
+            if (n <= 0) continue;
+            auto woke = std::chrono::steady_clock::now();
+
+            // The lid event carries a kernel timestamp; uevents don't, so
+            // their latency is counted from the wakeup. It is copied out,
+            // since later reads reuse the buffer.
+            struct input_event lid_event = {};
+            bool lid_changed = false;
+            struct input_event input[16];
+            for (int e = 0; e < n; ++e) {
+                if (events[e].data.fd == lid_fd.get()) {
+                    ssize_t bytes;
+                    while ((bytes = ::read(lid_fd.get(), input, sizeof(input))) > 0) {
+                        for (size_t k = 0; k < static_cast<size_t>(bytes) / sizeof(input[0]); ++k) {
+                            if (input[k].type == EV_SW && input[k].code == SW_LID) {
+                                lid_closed = input[k].value != 0;
+                                lid_event = input[k];
+                                lid_changed = true;
+                            }
+                        }
+                    }
+                    if (bytes == 0 || (bytes < 0 && errno == ENODEV)) {
+                        std::cerr << "Warning: Lid switch " << lid_path << " went away, following AC only" << std::endl;
+                        epoll_ctl(epoll_fd.get(), EPOLL_CTL_DEL, lid_fd.get(), nullptr);
+                        lid_fd.reset();
+                    }
+                } else {
+                    std::map<std::string, std::string> properties;
+                    while (uevent::receive(uevent_fd.get(), properties)) {
+                        if (properties["SUBSYSTEM"] != "power_supply") continue;
+                        if (properties["POWER_SUPPLY_TYPE"] == "Mains" && properties.count("POWER_SUPPLY_ONLINE")) {
+                            online = std::atoi(properties["POWER_SUPPLY_ONLINE"].c_str());
+                        } else {
+                            power_supply::read_int(ac_online, online);
+                        }
+                    }
+                }
+            }
+
+            bool next = lid_closed || online != 1;
+            if (next == low) continue;
+            if (!apply(next)) ok = false;
+            double latency_us = lid_changed
+                                    ? evdev::age_us(lid_event, lid_clock)
+                                    : std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - woke).count();
+            low = next;
+            transitions++;
+            total_us += latency_us;
+            worst_us = std::max(worst_us, latency_us);
+            std::cout << timestamp_now() << " " << (lid_changed ? (lid_closed ? "Lid closed" : "Lid opened")
+                                                                   : (online == 1 ? "AC online" : "AC offline"))
+                      << ": " << (low ? "low" : "high") << " power applied in " << std::fixed << std::setprecision(3)
+                      << latency_us / 1000.0 << " ms" << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            if (!settings[0].attributes.empty()) accounting::enter(low ? settings[0].low : settings[0].high);
+        }
+        accounting::tick(true);
+
+        if (transitions > 0) {
+            std::cout << transitions << " transitions, mean " << std::fixed << std::setprecision(3)
+                      << total_us / transitions / 1000.0 << " ms, max " << worst_us / 1000.0 << " ms" << std::endl;
+        }
+        return ok;
+    }
+};
+
+// Cycles the platform profile on the performance mode hotkey (Fn+F11),
+// which the extra buttons input device reports as a key. Choices and the
+// attributes are prepared once, so a press costs one read and one write.
+class HotkeyCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        int key = KEY_PROG3;
+        std::string device, metrics_path;
+        bool grab = true, notify = false;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "--shared") {
+                grab = false;
+                continue;
+            }
+            if (args[i] == "--notify") {
+                notify = true;
+                continue;
+            }
+            if (i + 1 >= args.size()) {
+                std::cerr << "Error: Missing value for '" << args[i] << "'" << std::endl;
+                return false;
+            }
+            if (args[i] == "--key") {
+                try {
+                    key = std::stoi(args[++i], nullptr, 0);
+                } catch (...) {
+                    key = -1;
+                }
+                if (key <= 0 || key > KEY_MAX) {
+                    std::cerr << "Error: Invalid key code '" << args[i] << "'" << std::endl;
+                    return false;
+                }
+            } else if (args[i] == "--device") {
+                device = args[++i];
+            } else if (args[i] == "--metrics") {
+                metrics_path = args[++i];
+            } else {
+                std::cerr << "Error: Unknown hotkey option '" << args[i] << "'" << std::endl;
+                return false;
+            }
+        }
+        return run(key, device, metrics_path, grab, notify);
+    }
+
+    std::string get_help() const override {
+        return "  hotkey [--key <code>] [--device <node>] [--metrics <file>] [--shared] [--notify]\n"
+               "               Cycle performance modes on the mode hotkey (default KEY_PROG3)";
+    }
+
+private:
+    // Metrics are rewritten this long after a press rather than on it
+    static constexpr int METRICS_DELAY_MS = 1000;
+
+    // Desktop notification through org.freedesktop.Notifications on the
+    // session bus, each one replacing the last
+    struct Notifier {
+        dbus::Connection bus;
+        uint32_t last_id = 0;
+        uint32_t pending_serial = 0;
+
+        void show(const std::string& mode) {
+            dbus::Message message;
+            message.type = dbus::METHOD_CALL;
+            message.destination = "org.freedesktop.Notifications";
+            message.path = "/org/freedesktop/Notifications";
+            message.interface = "org.freedesktop.Notifications";
+            message.member = "Notify";
+            message.signature = "susssasa{sv}i";
+            std::string body;
+            dbus::Writer writer(body);
+            writer.string("samsung-cli");
+            writer.u32(last_id);
+            writer.string("preferences-system-power");
+            writer.string("Performance mode");
+            writer.string(mode);
+            writer.close_array(writer.open_array(4), 4);
+            writer.close_array(writer.open_array(8), 8);
+            writer.u32(2000);
+            pending_serial = bus.send(message, body);
+        }
+
+        // Keep the id the server gave the latest notification; false once
+        // the bus is gone
+        bool receive() {
+            if (!bus.fill()) return false;
+            dbus::Message reply;
+            while (bus.next(reply)) {
+                if (reply.type == dbus::METHOD_RETURN && reply.reply_serial == pending_serial) {
+                    last_id = reply.body().u32();
+                }
+            }
+            return true;
+        }
+    };
+
+    bool run(int key, const std::string& device, const std::string& metrics_path, bool grab, bool notify) {
+        std::string choices;
+        if (!profiles::read_choices(choices)) return false;
+        std::vector<std::string> ladder = profiles::ladder(choices);
+        if (ladder.size() < 2) {
+            std::cerr << "Error: Need at least two known modes to cycle, have '" << choices << "'" << std::endl;
+            return false;
+        }
+
+        file_ops::Attribute current;
+        std::vector<file_ops::Attribute> targets;
+        int err = current.open(profiles::current_path());
+        for (const auto& path : profiles::targets()) {
+            if (err != 0) break;
+            targets.emplace_back();
+            err = targets.back().open(path, true);
+        }
+        if (err != 0) {
+            std::cerr << "Error: Could not open the platform profile: " << std::strerror(err) << std::endl;
+            return false;
+        }
+
+        std::string path = device;
+        int fd = device.empty() ? evdev::open_device(EV_KEY, key, EXTRA_BUTTONS_NAME, path)
+                                : ::open(device.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Error: No '" << EXTRA_BUTTONS_NAME << "' input device with key " << key
+                      << (device.empty() ? "; pass --device" : " at " + device) << std::endl;
+            return false;
+        }
+        // Keep desktop environments from acting on the same press
+        if (grab && ioctl(fd, EVIOCGRAB, 1) != 0 && errno != ENOTTY) {
+            std::cerr << "Warning: Could not grab " << path << ": " << std::strerror(errno) << std::endl;
+        }
+        clockid_t clock = evdev::use_monotonic_clock(fd);
+        int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event watch = {};
+        watch.events = EPOLLIN;
+        watch.data.fd = fd;
+        if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &watch) != 0) {
+            std::cerr << "Error: Could not watch " << path << ": " << std::strerror(errno) << std::endl;
+            if (epoll_fd >= 0) ::close(epoll_fd);
+            ::close(fd);
+            return false;
+        }
+        std::unique_ptr<Notifier> notifier;
+        if (notify) {
+            const char* session_bus = std::getenv("DBUS_SESSION_BUS_ADDRESS");
+            notifier = std::make_unique<Notifier>();
+            struct epoll_event bus_watch = {};
+            bus_watch.events = EPOLLIN;
+            bus_watch.data.fd = -1;
+            if (!notifier->bus.open(session_bus != nullptr ? session_bus : "") ||
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, notifier->bus.fd(), &bus_watch) != 0) {
+                std::cerr << "Warning: No session bus, changes won't be notified" << std::endl;
+                notifier.reset();
+            }
+        }
+        std::cout << "Cycling " << choices << " on key " << key << " from " << path << std::endl;
+
+        signals::install_stop_handlers();
+        int presses = 0;
+        double total_s = 0.0, worst_s = 0.0, last_s = 0.0;
+        auto write_metrics = [&]() {
+            if (!metrics::write_textfile(metrics_path, {
+                    {"samsung_cli_hotkey_presses_total", "Mode hotkey presses handled", "counter",
+                     static_cast<double>(presses)},
+                    {"samsung_cli_hotkey_latency_seconds_sum", "Keypress to profile write latency, summed", "counter",
+                     total_s},
+                    {"samsung_cli_hotkey_latency_seconds_max", "Slowest keypress to profile write", "gauge", worst_s},
+                    {"samsung_cli_hotkey_latency_seconds_last", "Latest keypress to profile write", "gauge", last_s},
+                })) {
+                std::cerr << "Warning: Could not write metrics to " << metrics_path << std::endl;
+            }
+        };
+        // Persistence waits for a quiet moment so a press only costs the
+        // profile write: metrics after METRICS_DELAY_MS, residency on the
+        // usual checkpoint timer
+        bool metrics_pending = false;
+        auto metrics_due = std::chrono::steady_clock::now();
+        bool ok = true;
+        while (!signals::stop_requested) {
+            int timeout = accounting::checkpoint_timeout_ms();
+            if (metrics_pending) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(metrics_due -
+                                                                                  std::chrono::steady_clock::now());
+                int metrics_timeout = static_cast<int>(std::max<int64_t>(0, left.count()));
+                timeout = timeout < 0 ? metrics_timeout : std::min(timeout, metrics_timeout);
+            }
+            struct epoll_event ready;
+            int n = epoll_wait(epoll_fd, &ready, 1, timeout);
+            if (n < 0 && errno != EINTR) {
+                ok = false;
+                break;
+            }
+            accounting::tick();
+            if (metrics_pending && std::chrono::steady_clock::now() >= metrics_due) {
+                write_metrics();
+                metrics_pending = false;
+            }
+            if (n <= 0) continue;
+            if (ready.data.fd == -1) {
+                if (!notifier->receive()) {
+                    std::cerr << "Warning: Lost the session bus, changes won't be notified" << std::endl;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, notifier->bus.fd(), nullptr);
+                    notifier.reset();
+                }
+                continue;
+            }
+
+            struct input_event events[16];
+            ssize_t bytes = ::read(fd, events, sizeof(events));
+            if (bytes == 0 || (bytes < 0 && errno == ENODEV)) {
+                std::cerr << "Error: " << path << " went away" << std::endl;
+                ok = false;
+                break;
+            }
+            for (ssize_t k = 0; k < bytes / static_cast<ssize_t>(sizeof(events[0])); ++k) {
+                // Presses only, not releases or autorepeat
+                if (events[k].type != EV_KEY || events[k].code != key || events[k].value != 1) continue;
+
+                // Follow the mode even when something else changed it
+                std::string mode;
+                current.read(mode);
+                auto position = std::find(ladder.begin(), ladder.end(), mode);
+                const std::string& next =
+                    position == ladder.end() || position + 1 == ladder.end() ? ladder.front() : *(position + 1);
+                for (auto& target : targets) {
+                    if (int write_err = target.write(next)) {
+                        std::cerr << "Error: Could not write to " << target.path() << ": " << std::strerror(write_err)
+                                  << std::endl;
+                        ok = false;
+                    }
+                }
+                double latency_s = evdev::age_us(events[k], clock) / 1e6;
+
+                presses++;
+                total_s += latency_s;
+                worst_s = std::max(worst_s, latency_s);
+                // One line per change for anything following stdout
+                std::cout << timestamp_now() << " profile-changed " << next << " " << std::fixed << std::setprecision(3)
+                          << latency_s * 1000.0 << " ms" << std::endl;
+                std::cout.unsetf(std::ios::fixed);
+                accounting::enter(next);
+                if (notifier) notifier->show(next);
+                last_s = latency_s;
+                if (!metrics_path.empty() && !metrics_pending) {
+                    metrics_pending = true;
+                    metrics_due = std::chrono::steady_clock::now() + std::chrono::milliseconds(METRICS_DELAY_MS);
+                }
+            }
+        }
+        if (metrics_pending) write_metrics();
+
+        if (presses > 0) {
+            std::cout << presses << " presses, mean " << std::fixed << std::setprecision(3) << total_s / presses * 1000.0
+                      << " ms, max " << worst_s * 1000.0 << " ms" << std::endl;
+        }
+        accounting::tick(true);
+        ::close(epoll_fd);
+        ::close(fd);
+        return ok;
+    }
+};
+
+namespace readings {
+    std::vector<Reading> open_all() {
+        const FeaturePaths& paths = feature_paths();
+        std::vector<Reading> result;
+        auto add = [&](const char* name, const std::string& path, bool invert) {
+            if (path.empty()) return;
+            Reading reading{name, {}, invert};
+            uint64_t value;
+            if (reading.attribute.open(path) == 0 && reading.attribute.read_u64(value) == 0) {
+                result.push_back(std::move(reading));
+            }
+        };
+        add("charge_control_end_threshold", POWER_PATH, false);
+        // The first fan keeps the usual name, any others are numbered
+        static const char* const extra_fans[] = {"fan2_speed_rpm", "fan3_speed_rpm", "fan4_speed_rpm"};
+        add("fan_speed_rpm", fans::primary_path(), false);
+        for (size_t i = 1; i < fans::all().size() && i <= std::size(extra_fans); ++i) {
+            add(extra_fans[i - 1], fans::all()[i].path, false);
+        }
+        add("allow_recording", paths.allow_recording, paths.recording_inverted);
+        add("kbd_backlight", KBD_BACKLIGHT_PATH, false);
+        add("start_on_lid_open", paths.start_on_lid_open, false);
+        add("usb_charge", paths.usb_charge, false);
+        add("battery_capacity_percent", BATTERY_CAPACITY_PATH, false);
+        add("battery_power_uw", BATTERY_POWER_NOW_PATH, false);
+        add("battery_energy_uwh", BATTERY_ENERGY_NOW_PATH, false);
+        add("ac_online", power_supply::find_mains_online(), false);
+        return result;
+    }
+}
+
+// Pushes the attributes the commands cover, plus battery and AC state, to
+// a statsd or InfluxDB line protocol listener. Lines are formatted straight
+// into one datagram buffer and sent whenever it fills or a batch ends; a
+// missing or slow listener costs dropped datagrams, never a blocked loop.
+class PushCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        std::string target = "udp:127.0.0.1:8125";
+        int interval_ms = 10000, batch = 6;
+        long count = 0;
+        try {
+            for (size_t i = 1; i < args.size(); ++i) {
+                if (i + 1 >= args.size()) throw std::invalid_argument(args[i]);
+                const std::string& option = args[i];
+                const std::string& value = args[++i];
+                if (option == "--to") {
+                    target = value;
+                } else if (option == "--format" && (value == "statsd" || value == "influx")) {
+                    influx = value == "influx";
+                } else if (option == "--prefix") {
+                    prefix = value;
+                } else if (option == "--interval") {
+                    interval_ms = std::stoi(value);
+                } else if (option == "--batch") {
+                    batch = std::stoi(value);
+                } else if (option == "--count") {
+                    count = std::stol(value);
+                } else {
+                    throw std::invalid_argument(option);
+                }
+            }
+        } catch (...) {
+            std::cerr << "Error: Invalid option for 'push'" << std::endl;
+            return false;
+        }
+        if (interval_ms < 10 || batch < 1 || count < 0) {
+            std::cerr << "Error: Interval must be at least 10 ms, batch and count positive" << std::endl;
+            return false;
+        }
+        return open_target(target) && open_sources() && run(interval_ms, batch, count);
+    }
+
+    std::string get_help() const override {
+        return "  push [--to udp:<host>:<port> | unix:<path>] [--format statsd|influx] [--prefix <name>]\n"
+               "       [--interval <ms>] [--batch <samples>] [--count <samples>]\n"
+               "               Push all readings in batched datagrams (default udp:127.0.0.1:8125, statsd)";
+    }
+
+private:
+    // Below the usual 1500 byte MTU after IP and UDP headers
+    static const size_t MAX_DATAGRAM = 1432;
+
+    std::vector<readings::Reading> sources;
+    file_ops::Attribute profile;
+    std::string prefix = "samsung";
+    std::string host;
+    bool influx = false;
+
+    int socket_fd = -1;
+    bool connected = false;
+    struct sockaddr_storage address = {};
+    socklen_t address_length = 0;
+
+    // Lines are built in 'line' and only complete ones go into 'packet'
+    char packet[MAX_DATAGRAM];
+    size_t used = 0;
+    char line[MAX_DATAGRAM];
+    size_t line_length = 0;
+    bool line_truncated = false;
+    uint64_t sent = 0, dropped = 0;
+
+    bool open_target(const std::string& target) {
+        int type = SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC;
+        if (target.compare(0, 5, "unix:") == 0 && target.size() - 5 < sizeof(sockaddr_un::sun_path)) {
+            auto* unix_address = reinterpret_cast<struct sockaddr_un*>(&address);
+            unix_address->sun_family = AF_UNIX;
+            std::memcpy(unix_address->sun_path, target.data() + 5, target.size() - 5);
+            address_length = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + target.size() - 5 + 1);
+            socket_fd = socket(AF_UNIX, type, 0);
+        } else if (target.compare(0, 4, "udp:") == 0 && target.rfind(':') > 4) {
+            size_t colon = target.rfind(':');
+            std::string name = target.substr(4, colon - 4);
+            if (name.size() > 2 && name.front() == '[' && name.back() == ']') name = name.substr(1, name.size() - 2);
+            struct addrinfo hints = {}, *result = nullptr;
+            hints.ai_socktype = SOCK_DGRAM;
+            if (getaddrinfo(name.c_str(), target.c_str() + colon + 1, &hints, &result) != 0 || result == nullptr) {
+                std::cerr << "Error: Could not resolve '" << target << "'" << std::endl;
+                return false;
+            }
+            std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+            address_length = result->ai_addrlen;
+            socket_fd = socket(result->ai_family, type, 0);
+            freeaddrinfo(result);
+        } else {
+            std::cerr << "Error: Invalid target '" << target << "'. Use udp:<host>:<port> or unix:<path>" << std::endl;
+            return false;
+        }
+        if (socket_fd < 0) {
+            std::cerr << "Error: Could not create socket: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        char name[256] = {};
+        gethostname(name, sizeof(name) - 1);
+        host = name;
+        return true;
+    }
+
+    bool open_sources() {
+        sources = readings::open_all();
+        profile.open(profiles::current_path());
+        if (sources.empty() && !profile.is_open()) {
+            std::cerr << "Error: None of the attributes could be read" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Send what has been formatted; a listener that isn't there (yet) or
+    // can't keep up just loses the datagram
+    void flush() {
+        if (used == 0) return;
+        if (!connected) {
+            connected = connect(socket_fd, reinterpret_cast<struct sockaddr*>(&address), address_length) == 0;
+        }
+        if (connected && ::send(socket_fd, packet, used, MSG_DONTWAIT | MSG_NOSIGNAL) == static_cast<ssize_t>(used)) {
+            sent++;
+        } else {
+            dropped++;
+            // A Unix listener that restarted needs a fresh connect
+            if (connected && (errno == ECONNREFUSED || errno == ENOTCONN)) connected = false;
+        }
+        used = 0;
+    }
+
+    template <typename... Args>
+    void append(const char* format, Args... args) {
+        int n = std::snprintf(line + line_length, MAX_DATAGRAM - line_length, format, args...);
+        if (n < 0 || line_length + static_cast<size_t>(n) >= MAX_DATAGRAM) {
+            line_truncated = true;
+        } else {
+            line_length += static_cast<size_t>(n);
+        }
+    }
+
+    void end_line() {
+        if (!line_truncated) {
+            if (used + line_length > MAX_DATAGRAM) flush();
+            std::memcpy(packet + used, line, line_length);
+            used += line_length;
+        }
+        line_length = 0;
+        line_truncated = false;
+    }
+
+    void sample() {
+        char mode[64];
+        size_t mode_length = 0;
+        bool have_mode = profile.is_open() && profile.read(mode, sizeof(mode) - 1, mode_length) == 0;
+        while (mode_length > 0 && std::isspace(static_cast<unsigned char>(mode[mode_length - 1]))) mode_length--;
+        mode[mode_length] = '\0';
+
+        if (influx) {
+            // One line per sample with every reading as a field
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            append("%s,host=%s ", prefix.c_str(), host.c_str());
+            for (auto& source : sources) {
+                uint64_t value;
+                if (source.attribute.read_u64(value) != 0) continue;
+                if (source.invert) value = value == 0;
+                append("%s=%" PRIu64 "i,", source.name, value);
+            }
+            if (have_mode) append("profile=\"%s\",profile_rank=%di,", mode, profiles::rank(mode));
+            if (line_length > 0 && line[line_length - 1] == ',') {
+                line_length--;
+                append(" %lld%09ld\n", static_cast<long long>(now.tv_sec), now.tv_nsec);
+                end_line();
+            }
+            line_length = 0;
+        } else {
+            for (auto& source : sources) {
+                uint64_t value;
+                if (source.attribute.read_u64(value) != 0) continue;
+                if (source.invert) value = value == 0;
+                append("%s.%s:%" PRIu64 "|g\n", prefix.c_str(), source.name, value);
+                end_line();
+            }
+            if (have_mode) {
+                append("%s.profile_rank:%d|g\n", prefix.c_str(), profiles::rank(mode));
+                end_line();
+            }
+        }
+    }
+
+    bool run(int interval_ms, int batch, long count) {
+        std::cout << "Pushing " << sources.size() + (profile.is_open() ? 1 : 0) << " readings every " << interval_ms
+                  << " ms as " << (influx ? "influx" : "statsd") << std::endl;
+        signals::install_stop_handlers();
+        auto next = std::chrono::steady_clock::now();
+        for (long taken = 0; !signals::stop_requested && (count == 0 || taken < count);) {
+            sample();
+            if (++taken % batch == 0) flush();
+            next += std::chrono::milliseconds(interval_ms);
+            std::this_thread::sleep_until(next);
+        }
+        flush();
+        ::close(socket_fd);
+        std::cout << "Sent " << sent << " datagrams, dropped " << dropped << std::endl;
+        return true;
+    }
+};
+
+bool ResidentMonitor::open(size_t samples) {
+    // Everything that allocates happens here, before the loop
+    sources = readings::open_all();
+    profile.open(profiles::current_path());
+    if (sources.empty() && !profile.is_open()) {
+        std::cerr << "Error: None of the attributes could be read" << std::endl;
+        return false;
+    }
+    count = sources.size() + 1;  // the profile's rank is the last reading
+    ring_size = samples;
+    output_size = count * OUTPUT_PER_READING;
+    head = filled = 0;
+    arena = std::make_unique<Arena>(count * VALUE_SIZE + count * ring_size * sizeof(int64_t) + output_size + 64);
+    values = arena->allocate<char>(count * VALUE_SIZE);
+    ring = arena->allocate<int64_t>(count * ring_size);
+    out = arena->allocate<char>(output_size);
+    return true;
+}
+
+size_t ResidentMonitor::pass() {
+    // Sample into the arena's value slots and the ring
+    int64_t* slot = ring + head * count;
+    for (size_t i = 0; i < count; ++i) {
+        char* value = values + i * VALUE_SIZE;
+        size_t length = 0;
+        file_ops::Attribute& attribute = i < sources.size() ? sources[i].attribute : profile;
+        if (attribute.read(value, VALUE_SIZE - 1, length) != 0) length = 0;
+        while (length > 0 && std::isspace(static_cast<unsigned char>(value[length - 1]))) length--;
+        value[length] = '\0';
+        if (i == sources.size()) {
+            slot[i] = profiles::rank(value, length);
+        } else {
+            slot[i] = std::strtoll(value, nullptr, 10);
+            if (sources[i].invert) slot[i] = slot[i] == 0;
+        }
+    }
+    head = (head + 1) % ring_size;
+    filled = std::min(filled + 1, ring_size);
+
+    // Current value plus the ring's average, minimum and maximum
+    size_t used = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int64_t low = INT64_MAX, high = INT64_MIN;
+        double sum = 0.0;
+        for (size_t k = 0; k < filled; ++k) {
+            int64_t sample = ring[k * count + i];
+            low = std::min(low, sample);
+            high = std::max(high, sample);
+            sum += static_cast<double>(sample);
+        }
+        const char* name = i < sources.size() ? sources[i].name : "profile_rank";
+        int64_t now = slot[i];
+        int n = std::snprintf(out + used, output_size - used,
+                              "samsung_cli_%s %" PRId64 "\nsamsung_cli_%s_avg %.3f\n"
+                              "samsung_cli_%s_min %" PRId64 "\nsamsung_cli_%s_max %" PRId64 "\n",
+                              name, now, name, sum / static_cast<double>(filled), name, low, name, high);
+        if (n > 0) used = std::min(used + static_cast<size_t>(n), output_size - 1);
+    }
+    return used;
+}
+
+// Runs ResidentMonitor on a timer, or back to back to check its footprint
+// over a long span
+class ResidentCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        int interval_ms = 5000;
+        long ring_size = 720;
+        double hours = 0.0;
+        std::string output;
+        try {
+            for (size_t i = 1; i < args.size(); ++i) {
+                if (i + 1 >= args.size()) throw std::invalid_argument(args[i]);
+                if (args[i] == "--interval") {
+                    interval_ms = std::stoi(args[++i]);
+                } else if (args[i] == "--ring") {
+                    ring_size = std::stol(args[++i]);
+                } else if (args[i] == "--output") {
+                    output = args[++i];
+                } else if (args[i] == "--fast-forward") {
+                    hours = std::stod(args[++i]);
+                } else {
+                    throw std::invalid_argument(args[i]);
+                }
+            }
+        } catch (...) {
+            std::cerr << "Error: Invalid option for 'resident'" << std::endl;
+            return false;
+        }
+        if (interval_ms < 10 || ring_size < 1 || ring_size > 1000000 || hours < 0) {
+            std::cerr << "Error: Interval must be at least 10 ms, ring 1 to 1000000 samples" << std::endl;
+            return false;
+        }
+        return run(interval_ms, static_cast<size_t>(ring_size), output, hours);
+    }
+
+    std::string get_help() const override {
+        return "  resident [--interval <ms>] [--ring <samples>] [--output <file>] [--fast-forward <hours>]\n"
+               "               Monitor all readings with a fixed memory footprint; --fast-forward runs that\n"
+               "               span back to back and reports the memory use";
+    }
+
+private:
+    // Resident set and its peak in KiB, from /proc without allocating
+    static void memory_kib(long& rss, long& peak) {
+        char buf[4096];
+        rss = peak = -1;
+        int fd = ::open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+        ::close(fd);
+        buf[n > 0 ? n : 0] = '\0';
+        if (const char* line = std::strstr(buf, "VmRSS:")) rss = std::atol(line + 6);
+        if (const char* line = std::strstr(buf, "VmHWM:")) peak = std::atol(line + 6);
+    }
+
+    bool run(int interval_ms, size_t ring_size, const std::string& output, double hours) {
+        ResidentMonitor monitor;
+        if (!monitor.open(ring_size)) return false;
+        const std::string tmp = output + ".tmp";
+        const bool fast = hours > 0;
+        const uint64_t passes = fast ? static_cast<uint64_t>(hours * 3600000.0 / interval_ms) : 0;
+
+        long rss_start, peak;
+        memory_kib(rss_start, peak);
+        std::cerr << "Resident with " << monitor.readings() << " readings, " << ring_size << " sample ring, "
+                  << monitor.arena_size() << " byte arena" << std::endl;
+
+        signals::install_stop_handlers();
+        uint64_t pass = 0;
+        auto next = std::chrono::steady_clock::now();
+        while (!signals::stop_requested && (!fast || pass < passes)) {
+            size_t used = monitor.pass();
+            const char* out = monitor.output();
+            if (!output.empty()) {
+                int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                bool ok = fd >= 0 && ::write(fd, out, used) == static_cast<ssize_t>(used);
+                if (fd >= 0) ok = ::close(fd) == 0 && ok;
+                if (ok) ::rename(tmp.c_str(), output.c_str());
+            } else if (!fast) {
+                if (::write(STDOUT_FILENO, out, used) < 0) break;
+            }
+
+            pass++;
+            if (!fast) {
+                next += std::chrono::milliseconds(interval_ms);
+                std::this_thread::sleep_until(next);
+            }
+        }
+
+        long rss_end;
+        memory_kib(rss_end, peak);
+        std::cerr << pass << " passes (" << std::fixed << std::setprecision(1)
+                  << pass * static_cast<double>(interval_ms) / 3600000.0 << " h of samples)" << std::endl;
+        std::cerr << "RSS " << rss_start << " KiB at start, " << rss_end << " KiB at end, peak " << peak << " KiB"
+                  << std::endl;
+        std::cerr.unsetf(std::ios::fixed);
+        return true;
+    }
+};
+
+// Predicts time to empty and time to the charge threshold from energy_now
+// and power_now. A scalar Kalman filter smooths the signed battery power so
+// one sample costs four preads and a handful of arithmetic, however long it
+// runs; the firmware's own estimates jump with every load spike.
+class BatteryCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        if (args.size() < 2 || args[1] != "estimate") {
+            std::cerr << "Error: Missing or unknown battery subcommand. Use 'estimate'." << std::endl;
+            return false;
+        }
+        int interval_ms = 5000;
+        int count = 0;
+        std::string metrics_path;
+        for (size_t i = 2; i < args.size(); ++i) {
+            if (i + 1 >= args.size()) {
+                std::cerr << "Error: Missing value for '" << args[i] << "'" << std::endl;
+                return false;
+            }
+            try {
+                if (args[i] == "--interval") {
+                    interval_ms = std::stoi(args[++i]);
+                } else if (args[i] == "--count") {
+                    count = std::stoi(args[++i]);
+                } else if (args[i] == "--metrics") {
+                    metrics_path = args[++i];
+                } else {
+                    std::cerr << "Error: Unknown battery option '" << args[i] << "'" << std::endl;
+                    return false;
+                }
+            } catch (...) {
+                std::cerr << "Error: Invalid value '" << args[i] << "'" << std::endl;
+                return false;
+            }
+        }
+        if (interval_ms < 1 || count < 0) {
+            std::cerr << "Error: Interval must be positive and count not negative" << std::endl;
+            return false;
+        }
+        return estimate(interval_ms, count, metrics_path);
+    }
+
+    std::string get_help() const override {
+        return "  battery estimate [--interval <ms>] [--count <n>] [--metrics <file>]\n"
+               "               Filtered time to empty, or to the charge threshold while charging";
+    }
+
+private:
+    // Power drifts with the workload rather than jumping between fixed
+    // levels, so the process noise grows with time between samples
+    static constexpr double PROCESS_NOISE_W2_PER_S = 0.05;
+    static constexpr double MEASUREMENT_NOISE_W2 = 4.0;
+
+    struct Filter {
+        double rate_w = 0.0;  // Positive while charging
+        double variance = -1.0;  // Negative until the first measurement
+
+        void update(double measured_w, double dt_s) {
+            if (variance < 0.0) {
+                rate_w = measured_w;
+                variance = MEASUREMENT_NOISE_W2;
+                return;
+            }
+            variance += PROCESS_NOISE_W2_PER_S * dt_s;
+            double gain = variance / (variance + MEASUREMENT_NOISE_W2);
+            rate_w += gain * (measured_w - rate_w);
+            variance *= 1.0 - gain;
+        }
+    };
+
+    static std::string format_duration(double seconds) {
+        long minutes = std::lround(seconds / 60.0);
+        std::ostringstream out;
+        if (minutes >= 60) out << minutes / 60 << "h ";
+        out << minutes % 60 << "m";
+        return out.str();
+    }
+
+    bool estimate(int interval_ms, int count, const std::string& metrics_path) {
+        file_ops::Attribute energy_now, power_now, status, threshold;
+        int err = energy_now.open(BATTERY_ENERGY_NOW_PATH);
+        if (err == 0) err = power_now.open(BATTERY_POWER_NOW_PATH);
+        if (err == 0) err = status.open(BATTERY_STATUS_PATH);
+        uint64_t full_uwh = 0;
+        std::string full;
+        if (err == 0) err = file_ops::backend().read(BATTERY_ENERGY_FULL_PATH, full);
+        try {
+            if (err == 0) full_uwh = std::stoull(full);
+        } catch (...) {
+            err = EINVAL;
+        }
+        if (err != 0 || full_uwh == 0) {
+            std::cerr << "Error: Could not read the battery energy and power: " << std::strerror(err ? err : EINVAL)
+                      << std::endl;
+            return false;
+        }
+        // Batteries without a threshold charge to full
+        bool have_threshold = threshold.open(POWER_PATH) == 0;
+
+        signals::install_stop_handlers();
+        Filter filter;
+        std::string state, previous_state;
+        uint64_t last_uwh = 0;
+        auto last_change = std::chrono::steady_clock::now();
+        auto previous = last_change;
+        auto next = last_change;
+        for (int i = 0; !signals::stop_requested && (count == 0 || i < count); ++i) {
+            if (i > 0) {
+                next += std::chrono::milliseconds(interval_ms);
+                std::this_thread::sleep_until(next);
+            }
+            auto now = std::chrono::steady_clock::now();
+            double dt_s = std::chrono::duration<double>(now - previous).count();
+            previous = now;
+
+            uint64_t energy_uwh, power_uw, limit = 100;
+            if ((err = energy_now.read_u64(energy_uwh)) || (err = power_now.read_u64(power_uw)) ||
+                (err = status.read(state))) {
+                std::cerr << "Error: Could not read the battery: " << std::strerror(err) << std::endl;
+                return false;
+            }
+            if (have_threshold && (threshold.read_u64(limit) != 0 || limit == 0 || limit > 100)) limit = 100;
 
-// Function to detect the correct path for a feature
-std::string detect_feature_path(const std::string& feature_name) {
-    // Try the udev rule path first
-    std::string udev_path = "/dev/samsung-galaxybook/" + feature_name;
-    if (access(udev_path.c_str(), R_OK) == 0) {
-        return udev_path;
-    }
-    
-    // Try the platform driver path
-    DIR* dir = opendir("/sys/bus/platform/drivers/samsung-galaxybook");
-    if (dir != nullptr) {
-        struct dirent* entry;
-        while ((entry = readdir(dir)) != nullptr) {
-            if (strncmp(entry->d_name, "SAM", 3) == 0) {
-                std::string path = "/sys/bus/platform/drivers/samsung-galaxybook/" + std::string(entry->d_name) + "/" + feature_name;
-                if (access(path.c_str(), R_OK) == 0) {
-                    closedir(dir);
-                    return path;
-                }
+            bool charging = state == "Charging";
+            bool discharging = state == "Discharging";
+            // A plug or unplug flips the sign, so start over instead of
+            // dragging the old rate through zero
+            if (state != previous_state) {
+                filter = Filter();
+                last_uwh = energy_uwh;
+                last_change = now;
+                previous_state = state;
+            }
+            double sign = charging ? 1.0 : discharging ? -1.0 : 0.0;
+            if (power_uw > 0) {
+                filter.update(sign * static_cast<double>(power_uw) / 1e6, dt_s);
+            } else if (energy_uwh != last_uwh) {
+                // Some firmware reports no power_now; fall back to the
+                // energy change since it last moved
+                double span_s = std::chrono::duration<double>(now - last_change).count();
+                filter.update((static_cast<double>(energy_uwh) - static_cast<double>(last_uwh)) / 1e6 * 3600.0 / span_s,
+                              span_s);
+            }
+            if (energy_uwh != last_uwh) {
+                last_uwh = energy_uwh;
+                last_change = now;
             }
-        }
-        closedir(dir);
-    }
-    
-    // If no path found, return the original ACPI path as fallback
-    return "/sys/bus/acpi/devices/SCAI:00/" + feature_name;
-}
 
-// Global variables to store the detected paths
-std::string ALLOW_RECORDING_PATH = detect_feature_path("allow_recording");
-std::string START_ON_LID_OPEN_PATH = detect_feature_path("start_on_lid_open");
-std::string USB_CHARGE_PATH = detect_feature_path("usb_charge");
+            double energy_wh = static_cast<double>(energy_uwh) / 1e6;
+            double target_wh = static_cast<double>(full_uwh) / 1e6 * static_cast<double>(limit) / 100.0;
+            double to_empty_s = std::nan("");
+            double to_target_s = std::nan("");
+            bool estimated = filter.variance >= 0.0;
+            if (estimated && discharging && filter.rate_w < 0.0) {
+                to_empty_s = energy_wh / -filter.rate_w * 3600.0;
+            } else if (estimated && charging && filter.rate_w > 0.0) {
+                to_target_s = std::max(0.0, target_wh - energy_wh) / filter.rate_w * 3600.0;
+            }
 
-// Base class for all commands
-class Command {
-public:
-    virtual ~Command() = default;
-    virtual bool execute(const std::vector<std::string>& args) = 0;
-    virtual std::string get_help() const = 0;
-};
+            std::cout << timestamp_now() << " " << state << " " << std::fixed << std::setprecision(2) << energy_wh
+                      << " Wh, " << std::setprecision(1) << filter.rate_w << " W (" << sign * power_uw / 1e6
+                      << " W now)";
+            if (!std::isnan(to_empty_s)) {
+                std::cout << ", empty in " << format_duration(to_empty_s);
+            } else if (!std::isnan(to_target_s)) {
+                std::cout << ", " << limit << "% in " << format_duration(to_target_s);
+            }
+            std::cout << std::endl;
+            std::cout.unsetf(std::ios::fixed);
 
-// Helper functions for file operations
-namespace file_ops {
-    bool check_permissions(const std::string& path, bool write = false) {
-        if (access(path.c_str(), write ? W_OK : R_OK) != 0) {
-            std::cerr << "Error: Permission denied. Run with sudo." << std::endl;
-            return false;
+            // NaN marks an estimate that doesn't apply in this state
+            if (!metrics_path.empty() && !metrics::write_textfile(metrics_path, {
+                    {"samsung_cli_battery_power_watts", "Filtered battery power, positive while charging", "gauge",
+                     filter.rate_w},
+                    {"samsung_cli_battery_energy_wh", "Battery energy now", "gauge", energy_wh},
+                    {"samsung_cli_battery_seconds_to_empty", "Estimated runtime left while discharging", "gauge",
+                     to_empty_s},
+                    {"samsung_cli_battery_seconds_to_threshold", "Estimated time to the charge threshold",
+                     "gauge", to_target_s},
+                })) {
+                std::cerr << "Warning: Could not write metrics to " << metrics_path << std::endl;
+            }
         }
         return true;
     }
+};
 
-    bool read_file(const std::string& path, std::string& value) {
-        std::ifstream file(path);
-        if (!file.is_open()) {
-            std::cerr << "Error: Could not open " << path << std::endl;
+// Lets a group change every attribute the tool writes and update the mode
+// statistics, so scripts don't pay for sudo on each call. The udev rules
+// apply on the next boot or driver load and the tmpfiles rule on the next
+// boot; the same permissions are applied to the running system at once.
+class InstallUdevCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        std::string group = "samsung-cli";
+        bool print = false, verify = false;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "--print") {
+                print = true;
+            } else if (args[i] == "--verify") {
+                verify = true;
+            } else if (args[i] == "--group" && i + 1 < args.size()) {
+                group = args[++i];
+            } else {
+                std::cerr << "Error: Unknown install-udev option '" << args[i] << "'" << std::endl;
+                return false;
+            }
+        }
+        if (group.empty() || group.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_-") != std::string::npos) {
+            std::cerr << "Error: Invalid group name '" << group << "'" << std::endl;
             return false;
         }
-        std::getline(file, value);
-        file.close();
-        return true;
+        if (print) {
+            std::cout << "# " << UDEV_RULES_PATH << "\n" << rules(group) << "\n# " << TMPFILES_PATH << "\n"
+                      << tmpfiles(group);
+            return true;
+        }
+        struct group* entry = getgrnam(group.c_str());
+        if (entry == nullptr) {
+            std::cerr << "Error: No group '" << group << "'. Create it with: sudo groupadd -r " << group << std::endl;
+            return false;
+        }
+        return verify ? check(group, entry->gr_gid) : install(group, entry->gr_gid);
     }
 
-    bool write_file(const std::string& path, const std::string& value) {
-        if (!check_permissions(path, true)) return false;
-        
-        std::ofstream file(path);
-        if (!file.is_open()) {
-            std::cerr << "Error: Could not write to " << path << std::endl;
+    std::string get_help() const override {
+        return "  install-udev [--group <name>] [--print | --verify]  Install udev and tmpfiles rules that let\n"
+               "               a group (default samsung-cli) change settings and keep mode statistics without\n"
+               "               sudo, or check they are in effect";
+    }
+
+private:
+    // Every attribute commands write, as resolved on this machine
+    static std::vector<std::string> attributes() {
+        const FeaturePaths& paths = feature_paths();
+        std::vector<std::string> result = {POWER_PATH, KBD_BACKLIGHT_PATH};
+        for (const auto& target : profiles::targets()) result.push_back(target);
+        for (const auto& feature : FEATURES) {
+            if (!(paths.*feature.path).empty()) result.push_back(paths.*feature.path);
+        }
+        return result;
+    }
+
+    // Attribute name of a path, or with 'device' the name of its directory
+    static std::string name(const std::string& path, bool device = false) {
+        std::string dir = device ? path.substr(0, path.rfind('/')) : path;
+        return dir.substr(dir.rfind('/') + 1);
+    }
+
+    static std::string permit(const std::string& group, const std::string& files) {
+        return "chgrp " + group + " " + files + "; chmod g+w " + files;
+    }
+
+    static std::string rules(const std::string& group) {
+        std::string firmware, toggles, links;
+        for (const auto& feature : FEATURES) {
+            firmware += std::string(firmware.empty() ? "" : " ") + "attributes/" + feature.upstream_name + "/current_value";
+            toggles += std::string(toggles.empty() ? "" : " ") + feature.name;
+        }
+        std::ostringstream out;
+        out << "# Generated by samsung-cli install-udev: members of '" << group << "' may change\n"
+            << "# the Galaxy Book settings samsung-cli writes, without sudo\n"
+            << "ACTION==\"add\", SUBSYSTEM==\"power_supply\", KERNEL==\"" << name(POWER_PATH, true)
+            << "\", RUN+=\"/bin/sh -c 'cd /sys%p; " << permit(group, name(POWER_PATH)) << "'\"\n"
+            << "ACTION==\"add\", SUBSYSTEM==\"leds\", KERNEL==\"" << name(KBD_BACKLIGHT_PATH, true)
+            << "\", RUN+=\"/bin/sh -c 'cd /sys%p; " << permit(group, name(KBD_BACKLIGHT_PATH)) << "'\"\n"
+            << "\n# Upstream driver\n"
+            << "ACTION==\"add\", SUBSYSTEM==\"platform-profile\", RUN+=\"/bin/sh -c 'cd /sys%p; "
+            << permit(group, "profile " + PLATFORM_PROFILE_PATH) << "'\"\n"
+            << "ACTION==\"add\", SUBSYSTEM==\"firmware-attributes\", KERNEL==\"samsung-galaxybook\", "
+            << "RUN+=\"/bin/sh -c 'cd /sys%p; " << permit(group, firmware) << "'\"\n"
+            << "\n# Out-of-tree driver, with its toggles linked where feature detection looks first\n"
+            << "ACTION==\"bind\", SUBSYSTEM==\"platform\", DRIVER==\"samsung-galaxybook\", "
+            << "RUN+=\"/bin/sh -c 'cd /sys%p; " << permit(group, toggles + " " + PLATFORM_PROFILE_PATH)
+            << "; mkdir -p " << UDEV_LINKS_PATH << "; for f in " << toggles << "; do ln -sf /sys%p/$$f "
+            << UDEV_LINKS_PATH << "/$$f; done'\"\n";
+        return out.str();
+    }
+
+    // The state directory is setgid so files created in it stay in the group
+    static std::string tmpfiles(const std::string& group) {
+        return "# Generated by samsung-cli install-udev: members of '" + group + "' may update\n"
+               "# the mode statistics samsung-cli keeps\n"
+               "d " + accounting::state_dir() + " 2775 root " + group + " -\n";
+    }
+
+    static bool write_config(const std::string& config, const std::string& data) {
+        std::string path = root_prefix() + config;
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+        if (fd >= 0) ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            std::cerr << "Error: Could not write " << path << ": " << std::strerror(errno)
+                      << (errno == EACCES ? ". Run with sudo." : "") << std::endl;
+            unlink(tmp.c_str());
             return false;
         }
-        file << value;
-        file.close();
+        std::cout << "Wrote " << path << std::endl;
         return true;
     }
-}
 
-// Command implementations
-class PowerCommand : public Command {
-public:
-    bool execute(const std::vector<std::string>& args) override {
-        if (args.size() < 2) {
-            std::cerr << "Error: Missing power subcommand. Use 'read' or 'set'." << std::endl;
-            return false;
+    // Run a program found in PATH with its output discarded, true if it
+    // exited with status 0. No shell is involved.
+    static bool run_quietly(const std::vector<const char*>& argv) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+            if (null_fd >= 0) {
+                dup2(null_fd, STDOUT_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+            }
+            std::vector<char*> args;
+            for (const char* arg : argv) args.push_back(const_cast<char*>(arg));
+            args.push_back(nullptr);
+            execvp(args[0], args.data());
+            _exit(127);
         }
+        int status = 0;
+        while (pid > 0 && waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        return pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
 
-        std::string subcommand = args[1];
-        if (subcommand == "read") {
-            return read_power();
-        } else if (subcommand == "set") {
-            if (args.size() < 3) {
-                std::cerr << "Error: Missing value for 'power set'" << std::endl;
+    bool install(const std::string& group, gid_t gid) {
+        if (!write_config(UDEV_RULES_PATH, rules(group)) || !write_config(TMPFILES_PATH, tmpfiles(group))) return false;
+        if (root_prefix().empty() && !run_quietly({"udevadm", "control", "--reload"})) {
+            std::cerr << "Warning: Could not reload the udev rules; they apply from the next boot" << std::endl;
+        }
+        bool ok = true;
+
+        // What the tmpfiles rule sets up at boot
+        std::string state = accounting::state_dir();
+        mkdir(state.c_str(), 0775);
+        if (chown(state.c_str(), static_cast<uid_t>(-1), gid) != 0 || chmod(state.c_str(), 02775) != 0) {
+            std::cerr << "Error: Could not change " << state << ": " << std::strerror(errno) << std::endl;
+            ok = false;
+        }
+
+        // The rules only run on the next add or bind event, so apply the
+        // same permissions now
+        for (const auto& attribute : attributes()) {
+            std::string full = root_prefix() + attribute;
+            struct stat st;
+            if (stat(full.c_str(), &st) != 0) continue;
+            if (chown(full.c_str(), static_cast<uid_t>(-1), gid) != 0 || chmod(full.c_str(), (st.st_mode & 07777) | S_IWGRP) != 0) {
+                std::cerr << "Error: Could not change " << attribute << ": " << std::strerror(errno) << std::endl;
+                ok = false;
+                continue;
+            }
+            // Out-of-tree toggles are linked where feature detection looks first
+            if (attribute.compare(0, GALAXYBOOK_DRIVER_PATH.size(), GALAXYBOOK_DRIVER_PATH) == 0) {
+                std::string link = root_prefix() + UDEV_LINKS_PATH + "/" + name(attribute);
+                mkdir((root_prefix() + UDEV_LINKS_PATH).c_str(), 0755);
+                unlink(link.c_str());
+                if (symlink(full.c_str(), link.c_str()) != 0) {
+                    std::cerr << "Warning: Could not link " << link << ": " << std::strerror(errno) << std::endl;
+                }
+            }
+        }
+        std::cout << "Add users with: sudo usermod -aG " << group << " <user> (they need to log in again)" << std::endl;
+        return ok;
+    }
+
+    // Each attribute and the state directory must belong to the group and be
+    // group writable, and a non-root caller has to be in the group for that
+    // to help
+    bool check(const std::string& group, gid_t gid) {
+        bool ok = true;
+        // Shown and full path; the state directory has its own override
+        // rather than living under the fake tree
+        std::vector<std::pair<std::string, std::string>> paths;
+        for (const auto& attribute : attributes()) paths.emplace_back(attribute, root_prefix() + attribute);
+        paths.emplace_back(accounting::state_dir(), accounting::state_dir());
+        for (const auto& [attribute, path] : paths) {
+            struct stat st;
+            std::string problem;
+            if (stat(path.c_str(), &st) != 0) {
+                problem = std::strerror(errno);
+            } else if (st.st_gid != gid || !(st.st_mode & S_IWGRP)) {
+                struct group* owner = getgrgid(st.st_gid);
+                std::ostringstream mode;
+                mode << "group " << (owner != nullptr ? owner->gr_name : std::to_string(st.st_gid)) << ", mode "
+                     << std::oct << (st.st_mode & 0777);
+                problem = mode.str();
+            }
+            std::cout << (problem.empty() ? "ok            " : "not writable  ") << attribute
+                      << (problem.empty() ? "" : " (" + problem + ")") << std::endl;
+            ok = ok && problem.empty();
+        }
+
+        std::vector<gid_t> groups(static_cast<size_t>(std::max(getgroups(0, nullptr), 0)));
+        int count = getgroups(static_cast<int>(groups.size()), groups.data());
+        groups.resize(static_cast<size_t>(std::max(count, 0)));
+        if (geteuid() != 0 && getegid() != gid && std::find(groups.begin(), groups.end(), gid) == groups.end()) {
+            std::cout << "You are not in the '" << group << "' group: sudo usermod -aG " << group
+                      << " $USER, then log in again" << std::endl;
+            ok = false;
+        }
+        return ok;
+    }
+};
+
+// Collects every attribute that matters for a bug report into one tar
+// archive. Files are read by a small pool of threads, and a read that
+// outlives the per-file timeout is abandoned to a replacement thread, so
+// one slow ACPI method doesn't hold up the rest.
+class DiagnoseCommand : public Command {
+public:
+    bool execute(const std::vector<std::string>& args) override {
+        std::string output;
+        int jobs = 8, timeout_ms = 250;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (i + 1 >= args.size()) {
+                std::cerr << "Error: Missing value for '" << args[i] << "'" << std::endl;
+                return false;
+            }
+            try {
+                if (args[i] == "--output") {
+                    output = args[++i];
+                } else if (args[i] == "--jobs") {
+                    jobs = std::stoi(args[++i]);
+                } else if (args[i] == "--timeout") {
+                    timeout_ms = std::stoi(args[++i]);
+                } else {
+                    std::cerr << "Error: Unknown diagnose option '" << args[i] << "'" << std::endl;
+                    return false;
+                }
+            } catch (...) {
+                std::cerr << "Error: Invalid value '" << args[i] << "'" << std::endl;
                 return false;
             }
-            return set_power(args[2]);
         }
-        std::cerr << "Error: Unknown power subcommand '" << subcommand << "'" << std::endl;
-        return false;
+        if (jobs < 1 || timeout_ms < 1) {
+            std::cerr << "Error: Jobs and timeout must be positive" << std::endl;
+            return false;
+        }
+        if (output.empty()) {
+            char name[64];
+            std::time_t now = std::time(nullptr);
+            std::strftime(name, sizeof(name), "samsung-cli-diagnose-%Y%m%d-%H%M%S.tar", std::localtime(&now));
+            output = name;
+        }
+        return diagnose(output, jobs, timeout_ms);
     }
 
     std::string get_help() const override {
-        return "  power read    Read the charge threshold\n"
-               "  power set <value>  Set the charge threshold (0-100)";
+        return "  diagnose [--output <file>] [--jobs <n>] [--timeout <ms>]  Collect DMI, ACPI, driver,\n"
+               "               power supply, thermal and hwmon state into one tar archive";
     }
 
 private:
-    bool read_power() {
-        std::string value;
-        if (!file_ops::read_file(POWER_PATH, value)) return false;
-        std::cout << "Current charge threshold: " << value << "%" << std::endl;
+    // Where to look, how many directory levels below it to descend, and
+    // which names to take at the first level (all when empty)
+    struct Root {
+        std::string path;
+        int depth;
+        std::vector<const char*> prefixes;
+    };
+
+    // Identifiers that say nothing about the problem
+    static constexpr const char* PRIVATE_NAMES[] = {"product_serial", "board_serial", "chassis_serial",
+                                                    "product_uuid"};
+    static constexpr size_t MAX_FILE_SIZE = 65536;
+    // However slow the hardware, the archive is written by then
+    static constexpr int DEADLINE_MS = 5000;
+
+    static std::vector<Root> roots() {
+        return {
+            {"/sys/class/dmi/id", 0, {}},
+            {POWER_SUPPLY_PATH, 1, {}},
+            {"/sys/class/thermal", 1, {}},
+            {HWMON_PATH, 1, {}},
+            {CPU_PATH + "/cpu0", 1, {"cpufreq", "thermal_throttle"}},
+            {POWERCAP_PATH, 1, {}},
+            {"/sys/firmware/acpi", 0, {"platform_profile"}},
+            {PLATFORM_PROFILE_CLASS_PATH, 1, {}},
+            {"/sys/class/leds", 1, {"samsung-galaxybook"}},
+            {"/sys/module/samsung_galaxybook", 1, {"parameters", "version", "srcversion"}},
+            // Every location feature detection probes
+            {UDEV_LINKS_PATH, 0, {}},
+            {FIRMWARE_ATTRIBUTES_PATH, 1, {}},
+            {GALAXYBOOK_DRIVER_PATH, 1, {}},
+            {ACPI_DEVICES_PATH, 1, {"SCAI:", "SAM04", "PNP0C0B:", "PNP0C0A:", "ACPI0003:"}},
+            {"/proc", 0, {"version"}},
+        };
+    }
+
+    // Regular files under a root. Symlinks are followed at the first level
+    // only, where class directories link to their devices.
+    static void walk(const std::string& path, int depth, const std::vector<const char*>& prefixes, bool top,
+                     std::vector<std::string>& files) {
+        DIR* dir = opendir((root_prefix() + path).c_str());
+        if (dir == nullptr) return;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string name = entry->d_name;
+            if (name[0] == '.') continue;
+            if (!prefixes.empty() && std::none_of(prefixes.begin(), prefixes.end(), [&](const char* prefix) {
+                    return name.compare(0, std::strlen(prefix), prefix) == 0;
+                })) {
+                continue;
+            }
+            if (std::any_of(std::begin(PRIVATE_NAMES), std::end(PRIVATE_NAMES),
+                            [&](const char* secret) { return name == secret; })) {
+                continue;
+            }
+            std::string child = path + "/" + name;
+            unsigned char type = entry->d_type;
+            if (type == DT_LNK && top) {
+                struct stat st;
+                if (stat((root_prefix() + child).c_str(), &st) != 0) continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type == DT_REG) {
+                files.push_back(child);
+            } else if (type == DT_DIR && depth > 0) {
+                walk(child, depth - 1, {}, false, files);
+            }
+        }
+        closedir(dir);
+    }
+
+    // Shared with the readers, which may outlive the command when a read
+    // never returns. They only touch what is in here, so nothing they use
+    // is destroyed at exit under them.
+    struct Collection {
+        std::string prefix;  // root_prefix(), copied
+        std::vector<std::string> paths;
+        std::vector<std::string> values;
+        std::vector<int> errors;
+        std::vector<std::chrono::steady_clock::time_point> started;
+        std::vector<char> state;  // 0 waiting, 1 reading, 2 done, 3 abandoned
+        size_t next = 0;
+        bool stopped = false;
+        // Item each reader is on, NONE when it has nothing left
+        std::vector<size_t> current;
+        std::mutex lock;
+        std::condition_variable changed;
+    };
+
+    static constexpr size_t NONE = SIZE_MAX;
+
+    static void reader(std::shared_ptr<Collection> collection, size_t id) {
+        std::unique_lock<std::mutex> guard(collection->lock);
+        while (!collection->stopped && collection->next < collection->paths.size()) {
+            size_t i = collection->next++;
+            collection->current[id] = i;
+            collection->state[i] = 1;
+            collection->started[i] = std::chrono::steady_clock::now();
+            std::string path = collection->prefix + collection->paths[i];
+            guard.unlock();
+
+            std::string value;
+            int err = 0;
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                err = errno;
+            } else {
+                char buf[4096];
+                ssize_t n;
+                while (value.size() < MAX_FILE_SIZE && (n = ::read(fd, buf, sizeof(buf))) != 0) {
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        err = errno;
+                        break;
+                    }
+                    value.append(buf, static_cast<size_t>(n));
+                }
+                ::close(fd);
+            }
+
+            guard.lock();
+            if (collection->state[i] == 1) {
+                collection->values[i] = std::move(value);
+                collection->errors[i] = err;
+                collection->state[i] = 2;
+            }
+            collection->changed.notify_one();
+            // An abandoned read already has its replacement
+            if (collection->state[i] == 3) return;
+        }
+        collection->current[id] = NONE;
+    }
+
+    // One ustar member; the name is split at a slash when over 100 bytes
+    static bool add_member(std::string& archive, const std::string& name, const std::string& data) {
+        std::string prefix, base = name;
+        if (name.size() > 100) {
+            size_t slash = name.find('/', name.size() - 101);
+            if (slash == std::string::npos || slash > 155) return false;
+            prefix = name.substr(0, slash);
+            base = name.substr(slash + 1);
+        }
+        char header[512] = {};
+        std::memcpy(header, base.data(), base.size());
+        std::snprintf(header + 100, 8, "%07o", 0644);
+        std::snprintf(header + 108, 8, "%07o", 0);
+        std::snprintf(header + 116, 8, "%07o", 0);
+        std::snprintf(header + 124, 12, "%011lo", static_cast<unsigned long>(data.size()));
+        std::snprintf(header + 136, 12, "%011lo", static_cast<unsigned long>(std::time(nullptr)));
+        std::memset(header + 148, ' ', 8);
+        header[156] = '0';
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+        std::memcpy(header + 345, prefix.data(), prefix.size());
+        unsigned sum = 0;
+        for (unsigned char c : header) sum += c;
+        std::snprintf(header + 148, 8, "%06o", sum);
+        archive.append(header, sizeof(header));
+        archive.append(data);
+        archive.append((512 - data.size() % 512) % 512, '\0');
         return true;
     }
 
-    bool set_power(const std::string& value) {
-        int val;
-        try {
-            val = std::stoi(value);
-            if (val < 0 || val > 100) {
-                std::cerr << "Error: Value must be between 0 and 100" << std::endl;
-                return false;
+    bool diagnose(const std::string& output, int jobs, int timeout_ms) {
+        auto start = std::chrono::steady_clock::now();
+        auto collection = std::make_shared<Collection>();
+        collection->prefix = root_prefix();
+        for (const auto& root : roots()) {
+            std::vector<std::string> files;
+            walk(root.path, root.depth, root.prefixes, true, files);
+            std::sort(files.begin(), files.end());
+            collection->paths.insert(collection->paths.end(), files.begin(), files.end());
+        }
+        size_t total = collection->paths.size();
+        collection->values.resize(total);
+        collection->errors.resize(total, 0);
+        collection->started.resize(total);
+        collection->state.resize(total, 0);
+
+        int workers = std::min(jobs, static_cast<int>(std::max<size_t>(total, 1)));
+        std::vector<std::thread> threads;
+        size_t abandoned = 0;
+        std::vector<std::string> values;
+        std::vector<int> errors;
+        std::vector<char> state;
+        std::vector<bool> stuck;
+        {
+            std::unique_lock<std::mutex> guard(collection->lock);
+            auto start_reader = [&]() {
+                collection->current.push_back(NONE);
+                threads.emplace_back(reader, collection, threads.size());
+            };
+            for (int i = 0; i < workers; ++i) start_reader();
+            auto deadline = start + std::chrono::milliseconds(DEADLINE_MS);
+            while (true) {
+                auto now = std::chrono::steady_clock::now();
+                size_t finished = 0;
+                for (size_t i = 0; i < total; ++i) {
+                    if (collection->state[i] == 1 &&
+                        (now - collection->started[i] > std::chrono::milliseconds(timeout_ms) || now > deadline)) {
+                        collection->state[i] = 3;
+                        abandoned++;
+                        if (now <= deadline) start_reader();
+                    }
+                    if (collection->state[i] >= 2) finished++;
+                }
+                if (finished == total || now > deadline) break;
+                collection->changed.wait_for(guard, std::chrono::milliseconds(10));
             }
-        } catch (...) {
-            std::cerr << "Error: Invalid value '" << value << "'" << std::endl;
+
+            // No new reads from here; readers that were given up on may
+            // still finish, so copy out under the lock
+            collection->stopped = true;
+            values = collection->values;
+            errors = collection->errors;
+            state = collection->state;
+            for (size_t item : collection->current) stuck.push_back(item != NONE && collection->state[item] == 3);
+        }
+        // The rest are done or about to see 'stopped'
+        for (size_t id = 0; id < threads.size(); ++id) {
+            if (stuck[id]) {
+                threads[id].detach();
+            } else {
+                threads[id].join();
+            }
+        }
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::string archive, summary, failures;
+        size_t collected = 0;
+        for (size_t i = 0; i < total; ++i) {
+            const std::string& path = collection->paths[i];
+            if (state[i] == 3) {
+                failures += path + ": no answer within " + std::to_string(timeout_ms) + " ms\n";
+            } else if (state[i] != 2) {
+                failures += path + ": not read before the deadline\n";
+            } else if (errors[i] != 0) {
+                failures += path + ": " + std::strerror(errors[i]) + "\n";
+            } else if (add_member(archive, "samsung-cli-diagnose" + path, values[i])) {
+                collected++;
+            } else {
+                failures += path + ": name too long for the archive\n";
+            }
+        }
+
+        std::ostringstream view;
+        const FeaturePaths& paths = feature_paths();
+        view << "samsung-cli view of this machine\n"
+             << "allow_recording: " << paths.allow_recording << (paths.recording_inverted ? " (inverted)" : "") << "\n"
+             << "start_on_lid_open: " << paths.start_on_lid_open << "\n"
+             << "usb_charge: " << paths.usb_charge << "\n"
+             << "legacy platform_profile: " << (paths.legacy_profile ? "yes" : "no") << "\n";
+        for (const auto& handler : paths.profile_handlers) view << "profile handler: " << handler << "\n";
+        // Only the cached choice: measuring would read the fans outside the pool
+        std::vector<fans::Source> cached;
+        if (fans::load(cached)) {
+            for (const auto& fan : cached) view << "fan " << fan.fan << ": " << fan.path << "\n";
+        }
+        view << std::fixed << std::setprecision(1) << "\n" << collected << " of " << total << " files in "
+             << elapsed_ms << " ms with " << jobs << " readers, " << abandoned << " over the " << timeout_ms
+             << " ms timeout\n";
+        add_member(archive, "samsung-cli-diagnose/summary.txt", view.str());
+        add_member(archive, "samsung-cli-diagnose/errors.txt", failures);
+        archive.append(1024, '\0');
+
+        int fd = output == "-" ? STDOUT_FILENO : ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && ::write(fd, archive.data(), archive.size()) == static_cast<ssize_t>(archive.size());
+        if (fd >= 0 && fd != STDOUT_FILENO) ok = ::close(fd) == 0 && ok;
+        if (!ok) {
+            std::cerr << "Error: Could not write " << output << ": " << std::strerror(errno) << std::endl;
             return false;
         }
-        if (!file_ops::write_file(POWER_PATH, std::to_string(val))) return false;
-        std::cout << "Set charge threshold to " << val << "%" << std::endl;
+        std::cerr << "Collected " << collected << " of " << total << " files in " << std::fixed << std::setprecision(1)
+                  << elapsed_ms << " ms (" << abandoned << " timed out)" << (output == "-" ? "" : " into " + output)
+                  << std::endl;
+        std::cerr.unsetf(std::ios::fixed);
         return true;
     }
 };
 
-class FanCommand : public Command {
+// Frame buffer for full-screen views. A frame is a grid of cells and only
+// the cells that differ from the one on screen are sent, grouped into runs,
+// in one write. The grids are only reallocated when the terminal is
+// resized. Off a terminal every frame is printed in full.
+class Screen {
 public:
-    bool execute(const std::vector<std::string>& args) override {
-        if (args.size() < 2) {
-            std::cerr << "Error: Missing fan subcommand. Use 'read'." << std::endl;
-            return false;
-        }
+    Screen() : tty(isatty(STDOUT_FILENO) == 1) {}
 
-        std::string subcommand = args[1];  // args[0] is the command name "fan"
-        if (subcommand == "read") {
-            return read_fan();
+    ~Screen() { close(); }
+
+    // Leave the alternate screen, also done on destruction
+    void close() {
+        if (tty && started) write_all("\x1b[?25h\x1b[?1049l", 15);
+        started = false;
+    }
+
+    // Rows that fit, or a large number off a terminal
+    int rows() const {
+        struct winsize size;
+        if (!tty || ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row == 0) return 1000;
+        return size.ws_row;
+    }
+
+    // Line 'row' of the frame being built; control and non-ASCII bytes
+    // show as '?' so every byte is one cell
+    void set(size_t row, const char* text, size_t length) {
+        if (!tty) {
+            if (row >= lines) {
+                out.append(row - lines, '\n');
+                lines = row;
+            }
+            for (size_t i = 0; i < length; ++i) out.push_back(printable(text[i]));
+            out.push_back('\n');
+            lines++;
+            return;
         }
-        std::cerr << "Error: Unknown fan subcommand '" << subcommand << "'" << std::endl;
-        return false;
+        if (!frame_open) open_frame();
+        if (row >= height) return;
+        char* cells = &next[row * width];
+        for (size_t i = 0; i < std::min(length, width); ++i) cells[i] = printable(text[i]);
     }
 
-    std::string get_help() const override {
-        return "  fan read      Read current fan speed in RPM";
+    // Send the frame; nothing is written when no cell changed
+    void flush() {
+        if (!tty) {
+            out.push_back('\n');
+            write_all(out.data(), out.size());
+            bytes_written += out.size();
+            out.clear();
+            lines = 0;
+            return;
+        }
+        if (!frame_open) open_frame();
+        char move[24];
+        for (size_t row = 0; row < height; ++row) {
+            const char* now = &next[row * width];
+            const char* was = &shown[row * width];
+            for (size_t column = 0; column < width; ++column) {
+                if (now[column] == was[column]) continue;
+                // Runs absorb short unchanged gaps, cheaper than another move
+                size_t last = column;
+                for (size_t j = column + 1; j < width && j - last <= RUN_GAP; ++j) {
+                    if (now[j] != was[j]) last = j;
+                }
+                int n = std::snprintf(move, sizeof(move), "\x1b[%zu;%zuH", row + 1, column + 1);
+                out.append(move, static_cast<size_t>(n));
+                out.append(now + column, last - column + 1);
+                column = last;
+            }
+        }
+        std::memcpy(shown.data(), next.data(), next.size());
+        frame_open = false;
+        if (!out.empty()) write_all(out.data(), out.size());
+        bytes_written += out.size();
+        out.clear();
     }
 
+    // Bytes sent to the terminal so far
+    size_t written() const { return bytes_written; }
+
 private:
-    bool read_fan() {
-        std::string value;
-        if (!file_ops::read_file(FAN_PATH, value)) return false;
-        std::cout << "Current fan speed: " << value << " RPM" << std::endl;
-        return true;
+    static constexpr size_t RUN_GAP = 4;
+
+    static char printable(char c) {
+        return c >= 0x20 && c < 0x7f ? c : '?';
+    }
+
+    // A blank frame at the current size. After a resize the whole screen
+    // is redrawn, since nothing on it can be trusted.
+    void open_frame() {
+        struct winsize size;
+        size_t new_width = 80, new_height = 24;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0) {
+            new_width = size.ws_col;
+            new_height = size.ws_row;
+        }
+        if (!started) {
+            // Alternate screen, cursor hidden
+            out.append("\x1b[?1049h\x1b[?25l");
+            started = true;
+        }
+        if (new_width != width || new_height != height) {
+            width = new_width;
+            height = new_height;
+            next.assign(width * height, ' ');
+            shown.assign(width * height, ' ');
+            out.append("\x1b[2J");
+            out.reserve(width * height * 2);
+        }
+        std::fill(next.begin(), next.end(), ' ');
+        frame_open = true;
+    }
+
+    void write_all(const char* data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::write(STDOUT_FILENO, data + done, size - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            done += static_cast<size_t>(n);
+        }
     }
+
+    bool tty;
+    bool started = false;
+    bool frame_open = false;
+    size_t width = 0, height = 0;
+    size_t lines = 0;  // Off a terminal, lines of the frame so far
+    size_t bytes_written = 0;
+    std::vector<char> next, shown;
+    std::string out;
 };
 
-class PerformanceCommand : public Command {
+// Per-process CPU use next to the fan speed and mode, and which processes
+// were busy before each fan spin-up. Every /proc/<pid>/stat stays open and
+// is reread with pread, the process table is merged by pid into a reused
+// buffer, and parsing works in place, so a tick costs one pread per process
+// and no allocation once the table has grown.
+class TopCommand : public Command {
 public:
     bool execute(const std::vector<std::string>& args) override {
-        if (args.size() < 2) {
-            std::cerr << "Error: Missing performance subcommand. Use 'read', 'set', or 'list'." << std::endl;
+        int interval_ms = 2000, count = 0;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (i + 1 >= args.size()) {
+                std::cerr << "Error: Missing value for '" << args[i] << "'" << std::endl;
+                return false;
+            }
+            try {
+                if (args[i] == "--interval") {
+                    interval_ms = std::stoi(args[++i]);
+                } else if (args[i] == "--count") {
+                    count = std::stoi(args[++i]);
+                } else {
+                    std::cerr << "Error: Unknown top option '" << args[i] << "'" << std::endl;
+                    return false;
+                }
+            } catch (...) {
+                std::cerr << "Error: Invalid value '" << args[i] << "'" << std::endl;
+                return false;
+            }
+        }
+        if (interval_ms < 100 || count < 0) {
+            std::cerr << "Error: Interval must be at least 100 ms and count not negative" << std::endl;
             return false;
         }
+        return run(interval_ms, count);
+    }
 
-        std::string subcommand = args[1];
-        if (subcommand == "read") {
-            return read_performance_mode();
-        } else if (subcommand == "set") {
-            if (args.size() < 3) {
-                std::cerr << "Error: Missing mode for 'perf set'" << std::endl;
-                return false;
+    std::string get_help() const override {
+        return "  top [--interval <ms>] [--count <n>]  Per-process CPU use with fan speed and mode, and the\n"
+               "               processes credited with each fan spin-up";
+    }
+
+private:
+    // The fan follows load over several seconds, so a spin-up is credited
+    // by CPU use smoothed over about that long
+    static constexpr double FAN_LAG_S = 10.0;
+    static constexpr uint64_t SPIN_UP_RPM = 100;
+    static constexpr size_t CULPRITS = 3;
+
+    struct Process {
+        int pid;
+        int fd;  // Kept open, -1 past the descriptor budget
+        char comm[16];
+        uint64_t ticks;  // utime + stime
+        bool sampled;  // ticks holds a reading
+        double cpu;  // Percent of one core over the last interval
+        double average;  // Smoothed over FAN_LAG_S
+        double fan_rpm;  // Spin-up RPM credited to this process
+    };
+
+    struct SpinUp {
+        std::time_t when = 0;
+        uint64_t from = 0, to = 0;
+        char comm[CULPRITS][16] = {};
+        double share[CULPRITS] = {};
+    };
+
+    // utime + stime and the command name of a stat line, parsed in place.
+    // The name may hold spaces and parentheses, so fields count from the
+    // last ')'.
+    static bool parse_stat(const char* buf, size_t length, char (&comm)[16], uint64_t& ticks) {
+        const char* open = static_cast<const char*>(std::memchr(buf, '(', length));
+        const char* close = nullptr;
+        for (const char* p = buf + length; p > buf; --p) {
+            if (p[-1] == ')') {
+                close = p - 1;
+                break;
             }
-            return set_performance_mode(args[2]);
-        } else if (subcommand == "list") {
-            return list_performance_modes();
         }
-        std::cerr << "Error: Unknown performance subcommand '" << subcommand << "'" << std::endl;
-        return false;
+        if (open == nullptr || close == nullptr || close < open) return false;
+        size_t name = std::min(static_cast<size_t>(close - open - 1), sizeof(comm) - 1);
+        std::memcpy(comm, open + 1, name);
+        comm[name] = '\0';
+
+        // utime and stime are the 12th and 13th fields after the name
+        const char* p = close + 1;
+        const char* end = buf + length;
+        uint64_t values[2] = {};
+        for (int field = 0; field < 13; ++field) {
+            while (p < end && *p == ' ') ++p;
+            uint64_t value = 0;
+            while (p < end && *p != ' ') {
+                value = value * 10 + static_cast<uint64_t>(*p - '0');
+                ++p;
+            }
+            if (field >= 11) values[field - 11] = value;
+            if (p >= end && field < 12) return false;
+        }
+        ticks = values[0] + values[1];
+        return true;
     }
 
-    std::string get_help() const override {
-        return "  perf read     Read current performance mode\n"
-               "  perf set <mode>  Set performance mode (low-power/balanced/performance)\n"
-               "  perf list     List available performance modes";
+    static bool sample(Process& process) {
+        char buf[512];
+        ssize_t n = -1;
+        for (int attempt = 0; attempt < 2 && n < 0; ++attempt) {
+            int fd = process.fd;
+            if (fd < 0) {
+                char path[32];
+                std::snprintf(path, sizeof(path), "/proc/%d/stat", process.pid);
+                fd = ::open(path, O_RDONLY | O_CLOEXEC);
+                if (fd < 0) return false;
+            }
+            n = pread(fd, buf, sizeof(buf), 0);
+            if (process.fd < 0) {
+                ::close(fd);
+            } else if (n < 0) {
+                // The process is gone, maybe with its pid already reused
+                ::close(process.fd);
+                process.fd = -1;
+                process.sampled = false;
+            }
+        }
+        if (n <= 0) return false;
+        uint64_t ticks;
+        if (!parse_stat(buf, static_cast<size_t>(n), process.comm, ticks)) return false;
+        process.cpu = process.sampled && ticks >= process.ticks ? static_cast<double>(ticks - process.ticks) : 0.0;
+        process.ticks = ticks;
+        process.sampled = true;
+        return true;
     }
 
-private:
-    bool read_performance_mode() {
-        std::string value;
-        if (!file_ops::read_file(PLATFORM_PROFILE_PATH, value)) return false;
-        std::cout << "Current performance mode: " << value << std::endl;
-        return true;
-    }
+    bool run(int interval_ms, int count) {
+        // Each process holds a descriptor, so use all the hard limit allows
+        struct rlimit limit;
+        size_t budget = 0;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            getrlimit(RLIMIT_NOFILE, &limit);
+            budget = limit.rlim_cur > 64 ? static_cast<size_t>(limit.rlim_cur) - 64 : 0;
+        }
+        DIR* proc = opendir("/proc");
+        if (proc == nullptr) {
+            std::cerr << "Error: Could not open /proc: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        file_ops::Attribute fan, mode;
+        bool have_fan = fan.open(fans::primary_path()) == 0;
+        bool have_mode = mode.open(profiles::current_path()) == 0;
+        double tick_s = static_cast<double>(sysconf(_SC_CLK_TCK));
+
+        signals::install_stop_handlers();
+        Screen screen;
+        std::vector<Process> processes, merged;
+        std::vector<int> listed;
+        std::vector<size_t> order;
+        size_t open_fds = 0;
+        SpinUp last;
+        uint64_t rpm = 0, previous_rpm = 0;
+        std::string profile;
+        char line[256];
+        auto previous = std::chrono::steady_clock::now();
+        auto next = previous;
+        for (int frame = 0; !signals::stop_requested && (count == 0 || frame < count); ++frame) {
+            if (frame > 0) {
+                next += std::chrono::milliseconds(interval_ms);
+                std::this_thread::sleep_until(next);
+            }
+            auto now = std::chrono::steady_clock::now();
+            double dt = std::chrono::duration<double>(now - previous).count();
+            previous = now;
+
+            listed.clear();
+            rewinddir(proc);
+            while (struct dirent* entry = readdir(proc)) {
+                if (entry->d_name[0] >= '1' && entry->d_name[0] <= '9') listed.push_back(std::atoi(entry->d_name));
+            }
+            std::sort(listed.begin(), listed.end());
+
+            // Merge the listing into the table, both ordered by pid
+            merged.clear();
+            size_t old = 0;
+            for (int pid : listed) {
+                for (; old < processes.size() && processes[old].pid < pid; ++old) {
+                    if (processes[old].fd >= 0) {
+                        ::close(processes[old].fd);
+                        open_fds--;
+                    }
+                }
+                if (old < processes.size() && processes[old].pid == pid) {
+                    merged.push_back(processes[old++]);
+                    continue;
+                }
+                Process process = {pid, -1, {}, 0, false, 0.0, 0.0, 0.0};
+                if (open_fds < budget) {
+                    char path[32];
+                    std::snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+                    process.fd = ::open(path, O_RDONLY | O_CLOEXEC);
+                    if (process.fd >= 0) open_fds++;
+                }
+                merged.push_back(process);
+            }
+            for (; old < processes.size(); ++old) {
+                if (processes[old].fd >= 0) {
+                    ::close(processes[old].fd);
+                    open_fds--;
+                }
+            }
+            processes.swap(merged);
+
+            double alpha = 1.0 - std::exp(-dt / FAN_LAG_S);
+            double total_cpu = 0.0, total_average = 0.0;
+            for (auto& process : processes) {
+                bool had_fd = process.fd >= 0;
+                if (!sample(process)) process.cpu = 0.0;
+                if (had_fd && process.fd < 0) open_fds--;
+                process.cpu = frame > 0 ? process.cpu / tick_s / dt * 100.0 : 0.0;
+                process.average += alpha * (process.cpu - process.average);
+                total_cpu += process.cpu;
+                total_average += process.average;
+            }
+
+            previous_rpm = rpm;
+            if (have_fan) fan.read_u64(rpm);
+            if (have_mode) mode.read(profile);
+            order.resize(processes.size());
+            for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+
+            // Credit a spin-up to whatever was busy leading up to it
+            if (frame > 0 && rpm > previous_rpm + SPIN_UP_RPM && total_average > 0.0) {
+                for (auto& process : processes) {
+                    process.fan_rpm += static_cast<double>(rpm - previous_rpm) * process.average / total_average;
+                }
+                size_t top = std::min(CULPRITS, order.size());
+                std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(top), order.end(),
+                                  [&](size_t a, size_t b) { return processes[a].average > processes[b].average; });
+                last = SpinUp();
+                last.when = std::time(nullptr);
+                last.from = previous_rpm;
+                last.to = rpm;
+                for (size_t i = 0; i < top; ++i) {
+                    std::memcpy(last.comm[i], processes[order[i]].comm, sizeof(last.comm[i]));
+                    last.share[i] = processes[order[i]].average / total_average * 100.0;
+                }
+            }
 
-    bool set_performance_mode(const std::string& mode) {
-        // Check if the mode is valid. If 'mode' is not in the list of available modes, return false
-        std::string available_modes;
-        if (!file_ops::read_file(PLATFORM_PROFILE_CHOICES_PATH, available_modes)) return false;
-        if (available_modes.find(mode) == std::string::npos) {
-            std::cerr << "Error: Invalid performance mode '" << mode << "'" << std::endl;
-            return false;
-        }
+            size_t rows = static_cast<size_t>(std::max(screen.rows(), 6));
+            size_t shown = std::min(order.size(), rows - 5);
+            std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(shown), order.end(),
+                              [&](size_t a, size_t b) {
+                                  const Process& x = processes[a];
+                                  const Process& y = processes[b];
+                                  if (x.cpu != y.cpu) return x.cpu > y.cpu;
+                                  return x.average != y.average ? x.average > y.average : x.pid < y.pid;
+                              });
 
-        if (!file_ops::write_file(PLATFORM_PROFILE_PATH, mode)) return false;
-        std::cout << "Set performance mode to " << mode << std::endl;
-        return true;
-    }
+            char clock[16];
+            std::time_t wall = std::time(nullptr);
+            std::strftime(clock, sizeof(clock), "%H:%M:%S", std::localtime(&wall));
+            int n = std::snprintf(line, sizeof(line), "samsung-cli top  %s   fan %" PRIu64 " RPM   mode %s   CPU %.1f%%   %zu processes",
+                                  clock, rpm, have_mode ? profile.c_str() : "-", total_cpu, processes.size());
+            screen.set(0, line, static_cast<size_t>(std::max(n, 0)));
+            if (last.when != 0) {
+                std::strftime(clock, sizeof(clock), "%H:%M:%S", std::localtime(&last.when));
+                n = std::snprintf(line, sizeof(line), "last spin-up %s  %" PRIu64 " -> %" PRIu64 " RPM:", clock,
+                                  last.from, last.to);
+                for (size_t i = 0; i < CULPRITS && last.comm[i][0] != '\0' && n > 0; ++i) {
+                    n += std::snprintf(line + n, sizeof(line) - static_cast<size_t>(n), "%s %s %.0f%%",
+                                       i > 0 ? "," : "", last.comm[i], last.share[i]);
+                }
+            } else {
+                n = std::snprintf(line, sizeof(line), "no fan spin-up seen yet");
+            }
+            screen.set(1, line, static_cast<size_t>(std::max(std::min(n, static_cast<int>(sizeof(line)) - 1), 0)));
+            screen.set(2, "", 0);
+            n = std::snprintf(line, sizeof(line), "%7s %-16s %6s %6s %8s", "PID", "COMMAND", "CPU%", "AVG%", "FAN+RPM");
+            screen.set(3, line, static_cast<size_t>(n));
+            for (size_t i = 0; i < shown; ++i) {
+                const Process& process = processes[order[i]];
+                n = std::snprintf(line, sizeof(line), "%7d %-16s %6.1f %6.1f %8.0f", process.pid, process.comm,
+                                  process.cpu, process.average, process.fan_rpm);
+                screen.set(4 + i, line, static_cast<size_t>(n));
+            }
+            screen.flush();
+        }
 
-    bool list_performance_modes() {
-        std::string value;
-        if (!file_ops::read_file(PLATFORM_PROFILE_CHOICES_PATH, value)) return false;
-        std::cout << "Available performance modes: " << value << std::endl;
+        for (auto& process : processes) {
+            if (process.fd >= 0) ::close(process.fd);
+        }
+        closedir(proc);
         return true;
     }
 };
 
-class RecordingCommand : public Command {
+// Every setting and reading on one screen. Mode and backlight changes
+// arrive as sysfs POLLPRI and power supply changes as uevents, so they show
+// at once; fan speed and battery power have no notification and are reread
+// on a slow timer. A frame reads into fixed buffers and formats with
+// snprintf, and the screen only sends cells that changed, so nothing is
+// allocated or written while the values hold still.
+class DashboardCommand : public Command {
 public:
     bool execute(const std::vector<std::string>& args) override {
-        if (args.size() < 2) {
-            std::cerr << "Error: Missing recording subcommand. Use 'read' or 'set'." << std::endl;
-            return false;
-        }
-
-        std::string subcommand = args[1];
-        if (subcommand == "read") {
-            return read_recording_status();
-        } else if (subcommand == "set") {
-            if (args.size() < 3) {
-                std::cerr << "Error: Missing value for 'record set'" << std::endl;
+        int interval_ms = 2000, count = 0;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (i + 1 >= args.size()) {
+                std::cerr << "Error: Missing value for '" << args[i] << "'" << std::endl;
+                return false;
+            }
+            try {
+                if (args[i] == "--interval") {
+                    interval_ms = std::stoi(args[++i]);
+                } else if (args[i] == "--count") {
+                    count = std::stoi(args[++i]);
+                } else {
+                    std::cerr << "Error: Unknown dashboard option '" << args[i] << "'" << std::endl;
+                    return false;
+                }
+            } catch (...) {
+                std::cerr << "Error: Invalid value '" << args[i] << "'" << std::endl;
                 return false;
             }
-            return set_recording_status(args[2]);
         }
-        std::cerr << "Error: Unknown recording subcommand '" << subcommand << "'" << std::endl;
-        return false;
+        if (interval_ms < 100 || count < 0) {
+            std::cerr << "Error: Interval must be at least 100 ms and count not negative" << std::endl;
+            return false;
+        }
+        return run(interval_ms, count);
     }
 
     std::string get_help() const override {
-        return "  record read   Read recording permission status\n"
-               "  record set <value>  Set recording permission (0/1, on/off, true/false, yes/no)";
+        return "  dashboard [--interval <ms>] [--count <n>]  Live view of every setting and reading, redrawn\n"
+               "               on change notifications and every <ms> (default 2000) for the rest";
     }
 
 private:
-    bool read_recording_status() {
-        std::string value;
-        if (!file_ops::read_file(ALLOW_RECORDING_PATH, value)) return false;
-        std::cout << "Recording permission: " << (value == "1" ? "Enabled" : "Disabled") << std::endl;
-        return true;
+    static constexpr int LABEL_WIDTH = 20;
+
+    struct Fan {
+        std::string label;
+        file_ops::Attribute rpm;
+    };
+
+    // First line of an attribute in 'buf', "-" when it can't be read
+    static const char* text(file_ops::Attribute& attribute, char* buf, size_t size) {
+        size_t length = 0;
+        if (!attribute.is_open() || attribute.read(buf, size - 1, length) != 0) return "-";
+        buf[length] = '\0';
+        buf[std::strcspn(buf, "\n")] = '\0';
+        return buf;
     }
 
-    bool set_recording_status(const std::string& value) {
-        std::string normalized_value;
-        // Convert various input formats to "0" or "1"
-        if (value == "0" || value == "off" || value == "false" || value == "no") {
-            normalized_value = "0";
-        } else if (value == "1" || value == "on" || value == "true" || value == "yes") {
-            normalized_value = "1";
+    static bool number(file_ops::Attribute& attribute, uint64_t& value) {
+        return attribute.is_open() && attribute.read_u64(value) == 0;
+    }
+
+    bool run(int interval_ms, int count) {
+        const FeaturePaths& paths = feature_paths();
+        file_ops::Attribute mode, kbd, kbd_hw, threshold, capacity, status, power, energy, ac;
+        file_ops::Attribute recording, lid, usb;
+        std::string led = KBD_BACKLIGHT_PATH.substr(0, KBD_BACKLIGHT_PATH.rfind('/'));
+        mode.open(profiles::current_path());
+        kbd.open(KBD_BACKLIGHT_PATH);
+        kbd_hw.open(led + "/brightness_hw_changed");
+        threshold.open(POWER_PATH);
+        capacity.open(BATTERY_CAPACITY_PATH);
+        status.open(BATTERY_STATUS_PATH);
+        power.open(BATTERY_POWER_NOW_PATH);
+        energy.open(BATTERY_ENERGY_NOW_PATH);
+        ac.open(power_supply::find_mains_online());
+        if (!paths.allow_recording.empty()) recording.open(paths.allow_recording);
+        if (!paths.start_on_lid_open.empty()) lid.open(paths.start_on_lid_open);
+        if (!paths.usb_charge.empty()) usb.open(paths.usb_charge);
+        std::vector<Fan> fan_list;
+        if (fans::all().size() < 2) {
+            fan_list.push_back({"Fan", {}});
+            fan_list.back().rpm.open(fans::primary_path());
         } else {
-            std::cerr << "Error: Value must be one of: 0/1, on/off, true/false, yes/no" << std::endl;
-            return false;
+            for (const auto& source : fans::all()) {
+                fan_list.push_back({"Fan " + source.fan, {}});
+                fan_list.back().rpm.open(source.path);
+            }
         }
-        
-        if (!file_ops::write_file(ALLOW_RECORDING_PATH, normalized_value)) return false;
-        std::cout << "Set recording permission to " << (normalized_value == "1" ? "Enabled" : "Disabled") << std::endl;
+        uint64_t kbd_max = 3;
+        std::string max_brightness;
+        if (file_ops::backend().read(led + "/max_brightness", max_brightness) == 0) {
+            try {
+                kbd_max = std::stoull(max_brightness);
+            } catch (...) {
+            }
+        }
+
+        int uevent_fd = uevent::open_socket();
+        // Attributes whose changes the kernel announces
+        struct pollfd fds[6];
+        nfds_t watched = 0;
+        if (uevent_fd >= 0) fds[watched++] = {uevent_fd, POLLIN, 0};
+        for (file_ops::Attribute* attribute : {&mode, &kbd, &kbd_hw, &recording, &lid, &usb}) {
+            if (attribute->poll_fd() >= 0 && watched < std::size(fds)) {
+                fds[watched++] = {attribute->poll_fd(), POLLPRI | POLLERR, 0};
+            }
+        }
+
+        signals::install_stop_handlers();
+        char line[160], value[64], state[32];
+        int frames = 0;
+        Screen screen;
+        auto put = [&](size_t& row, const char* label, const char* shown) {
+            int n = std::snprintf(line, sizeof(line), "%-*s%s", LABEL_WIDTH, label, shown);
+            screen.set(row++, line, std::min(static_cast<size_t>(std::max(n, 0)), sizeof(line) - 1));
+        };
+        // Formats into 'value', "-" when the attribute can't be read
+        auto format = [&](file_ops::Attribute& attribute, const char* pattern) -> const char* {
+            uint64_t raw;
+            if (!number(attribute, raw)) return "-";
+            std::snprintf(value, sizeof(value), pattern, raw);
+            return value;
+        };
+        auto toggle = [&](file_ops::Attribute& attribute, bool inverted, const char* on,
+                          const char* off) -> const char* {
+            uint64_t raw;
+            if (!number(attribute, raw)) return "-";
+            return (raw != 0) != inverted ? on : off;
+        };
+
+        while (!signals::stop_requested && (count == 0 || frames < count)) {
+            size_t row = 0;
+            static const char title[] = "samsung-cli dashboard";
+            screen.set(row++, title, sizeof(title) - 1);
+            row++;
+
+            put(row, "Performance mode", text(mode, value, sizeof(value)));
+            for (auto& fan : fan_list) put(row, fan.label.c_str(), format(fan.rpm, "%" PRIu64 " RPM"));
+            uint64_t level;
+            bool have_level = number(kbd, level);
+            if (have_level) std::snprintf(value, sizeof(value), "%" PRIu64 " / %" PRIu64, level, kbd_max);
+            put(row, "Keyboard backlight", have_level ? value : "-");
+            put(row, "Charge threshold", format(threshold, "%" PRIu64 "%%"));
+            uint64_t percent, power_uw, energy_uwh;
+            bool have_percent = number(capacity, percent);
+            if (have_percent) {
+                const char* charge = text(status, state, sizeof(state));
+                double sign = std::strcmp(charge, "Discharging") == 0 ? -1.0 : 1.0;
+                int n = std::snprintf(value, sizeof(value), "%" PRIu64 "%%, %s", percent, charge);
+                if (n > 0 && number(power, power_uw)) {
+                    n += std::snprintf(value + n, sizeof(value) - static_cast<size_t>(n), ", %.1f W",
+                                       sign * static_cast<double>(power_uw) / 1e6);
+                }
+                if (n > 0 && static_cast<size_t>(n) < sizeof(value) && number(energy, energy_uwh)) {
+                    std::snprintf(value + n, sizeof(value) - static_cast<size_t>(n), ", %.2f Wh",
+                                  static_cast<double>(energy_uwh) / 1e6);
+                }
+            }
+            put(row, "Battery", have_percent ? value : "-");
+            put(row, "AC", toggle(ac, false, "online", "offline"));
+            put(row, "Recording", toggle(recording, paths.recording_inverted, "allowed", "blocked"));
+            put(row, "Start on lid open", toggle(lid, false, "on", "off"));
+            put(row, "USB charging", toggle(usb, false, "on", "off"));
+            row++;
+            int n = std::snprintf(line, sizeof(line), "Ctrl+C to quit; rereads every %d ms", interval_ms);
+            screen.set(row++, line, static_cast<size_t>(n));
+            screen.flush();
+
+            if (++frames == count) break;
+
+            int ready = poll(fds, watched, interval_ms);
+            if (ready > 0 && uevent_fd >= 0 && (fds[0].revents & POLLIN) != 0) {
+                // Drain the queue; a frame without changes writes nothing,
+                // so uevents of other devices cost little
+                char event[8192];
+                while (recv(uevent_fd, event, sizeof(event), 0) > 0) {
+                }
+            }
+            // Reading brightness_hw_changed rearms its notification
+            if (kbd_hw.is_open()) {
+                uint64_t ignored;
+                kbd_hw.read_u64(ignored);
+            }
+        }
+
+        // Reported once the terminal is back from the alternate screen
+        screen.close();
+        if (uevent_fd >= 0) ::close(uevent_fd);
+        std::cerr << frames << " frames, " << screen.written() << " bytes to the terminal" << std::endl;
         return true;
     }
 };
 
-class KeyboardCommand : public Command {
+class TraceCommand : public Command {
 public:
     bool execute(const std::vector<std::string>& args) override {
-        if (args.size() < 2) {
-            std::cerr << "Error: Missing keyboard subcommand. Use 'read' or 'set'." << std::endl;
+        if (args.size() < 3) {
+            std::cerr << "Error: Missing trace subcommand or file. Use 'dump <file>' or 'stats <file>'." << std::endl;
             return false;
         }
 
         std::string subcommand = args[1];
-        if (subcommand == "read") {
-            return read_keyboard_backlight();
-        } else if (subcommand == "set") {
-            if (args.size() < 3) {
-                std::cerr << "Error: Missing value for 'kbd set'" << std::endl;
-                return false;
-            }
-            return set_keyboard_backlight(args[2]);
+        if (subcommand != "dump" && subcommand != "stats") {
+            std::cerr << "Error: Unknown trace subcommand '" << subcommand << "'" << std::endl;
+            return false;
         }
-        std::cerr << "Error: Unknown keyboard subcommand '" << subcommand << "'" << std::endl;
-        return false;
+        std::vector<file_ops::TraceRecord> records;
+        if (!file_ops::trace::load(args[2], records)) return false;
+        return subcommand == "dump" ? dump(records) : stats(records);
     }
 
     std::string get_help() const override {
-        return "  kbd read      Read keyboard backlight level\n"
-               "  kbd set <0-3> Set keyboard backlight level (0=off, 1-3=brightness)\n"
-               "               Note: Backlight may be affected by ambient light sensor\n"
-               "               and GNOME's automatic backlight control";
+        return "  trace dump <file>   Print every operation in a recorded trace\n"
+               "  trace stats <file>  Summarize operations and latency per attribute\n"
+               "               Record with SAMSUNG_CLI_TRACE=<file>, replay with\n"
+               "               SAMSUNG_CLI_BACKEND=replay SAMSUNG_CLI_REPLAY=<file>";
     }
 
 private:
-    bool read_keyboard_backlight() {
-        std::string value;
-        if (!file_ops::read_file(KBD_BACKLIGHT_PATH, value)) return false;
-        std::cout << "Keyboard backlight level: " << value << std::endl;
-        return true;
+    static const char* op_name(file_ops::TraceRecord::Op op) {
+        switch (op) {
+            case file_ops::TraceRecord::Op::Access: return "access";
+            case file_ops::TraceRecord::Op::AccessWrite: return "access-w";
+            case file_ops::TraceRecord::Op::Read: return "read";
+            case file_ops::TraceRecord::Op::Write: return "write";
+        }
+        return "?";
     }
 
-    bool set_keyboard_backlight(const std::string& value) {
-        int val;
-        try {
-            val = std::stoi(value);
-            if (val < 0 || val > 3) {
-                std::cerr << "Error: Value must be between 0 and 3" << std::endl;
-                return false;
+    bool dump(const std::vector<file_ops::TraceRecord>& records) {
+        if (records.empty()) return true;
+        int64_t first = records.front().time_ns;
+        for (const auto& record : records) {
+            std::cout << std::fixed << std::setprecision(6) << (record.time_ns - first) / 1e9 << " "
+                      << op_name(record.op) << " " << record.path << " "
+                      << std::setprecision(3) << record.latency_ns / 1e6 << "ms";
+            if (record.err != 0) {
+                std::cout << " error=" << std::strerror(record.err);
+            } else if (!record.value.empty()) {
+                std::cout << " value=" << record.value;
             }
-        } catch (...) {
-            std::cerr << "Error: Invalid value '" << value << "'" << std::endl;
-            return false;
+            std::cout << std::endl;
+        }
+        return true;
+    }
+
+    bool stats(const std::vector<file_ops::TraceRecord>& records) {
+        struct Summary {
+            size_t count = 0;
+            size_t errors = 0;
+            int64_t total_ns = 0;
+            int64_t max_ns = 0;
+        };
+        std::map<std::pair<std::string, std::string>, Summary> summaries;
+        for (const auto& record : records) {
+            Summary& summary = summaries[{record.path, op_name(record.op)}];
+            summary.count++;
+            if (record.err != 0) summary.errors++;
+            summary.total_ns += record.latency_ns;
+            summary.max_ns = std::max(summary.max_ns, record.latency_ns);
+        }
+
+        std::cout << records.size() << " operations" << std::endl;
+        for (const auto& [key, summary] : summaries) {
+            std::cout << std::fixed << std::setprecision(3) << key.first << " " << key.second
+                      << ": count=" << summary.count << " errors=" << summary.errors
+                      << " avg=" << summary.total_ns / 1e6 / summary.count << "ms"
+                      << " max=" << summary.max_ns / 1e6 << "ms" << std::endl;
         }
-        if (!file_ops::write_file(KBD_BACKLIGHT_PATH, std::to_string(val))) return false;
-        std::cout << "Set keyboard backlight level to " << val << std::endl;
         return true;
     }
 };
 
-class StartOnLidOpenCommand : public Command {
+// Records CPU load, fan speed, power and profile on a real machine and
+// replays the recording in virtual time to evaluate automatic profile
+// switching policies offline
+class SimulateCommand : public Command {
 public:
     bool execute(const std::vector<std::string>& args) override {
-        if (args.size() < 2) {
-            std::cerr << "Error: Missing start-on-lid-open subcommand. Use 'read' or 'set'." << std::endl;
+        if (args.size() < 3) {
+            std::cerr << "Error: Missing simulate subcommand or file. Use 'record' or 'run'." << std::endl;
             return false;
         }
 
         std::string subcommand = args[1];
-        if (subcommand == "read") {
-            return read_status();
-        } else if (subcommand == "set") {
-            if (args.size() < 3) {
-                std::cerr << "Error: Missing value for 'start-on-lid-open set'" << std::endl;
+        if (subcommand == "record") {
+            int interval_ms = 1000;
+            int duration_s = 0;
+            try {
+                if (args.size() > 3) interval_ms = std::stoi(args[3]);
+                if (args.size() > 4) duration_s = std::stoi(args[4]);
+            } catch (...) {
+                std::cerr << "Error: Invalid interval or duration" << std::endl;
                 return false;
             }
-            return set_status(args[2]);
+            if (interval_ms < 10 || duration_s < 0) {
+                std::cerr << "Error: Interval must be at least 10 ms and duration non-negative" << std::endl;
+                return false;
+            }
+            return record(args[2], interval_ms, duration_s);
+        } else if (subcommand == "run") {
+            if (args.size() < 4) {
+                std::cerr << "Error: Missing policy for 'simulate run'" << std::endl;
+                return false;
+            }
+            return run(args[2], std::vector<std::string>(args.begin() + 3, args.end()));
         }
-        std::cerr << "Error: Unknown start-on-lid-open subcommand '" << subcommand << "'" << std::endl;
+        std::cerr << "Error: Unknown simulate subcommand '" << subcommand << "'" << std::endl;
         return false;
     }
 
     std::string get_help() const override {
-        return "  start-on-lid-open read   Read start on lid open status\n"
-               "  start-on-lid-open set <value>  Set start on lid open (0/1, on/off, true/false, yes/no)";
+        return "  simulate record <file> [interval-ms] [duration-s]  Record load/fan/power samples\n"
+               "  simulate run <file> <policy>...  Evaluate profile switching policies on a recording\n"
+               "               Policy: static=<mode> or up=<load>,down=<load>,dwell=<s>,smooth=<s>";
     }
 
 private:
-    bool read_status() {
-        std::string value;
-        if (!file_ops::read_file(START_ON_LID_OPEN_PATH, value)) return false;
-        std::cout << "Start on lid open: " << (value == "1" ? "Enabled" : "Disabled") << std::endl;
-        return true;
+    // Profiles are stored as an index into this ladder, lowest power first
+    static constexpr const char* PROFILES[] = {"low-power", "quiet", "balanced", "performance"};
+    static constexpr int PROFILE_COUNT = 4;
+    static constexpr char MAGIC[8] = {'S', 'G', 'B', 'L', 'O', 'A', 'D', '1'};
+    static constexpr size_t RECORD_SIZE = 16;
+
+    struct Sample {
+        uint32_t time_ms;   // Since the start of the recording
+        float load;         // Busy fraction of all CPUs, 0-1
+        uint16_t fan_rpm;
+        uint32_t power_mw;  // 0 when no power source was available
+        uint8_t profile;    // Index into PROFILES, 0xff if unknown
+    };
+
+    struct Policy {
+        std::string label;
+        int fixed = -1;          // Static profile, -1 for an adaptive policy
+        double up = 0.70;        // Step up when the smoothed load exceeds this
+        double down = 0.30;      // Step down when it falls below this
+        double dwell_s = 30.0;   // Minimum time between switches
+        double smooth_s = 10.0;  // Load smoothing time constant
+    };
+
+    struct Result {
+        int switches = 0;
+        double seconds[PROFILE_COUNT] = {};
+        double energy_j = 0.0;
+    };
+
+    static int profile_index(const std::string& name) {
+        for (int i = 0; i < PROFILE_COUNT; ++i) {
+            if (name == PROFILES[i]) return i;
+        }
+        return -1;
     }
 
-    bool set_status(const std::string& value) {
-        std::string normalized_value;
-        // Convert various input formats to "0" or "1"
-        if (value == "0" || value == "off" || value == "false" || value == "no") {
-            normalized_value = "0";
-        } else if (value == "1" || value == "on" || value == "true" || value == "yes") {
-            normalized_value = "1";
-        } else {
-            std::cerr << "Error: Value must be one of: 0/1, on/off, true/false, yes/no" << std::endl;
+    // Simple package power model used to rescale measured power to another
+    // profile: idle watts plus watts at full load
+    static double model_power(int profile, double load) {
+        static const double idle[PROFILE_COUNT] = {3.0, 3.5, 4.0, 5.0};
+        static const double busy[PROFILE_COUNT] = {12.0, 16.0, 22.0, 35.0};
+        return idle[profile] + load * busy[profile];
+    }
+
+    // Aggregate busy and total jiffies from the first line of /proc/stat
+    static bool read_cpu_times(int fd, uint64_t& busy, uint64_t& total) {
+        char buf[512];
+        ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0) return false;
+        buf[n] = '\0';
+        uint64_t fields[8] = {};
+        if (std::sscanf(buf, "cpu %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64, &fields[0], &fields[1], &fields[2],
+                        &fields[3], &fields[4], &fields[5], &fields[6], &fields[7]) < 4) {
             return false;
         }
-        
-        if (!file_ops::write_file(START_ON_LID_OPEN_PATH, normalized_value)) return false;
-        std::cout << "Set start on lid open to " << (normalized_value == "1" ? "Enabled" : "Disabled") << std::endl;
+        total = 0;
+        for (uint64_t field : fields) total += field;
+        busy = total - fields[3] - fields[4];  // Minus idle and iowait
         return true;
     }
-};
 
-class UsbChargeCommand : public Command {
-public:
-    bool execute(const std::vector<std::string>& args) override {
-        if (args.size() < 2) {
-            std::cerr << "Error: Missing usb-charge subcommand. Use 'read' or 'set'." << std::endl;
+    bool record(const std::string& path, int interval_ms, int duration_s) {
+        int stat_fd = ::open("/proc/stat", O_RDONLY | O_CLOEXEC);
+        if (stat_fd < 0) {
+            std::cerr << "Error: Could not open /proc/stat" << std::endl;
+            return false;
+        }
+        int out = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            std::cerr << "Error: Could not write to " << path << ": " << std::strerror(errno) << std::endl;
+            ::close(stat_fd);
             return false;
         }
+        bool ok = ::write(out, MAGIC, sizeof(MAGIC)) == static_cast<ssize_t>(sizeof(MAGIC));
 
-        std::string subcommand = args[1];
-        if (subcommand == "read") {
-            return read_status();
-        } else if (subcommand == "set") {
-            if (args.size() < 3) {
-                std::cerr << "Error: Missing value for 'usb-charge set'" << std::endl;
-                return false;
+        // Package power from RAPL, battery power otherwise
+        uint64_t prev_busy = 0, prev_total = 0;
+        std::vector<rapl::Domain> domains;
+        rapl::Domain* package = nullptr;
+        if (rapl::discover(domains, true)) {
+            for (auto& domain : domains) {
+                if (package == nullptr && domain.name.compare(0, 7, "package") == 0) package = &domain;
             }
-            return set_status(args[2]);
         }
-        std::cerr << "Error: Unknown usb-charge subcommand '" << subcommand << "'" << std::endl;
-        return false;
-    }
+        bool have_rapl = package != nullptr;
+        ok = ok && read_cpu_times(stat_fd, prev_busy, prev_total);
 
-    std::string get_help() const override {
-        return "  usb-charge read   Read USB charge status\n"
-               "  usb-charge set <value>  Set USB charge (0/1, on/off, true/false, yes/no)";
-    }
+        auto start = std::chrono::steady_clock::now();
+        auto next = start;
+        auto prev_time = start;
+        size_t count = 0;
+        std::cout << "Recording to " << path << " every " << interval_ms << " ms"
+                  << (have_rapl ? " (RAPL power)" : " (battery power)") << std::endl;
+        while (ok && (duration_s == 0 || next - start < std::chrono::seconds(duration_s))) {
+            next += std::chrono::milliseconds(interval_ms);
+            std::this_thread::sleep_until(next);
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - prev_time).count();
+            prev_time = now;
 
-private:
-    bool read_status() {
-        std::string value;
-        if (!file_ops::read_file(USB_CHARGE_PATH, value)) return false;
-        std::cout << "USB charge: " << (value == "1" ? "Enabled" : "Disabled") << std::endl;
-        return true;
-    }
+            Sample sample{};
+            sample.time_ms = static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count());
+            uint64_t busy, total;
+            if (read_cpu_times(stat_fd, busy, total) && total > prev_total) {
+                sample.load = static_cast<float>(busy - prev_busy) / static_cast<float>(total - prev_total);
+                prev_busy = busy;
+                prev_total = total;
+            }
 
-    bool set_status(const std::string& value) {
-        std::string normalized_value;
-        // Convert various input formats to "0" or "1"
-        if (value == "0" || value == "off" || value == "false" || value == "no") {
-            normalized_value = "0";
-        } else if (value == "1" || value == "on" || value == "true" || value == "yes") {
-            normalized_value = "1";
-        } else {
-            std::cerr << "Error: Value must be one of: 0/1, on/off, true/false, yes/no" << std::endl;
+            std::string value;
+            if (file_ops::backend().read(fans::primary_path(), value) == 0) {
+                try {
+                    sample.fan_rpm = static_cast<uint16_t>(std::min(std::stoi(value), 65535));
+                } catch (...) {
+                }
+            }
+            sample.profile = 0xff;
+            if (file_ops::backend().read(profiles::current_path(), value) == 0) {
+                int index = profile_index(value);
+                if (index >= 0) sample.profile = static_cast<uint8_t>(index);
+            }
+
+            uint64_t delta_uj;
+            if (have_rapl) {
+                if (rapl::update(*package, delta_uj) == 0) {
+                    sample.power_mw = static_cast<uint32_t>(delta_uj / 1000.0 / elapsed);
+                }
+            } else if (file_ops::backend().read(BATTERY_POWER_NOW_PATH, value) == 0) {
+                try {
+                    sample.power_mw = static_cast<uint32_t>(std::stoull(value) / 1000);
+                } catch (...) {
+                }
+            }
+
+            ok = write_sample(out, sample);
+            count++;
+        }
+
+        ::close(stat_fd);
+        if (::close(out) != 0) ok = false;
+        if (!ok) {
+            std::cerr << "Error: Recording to " << path << " failed" << std::endl;
             return false;
         }
-        
-        if (!file_ops::write_file(USB_CHARGE_PATH, normalized_value)) return false;
-        std::cout << "Set USB charge to " << (normalized_value == "1" ? "Enabled" : "Disabled") << std::endl;
+        std::cout << "Recorded " << count << " samples" << std::endl;
         return true;
     }
-};
 
-class HelpCommand : public Command {
-public:
-    explicit HelpCommand(const std::map<std::string, std::unique_ptr<Command>>& cmds) 
-        : commands(cmds) {}
+    static bool write_sample(int fd, const Sample& sample) {
+        unsigned char buf[RECORD_SIZE] = {};
+        uint32_t load_bits;
+        std::memcpy(&load_bits, &sample.load, sizeof(load_bits));
+        for (int i = 0; i < 4; ++i) {
+            buf[i] = static_cast<unsigned char>(sample.time_ms >> (8 * i));
+            buf[4 + i] = static_cast<unsigned char>(load_bits >> (8 * i));
+            buf[10 + i] = static_cast<unsigned char>(sample.power_mw >> (8 * i));
+        }
+        buf[8] = static_cast<unsigned char>(sample.fan_rpm);
+        buf[9] = static_cast<unsigned char>(sample.fan_rpm >> 8);
+        buf[14] = sample.profile;
+        return ::write(fd, buf, sizeof(buf)) == static_cast<ssize_t>(sizeof(buf));
+    }
 
-    bool execute(const std::vector<std::string>&) override {
-        print_help();
+    static bool load_samples(const std::string& path, std::vector<Sample>& samples) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not open " << path << std::endl;
+            return false;
+        }
+        std::string data(static_cast<size_t>(file.tellg()), '\0');
+        file.seekg(0);
+        file.read(&data[0], static_cast<std::streamsize>(data.size()));
+        if (data.size() < sizeof(MAGIC) || data.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0) {
+            std::cerr << "Error: " << path << " is not a simulate recording" << std::endl;
+            return false;
+        }
+
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data()) + sizeof(MAGIC);
+        size_t count = (data.size() - sizeof(MAGIC)) / RECORD_SIZE;
+        samples.resize(count);
+        for (size_t i = 0; i < count; ++i, p += RECORD_SIZE) {
+            uint32_t load_bits = 0;
+            Sample& sample = samples[i];
+            sample.time_ms = 0;
+            sample.power_mw = 0;
+            for (int b = 3; b >= 0; --b) {
+                sample.time_ms = (sample.time_ms << 8) | p[b];
+                load_bits = (load_bits << 8) | p[4 + b];
+                sample.power_mw = (sample.power_mw << 8) | p[10 + b];
+            }
+            std::memcpy(&sample.load, &load_bits, sizeof(sample.load));
+            sample.fan_rpm = static_cast<uint16_t>(p[8] | (p[9] << 8));
+            sample.profile = p[14];
+        }
         return true;
     }
 
-    std::string get_help() const override {
-        return "  help          Show this help message";
+    static bool parse_policy(const std::string& spec, Policy& policy) {
+        policy.label = spec;
+        size_t start = 0;
+        while (start < spec.size()) {
+            size_t end = spec.find(',', start);
+            if (end == std::string::npos) end = spec.size();
+            std::string item = spec.substr(start, end - start);
+            start = end + 1;
+
+            size_t eq = item.find('=');
+            std::string key = item.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+            try {
+                if (key == "static") {
+                    policy.fixed = profile_index(value);
+                    if (policy.fixed < 0) return false;
+                } else if (key == "up") {
+                    policy.up = std::stod(value);
+                } else if (key == "down") {
+                    policy.down = std::stod(value);
+                } else if (key == "dwell") {
+                    policy.dwell_s = std::stod(value);
+                } else if (key == "smooth") {
+                    policy.smooth_s = std::stod(value);
+                } else {
+                    return false;
+                }
+            } catch (...) {
+                return false;
+            }
+        }
+        return policy.down <= policy.up && policy.dwell_s >= 0 && policy.smooth_s >= 0;
     }
 
-private:
-    void print_help() {
-        std::cout << "Usage: samsung-cli <command> [<args>]\n"
-                  << "CLI tool to control Samsung Galaxy Book features.\n\n"
-                  << "Commands:\n";
-        
-        // Get help text from all commands
-        for (const auto& [name, cmd] : commands) {
-            std::cout << cmd->get_help() << "\n";
+    // Run one policy over the recording in virtual time. Measured power is
+    // rescaled by the model ratio between the simulated and recorded profile.
+    static Result evaluate(const Policy& policy, const std::vector<Sample>& samples) {
+        Result result;
+        int profile = policy.fixed >= 0 ? policy.fixed : profile_index("balanced");
+        double smoothed = samples.empty() ? 0.0 : samples.front().load;
+        double last_switch = -policy.dwell_s;
+
+        for (size_t i = 1; i < samples.size(); ++i) {
+            const Sample& sample = samples[i];
+            double now = sample.time_ms / 1000.0;
+            double dt = (sample.time_ms - samples[i - 1].time_ms) / 1000.0;
+            if (dt <= 0) continue;
+
+            if (policy.fixed < 0) {
+                double alpha = policy.smooth_s > 0 ? 1.0 - std::exp(-dt / policy.smooth_s) : 1.0;
+                smoothed += alpha * (sample.load - smoothed);
+                if (now - last_switch >= policy.dwell_s) {
+                    int next = profile;
+                    if (smoothed > policy.up && profile < PROFILE_COUNT - 1) next++;
+                    if (smoothed < policy.down && profile > 0) next--;
+                    if (next != profile) {
+                        profile = next;
+                        result.switches++;
+                        last_switch = now;
+                    }
+                }
+            }
+
+            double power = model_power(profile, sample.load);
+            if (sample.power_mw > 0 && sample.profile < PROFILE_COUNT) {
+                power = sample.power_mw / 1000.0 * power / model_power(sample.profile, sample.load);
+            }
+            result.seconds[profile] += dt;
+            result.energy_j += power * dt;
         }
+        return result;
     }
 
-    const std::map<std::string, std::unique_ptr<Command>>& commands;
+    bool run(const std::string& path, const std::vector<std::string>& specs) {
+        std::vector<Policy> policies;
+        for (const auto& spec : specs) {
+            Policy policy;
+            if (!parse_policy(spec, policy)) {
+                std::cerr << "Error: Invalid policy '" << spec << "'" << std::endl;
+                return false;
+            }
+            policies.push_back(policy);
+        }
+
+        std::vector<Sample> samples;
+        if (!load_samples(path, samples)) return false;
+        if (samples.size() < 2) {
+            std::cerr << "Error: Recording " << path << " has too few samples" << std::endl;
+            return false;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        double span = (samples.back().time_ms - samples.front().time_ms) / 1000.0;
+        std::cout << "Recording: " << samples.size() << " samples over " << std::fixed << std::setprecision(1)
+                  << span / 3600.0 << " h" << std::endl;
+        for (const auto& policy : policies) {
+            Result result = evaluate(policy, samples);
+            std::cout << "\nPolicy " << policy.label << "\n"
+                      << "  switches: " << result.switches << "\n";
+            for (int i = 0; i < PROFILE_COUNT; ++i) {
+                std::cout << "  " << std::left << std::setw(12) << PROFILES[i] << std::right
+                          << std::setw(8) << std::setprecision(2) << result.seconds[i] / 3600.0 << " h  "
+                          << std::setw(5) << std::setprecision(1) << 100.0 * result.seconds[i] / span << "%\n";
+            }
+            std::cout << "  energy: " << std::setprecision(2) << result.energy_j / 3600.0 << " Wh, average "
+                      << result.energy_j / span << " W" << std::endl;
+        }
+        double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::cout << "\nEvaluated " << policies.size() << " policies in " << std::setprecision(3) << took
+                  << " s, " << std::setprecision(0) << span * policies.size() / std::max(took, 1e-9)
+                  << "x faster than real time" << std::endl;
+        return true;
+    }
 };
 
-int main(int argc, char* argv[]) {
-    std::map<std::string, std::unique_ptr<Command>> commands;
-    
-    // Create all other commands first
+void register_commands(std::map<std::string, std::unique_ptr<Command>>& commands) {
     commands["power"] = std::make_unique<PowerCommand>();
     commands["fan"] = std::make_unique<FanCommand>();
     commands["perf"] = std::make_unique<PerformanceCommand>();
@@ -494,24 +6109,19 @@ int main(int argc, char* argv[]) {
     commands["kbd"] = std::make_unique<KeyboardCommand>();
     commands["start-on-lid-open"] = std::make_unique<StartOnLidOpenCommand>();
     commands["usb-charge"] = std::make_unique<UsbChargeCommand>();
-    
-    // Create help command last since it needs reference to all commands
-    commands["help"] = std::make_unique<HelpCommand>(commands);
-
-    if (argc < 2) {
-        commands["help"]->execute({});
-        return 1;
-    }
-
-    std::string command = argv[1];
-    std::vector<std::string> args(argv + 1, argv + argc);  // Skip program name
-
-    auto it = commands.find(command);
-    if (it == commands.end()) {
-        std::cerr << "Error: Unknown command '" << command << "'" << std::endl;
-        commands["help"]->execute({});
-        return 1;
-    }
-
-    return it->second->execute(args) ? 0 : 1;
+    commands["cgroup-throttle"] = std::make_unique<CgroupThrottleCommand>();
+    commands["energy"] = std::make_unique<EnergyCommand>();
+    commands["run-when"] = std::make_unique<RunWhenCommand>();
+    commands["throttle"] = std::make_unique<ThrottleCommand>();
+    commands["power-events"] = std::make_unique<PowerEventsCommand>();
+    commands["hotkey"] = std::make_unique<HotkeyCommand>();
+    commands["push"] = std::make_unique<PushCommand>();
+    commands["resident"] = std::make_unique<ResidentCommand>();
+    commands["battery"] = std::make_unique<BatteryCommand>();
+    commands["install-udev"] = std::make_unique<InstallUdevCommand>();
+    commands["diagnose"] = std::make_unique<DiagnoseCommand>();
+    commands["top"] = std::make_unique<TopCommand>();
+    commands["dashboard"] = std::make_unique<DashboardCommand>();
+    commands["trace"] = std::make_unique<TraceCommand>();
+    commands["simulate"] = std::make_unique<SimulateCommand>();
 }
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+
+// Base class for all commands
+class Command {
+public:
+    virtual ~Command() = default;
+    virtual bool execute(const std::vector<std::string>& args) = 0;
+    virtual std::string get_help() const = 0;
+};
+
+// Adds every command except help, keyed by the name it is run as
+void register_commands(std::map<std::string, std::unique_ptr<Command>>& commands);
+
+namespace file_ops {
+    // All hardware access goes through a backend so the commands can run
+    // against real sysfs or against a simulated EC. Backend operations return
+    // 0 on success or an errno value on failure.
+    class Backend {
+    public:
+        virtual ~Backend() = default;
+        virtual int access(const std::string& path, bool write) = 0;
+        virtual int read(const std::string& path, std::string& value) = 0;
+        virtual int write(const std::string& path, const std::string& value) = 0;
+
+        // Handles keep an attribute open so sampling loops avoid an open and
+        // close per read. By default a handle only remembers the path and
+        // reads and writes go through the path based operations.
+        virtual int open_handle(const std::string& path, bool write, int& handle) {
+            if (int err = access(path, write)) return err;
+            handle = static_cast<int>(handle_paths.size());
+            handle_paths.push_back(path);
+            return 0;
+        }
+
+        virtual int read_handle(int handle, char* buf, size_t size, size_t& length) {
+            std::string value;
+            if (int err = read(handle_paths[handle], value)) return err;
+            length = std::min(value.size(), size);
+            std::memcpy(buf, value.data(), length);
+            return 0;
+        }
+
+        virtual int write_handle(int handle, const char* buf, size_t length) {
+            return write(handle_paths[handle], std::string(buf, length));
+        }
+
+        virtual void close_handle(int) {}
+
+        // File descriptor to poll for POLLPRI change notification, -1 when
+        // the backend can't notify and callers have to fall back to a timer
+        virtual int poll_fd(int) { return -1; }
+
+    protected:
+        std::vector<std::string> handle_paths;
+    };
+
+    Backend& backend();
+    void set_backend(std::unique_ptr<Backend> backend);
+    // Select the backend from SAMSUNG_CLI_BACKEND and friends, false with
+    // an error on stderr when they don't describe a usable one
+    bool configure_backend();
+
+    // An attribute kept open through a backend handle for repeated access
+    class Attribute {
+    public:
+        Attribute() = default;
+        Attribute(const Attribute&) = delete;
+        Attribute& operator=(const Attribute&) = delete;
+        Attribute(Attribute&& other) noexcept { *this = std::move(other); }
+
+        Attribute& operator=(Attribute&& other) noexcept {
+            if (this != &other) {
+                close();
+                owner = other.owner;
+                handle = other.handle;
+                attr_path = std::move(other.attr_path);
+                other.owner = nullptr;
+                other.handle = -1;
+            }
+            return *this;
+        }
+
+        ~Attribute() { close(); }
+
+        int open(const std::string& path, bool write = false) {
+            close();
+            attr_path = path;
+            int err = backend().open_handle(path, write, handle);
+            if (err != 0) {
+                handle = -1;
+                return err;
+            }
+            owner = &backend();
+            return 0;
+        }
+
+        void close() {
+            if (owner != nullptr) owner->close_handle(handle);
+            owner = nullptr;
+            handle = -1;
+        }
+
+        bool is_open() const { return owner != nullptr; }
+        const std::string& path() const { return attr_path; }
+        int poll_fd() const { return owner != nullptr ? owner->poll_fd(handle) : -1; }
+
+        // Raw read of the whole attribute into a caller supplied buffer
+        int read(char* buf, size_t size, size_t& length) {
+            if (owner == nullptr) return EBADF;
+            return owner->read_handle(handle, buf, size, length);
+        }
+
+        // First line of the attribute
+        int read(std::string& value) {
+            char buf[4096];
+            size_t length;
+            if (int err = read(buf, sizeof(buf), length)) return err;
+            const char* newline = static_cast<const char*>(std::memchr(buf, '\n', length));
+            value.assign(buf, newline != nullptr ? static_cast<size_t>(newline - buf) : length);
+            return 0;
+        }
+
+        // Unsigned decimal attribute, parsed without allocating
+        int read_u64(uint64_t& value) {
+            char buf[32];
+            size_t length;
+            if (int err = read(buf, sizeof(buf), length)) return err;
+            size_t i = 0;
+            value = 0;
+            while (i < length && buf[i] >= '0' && buf[i] <= '9') value = value * 10 + static_cast<uint64_t>(buf[i++] - '0');
+            return i == 0 ? EINVAL : 0;
+        }
+
+        int write(const char* buf, size_t length) {
+            if (owner == nullptr) return EBADF;
+            return owner->write_handle(handle, buf, length);
+        }
+
+        int write(const std::string& value) { return write(value.data(), value.size()); }
+
+    private:
+        Backend* owner = nullptr;
+        int handle = -1;
+        std::string attr_path;
+    };
+}
+
+// Shared with the D-Bus service; documented where they are defined
+
+namespace signals {
+    extern volatile sig_atomic_t stop_requested;
+    void install_stop_handlers();
+}
+
+namespace accounting {
+    void enter(const std::string& profile);
+    int checkpoint_timeout_ms();
+    void tick(bool at_exit = false);
+}
+
+namespace profiles {
+    int rank(const char* name, size_t length);
+    int rank(const std::string& name);
+    std::vector<std::string> ladder(const std::string& choices);
+    std::string current_path();
+    bool read_choices(std::string& choices);
+    bool apply(const std::string& mode);
+}
+
+std::string timestamp_now();
+
+// power-profiles-daemon compatible D-Bus service on the bus at 'address',
+// until stopped
+bool serve_power_profiles(const std::string& address);
+
+namespace iio {
+    // Layout of one channel in the buffer, e.g. "le:s32/32>>0"
+    struct ScanType {
+        bool big_endian = false;
+        bool is_signed = false;
+        int real_bits = 32;
+        int storage_bits = 32;
+        int shift = 0;
+    };
+
+    bool parse_scan_type(const std::string& spec, ScanType& type);
+    // One channel's value from its storage bytes in a scan
+    int64_t decode(const unsigned char* data, const ScanType& type);
+}
+
+namespace readings {
+    struct Reading {
+        const char* name;
+        file_ops::Attribute attribute;
+        // allow_recording exposed inverted as block_recording
+        bool invert = false;
+    };
+
+    // Every numeric reading the commands cover, plus battery and AC state,
+    // opened once for sampling loops. Attributes this machine lacks are left out.
+    std::vector<Reading> open_all();
+}
+
+// Bump allocator over one block reserved at startup. Nothing is freed on its
+// own; scratch space is given back by rewinding to a mark.
+class Arena {
+public:
+    explicit Arena(size_t capacity) : block(new char[capacity]), capacity(capacity) {}
+
+    // Room for 'count' trivially constructible T's, nullptr when full
+    template <typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_default_constructible<T>::value, "arena memory is not constructed");
+        size_t start = (used + alignof(T) - 1) / alignof(T) * alignof(T);
+        if (start + count * sizeof(T) > capacity) return nullptr;
+        used = start + count * sizeof(T);
+        return reinterpret_cast<T*>(block.get() + start);
+    }
+
+    size_t mark() const { return used; }
+    void rewind(size_t to) { used = to; }
+    size_t size() const { return capacity; }
+
+private:
+    std::unique_ptr<char[]> block;
+    size_t capacity;
+    size_t used = 0;
+};
+
+// Samples every reading with a fixed footprint. Attribute values, the sample
+// ring and the formatted output live in one arena sized by open, so a pass
+// makes no heap allocations and memory can't grow or fragment over weeks of
+// uptime.
+class ResidentMonitor {
+public:
+    // Open the readings and size the arena for a ring of 'samples'; false
+    // with an error on stderr when nothing can be read
+    bool open(size_t samples);
+
+    // Sample into the ring and format each reading's current value and the
+    // ring's average, minimum and maximum as textfile metrics into output().
+    // Returns the output's length.
+    size_t pass();
+
+    const char* output() const { return out; }
+    size_t readings() const { return count; }
+    size_t arena_size() const { return arena ? arena->size() : 0; }
+
+private:
+    static const size_t VALUE_SIZE = 64;
+    // Per reading: current, average, minimum and maximum lines
+    static const size_t OUTPUT_PER_READING = 4 * 160;
+
+    std::vector<readings::Reading> sources;
+    file_ops::Attribute profile;
+    std::unique_ptr<Arena> arena;
+    size_t count = 0, ring_size = 0, output_size = 0;
+    size_t head = 0, filled = 0;
+    char* values = nullptr;
+    int64_t* ring = nullptr;
+    char* out = nullptr;
+};
@@ -0,0 +1,66 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "samsung-cli.h"
+#include "test.h"
+
+// Every C++ heap allocation in this process is counted, so the resident
+// monitor's steady state can be checked to make none. The C library's own
+// allocations aren't seen.
+namespace allocations {
+    std::atomic<uint64_t> count{0};
+}
+
+void* operator new(std::size_t size) {
+    allocations::count.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size == 0 ? 1 : size)) return block;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    allocations::count.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete[](void* block) noexcept { std::free(block); }
+void operator delete(void* block, std::size_t) noexcept { std::free(block); }
+void operator delete[](void* block, std::size_t) noexcept { std::free(block); }
+
+uint64_t allocated() { return allocations::count.load(std::memory_order_relaxed); }
+
+// A day of 5 s samples through a one hour ring, so the ring wraps many times
+void resident_steady_state_does_not_allocate() {
+    setenv("SAMSUNG_CLI_BACKEND", "sim", 1);
+    setenv("SAMSUNG_CLI_SIM", "seed=1,clock=virtual", 1);
+    CHECK(file_ops::configure_backend());
+
+    uint64_t before = allocated();
+    ResidentMonitor monitor;
+    CHECK(monitor.open(720));
+    CHECK(monitor.readings() > 1);
+    // Opening allocates, which shows the counter sees the library's calls
+    CHECK(allocated() > before);
+
+    // The first pass may warm up lazily allocated library state
+    CHECK(monitor.pass() > 0);
+    uint64_t warm = allocated();
+    size_t length = 0;
+    for (int pass = 0; pass < 24 * 720; ++pass) length = monitor.pass();
+    CHECK(allocated() == warm);
+
+    std::string output(monitor.output(), length);
+    CHECK(output.find("samsung_cli_fan_speed_rpm ") != std::string::npos);
+    CHECK(output.find("samsung_cli_profile_rank_max ") != std::string::npos);
+}
+
+int main() {
+    resident_steady_state_does_not_allocate();
+    return test::result();
+}
@@ -0,0 +1,322 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <elf.h>
+
+#include "test.h"
+
+// Counts the file system work each command does against a fake sysfs tree,
+// under ptrace, and checks it against a budget so that a regression in
+// feature detection, file_ops or startup shows up as a failure. Only calls
+// on paths inside the fake tree, or on descriptors opened there, count;
+// the dynamic loader, locale setup and terminal output don't.
+//
+// Takes the CLI path, then optionally a command to measure without a budget.
+
+struct Counts {
+    int opens = 0;  // also access and stat calls, every path lookup
+    int reads = 0;
+    int writes = 0;
+    int dirreads = 0;
+};
+
+struct Check {
+    const char* command;
+    Counts budget;
+    // Run first on the same tree, without counting, to warm its caches
+    const char* warm_up = nullptr;
+};
+
+// Every command runs on a tree of its own, so none benefits from what an
+// earlier one cached in the state directory unless it names a warm-up
+const Check BUDGETS[] = {
+    // Lists the ACPI devices, hwmon and hwmon3, times three reads of each
+    // source and caches the choice for later commands
+    {"fan sources", {5, 6, 0, 6}},
+    // The same discovery, then the read
+    {"fan read", {6, 7, 0, 6}},
+    // With the choice cached, only the chosen source is read
+    {"fan read", {1, 1, 0, 0}, "fan sources"},
+    {"power read", {1, 1, 0, 0}},
+    {"power set 80", {2, 0, 1, 0}},
+    // Feature detection: one listing each of the udev links, the firmware
+    // attributes, the driver and the platform-profile class, and a check
+    // for the legacy platform_profile
+    {"perf read", {6, 1, 0, 4}},
+    {"perf list", {6, 1, 0, 4}},
+    {"perf set balanced", {8, 1, 1, 4}},
+    {"kbd read", {1, 1, 0, 0}},
+    // max_brightness, then the brightness
+    {"kbd set 2", {3, 1, 1, 0}},
+    {"record read", {6, 1, 0, 4}},
+    {"start-on-lid-open read", {6, 1, 0, 4}},
+    {"usb-charge read", {6, 1, 0, 4}},
+    {"usb-charge set 1", {7, 0, 1, 4}},
+};
+
+std::string cli;
+
+// The attributes of a Galaxy Book2 Pro running the upstream driver
+bool populate(const std::string& root) {
+    const std::string fan = "/sys/bus/acpi/devices/PNP0C0B:00";
+    const std::string attributes = "/sys/class/firmware-attributes/samsung-galaxybook/attributes";
+    const std::pair<std::string, const char*> files[] = {
+        {"/sys/class/power_supply/BAT1/charge_control_end_threshold", "80"},
+        {fan + "/fan_speed_rpm", "2800"},
+        {"/sys/class/hwmon/hwmon3/fan1_input", "2800"},
+        {"/sys/firmware/acpi/platform_profile", "balanced"},
+        {"/sys/firmware/acpi/platform_profile_choices", "low-power quiet balanced performance"},
+        {"/sys/class/platform-profile/platform-profile-0/name", "samsung-galaxybook"},
+        {"/sys/class/platform-profile/platform-profile-0/profile", "balanced"},
+        {"/sys/class/platform-profile/platform-profile-0/choices", "low-power quiet balanced performance"},
+        {"/sys/class/power_supply/BAT1/power_now", "9000000"},
+        {"/sys/class/power_supply/BAT1/energy_now", "40000000"},
+        {"/sys/class/power_supply/BAT1/status", "Discharging"},
+        {"/sys/class/power_supply/BAT1/capacity", "75"},
+        {"/sys/class/power_supply/ADP1/type", "Mains"},
+        {"/sys/class/power_supply/ADP1/online", "0"},
+        {"/sys/class/leds/samsung-galaxybook::kbd_backlight/brightness", "1"},
+        {"/sys/class/leds/samsung-galaxybook::kbd_backlight/max_brightness", "3"},
+        {attributes + "/block_recording/current_value", "0"},
+        {attributes + "/power_on_lid_open/current_value", "0"},
+        {attributes + "/usb_charging/current_value", "1"},
+    };
+    for (const auto& [path, value] : files) {
+        if (!test::write_file(root + path, std::string(value) + "\n")) {
+            std::cerr << "Error: Could not create " << root + path << std::endl;
+            return false;
+        }
+    }
+    // The ACPI fan's hwmon device
+    if (symlink((root + fan).c_str(), (root + "/sys/class/hwmon/hwmon3/device").c_str()) != 0) {
+        std::cerr << "Error: Could not link the hwmon device: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return mkdir((root + "/state").c_str(), 0755) == 0;
+}
+
+struct Registers {
+    long number;
+    unsigned long args[4];
+    long result;
+};
+
+bool registers(pid_t pid, Registers& regs) {
+#if defined(__x86_64__)
+    struct user_regs_struct raw;
+    if (ptrace(PTRACE_GETREGS, pid, nullptr, &raw) != 0) return false;
+    regs = {static_cast<long>(raw.orig_rax), {raw.rdi, raw.rsi, raw.rdx, raw.r10}, static_cast<long>(raw.rax)};
+#else
+    struct user_pt_regs raw;
+    struct iovec vec = {&raw, sizeof(raw)};
+    if (ptrace(PTRACE_GETREGSET, pid, reinterpret_cast<void*>(NT_PRSTATUS), &vec) != 0) return false;
+    regs = {static_cast<long>(raw.regs[8]), {raw.regs[0], raw.regs[1], raw.regs[2], raw.regs[3]},
+            static_cast<long>(raw.regs[0])};
+#endif
+    return true;
+}
+
+// NUL terminated string from the tracee, read a chunk at a time since a
+// chunk can't cross into an unmapped page
+std::string peek_string(pid_t pid, unsigned long address) {
+    std::string value;
+    char chunk[64];
+    while (value.size() < 4096) {
+        size_t room = 64 - (address + value.size()) % 64;
+        struct iovec local = {chunk, room};
+        struct iovec remote = {reinterpret_cast<void*>(address + value.size()), room};
+        ssize_t n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+        if (n <= 0) break;
+        size_t length = strnlen(chunk, static_cast<size_t>(n));
+        value.append(chunk, length);
+        if (length < static_cast<size_t>(n)) break;
+    }
+    return value;
+}
+
+// Which argument holds the path for the lookups we count, -1 otherwise
+int path_argument(long number) {
+    switch (number) {
+    case SYS_openat:
+    case SYS_faccessat:
+    case SYS_newfstatat:
+#ifdef SYS_faccessat2
+    case SYS_faccessat2:
+#endif
+#ifdef SYS_statx
+    case SYS_statx:
+#endif
+        return 1;
+#ifdef SYS_open
+    case SYS_open:
+    case SYS_access:
+    case SYS_stat:
+    case SYS_lstat:
+#endif
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+std::string join(const std::vector<std::string>& words) {
+    std::string result;
+    for (const auto& word : words) result += (result.empty() ? "" : " ") + word;
+    return result;
+}
+
+// Run the CLI with 'command' on the tree at 'root' and count its calls
+bool trace(const std::vector<std::string>& command, const std::string& root, Counts& counts) {
+    std::string state = root + "/state";
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Error: fork failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (pid == 0) {
+        setenv("SAMSUNG_CLI_ROOT", root.c_str(), 1);
+        setenv("SAMSUNG_CLI_STATE_DIR", state.c_str(), 1);
+        unsetenv("SAMSUNG_CLI_BACKEND");
+        unsetenv("SAMSUNG_CLI_TRACE");
+        int null_fd = ::open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        std::vector<char*> argv = {const_cast<char*>(cli.c_str())};
+        for (const auto& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+    std::vector<bool> tracked(1024, false);
+    bool entering = true;
+    Registers entry = {};
+    std::string entry_path;
+    int signal = 0;
+    while (ptrace(PTRACE_SYSCALL, pid, nullptr, reinterpret_cast<void*>(static_cast<long>(signal))) == 0 &&
+           waitpid(pid, &status, 0) == pid && WIFSTOPPED(status)) {
+        signal = 0;
+        if (WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+            // Pass real signals on; the SIGTRAP after execve is ours
+            if (WSTOPSIG(status) != SIGTRAP) signal = WSTOPSIG(status);
+            continue;
+        }
+        Registers regs;
+        if (!registers(pid, regs)) break;
+        if (entering) {
+            entry = regs;
+            int path_index = path_argument(regs.number);
+            entry_path = path_index >= 0 ? peek_string(pid, regs.args[path_index]) : "";
+            bool inside = path_index >= 0 && entry_path.compare(0, root.size(), root) == 0 &&
+                          entry_path.compare(0, state.size(), state) != 0;
+            if (inside) counts.opens++;
+            if (!inside) entry_path.clear();
+            size_t fd = regs.args[0];
+            bool on_tree = fd < tracked.size() && tracked[fd];
+            if (on_tree && (regs.number == SYS_read || regs.number == SYS_pread64)) counts.reads++;
+            if (on_tree && (regs.number == SYS_write || regs.number == SYS_pwrite64)) counts.writes++;
+            if (on_tree && regs.number == SYS_getdents64) counts.dirreads++;
+            if (on_tree && regs.number == SYS_close) tracked[fd] = false;
+        } else if (!entry_path.empty() && entry.number == SYS_openat && regs.result >= 0 &&
+                   static_cast<size_t>(regs.result) < tracked.size()) {
+            tracked[static_cast<size_t>(regs.result)] = true;
+        }
+        entering = !entering;
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Error: '" << join(command) << "' failed on the fake tree" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> split(const char* command) {
+    std::istringstream words(command);
+    return {std::istream_iterator<std::string>(words), std::istream_iterator<std::string>()};
+}
+
+// Trace 'command' on a freshly populated tree, after 'warm_up' if given
+bool measure(const std::vector<std::string>& command, const char* warm_up, Counts& counts) {
+    std::string root = test::make_temp_dir();
+    if (root.empty()) {
+        std::cerr << "Error: Could not create a temporary directory: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    Counts ignored;
+    bool ok = populate(root) && (warm_up == nullptr || trace(split(warm_up), root, ignored)) &&
+              trace(command, root, counts);
+    test::remove_tree(root);
+    return ok;
+}
+
+void print_header() {
+    std::cout << std::left << std::setw(26) << "Command" << std::right << std::setw(7) << "Opens" << std::setw(7)
+              << "Reads" << std::setw(8) << "Writes" << std::setw(10) << "Dirreads" << std::endl;
+}
+
+bool print_row(const std::string& command, const Counts& counts, const Counts* budget) {
+    auto cell = [&](int value, int limit, int width) {
+        std::string text = std::to_string(value);
+        if (budget != nullptr) text += "/" + std::to_string(limit);
+        std::cout << std::setw(width) << text;
+        return budget == nullptr || value <= limit;
+    };
+    std::cout << std::left << std::setw(26) << command << std::right;
+    Counts limits = budget != nullptr ? *budget : Counts();
+    bool ok = cell(counts.opens, limits.opens, 7);
+    ok = cell(counts.reads, limits.reads, 7) && ok;
+    ok = cell(counts.writes, limits.writes, 8) && ok;
+    ok = cell(counts.dirreads, limits.dirreads, 10) && ok;
+    std::cout << (ok ? "" : "  over budget") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+#if defined(__x86_64__) || defined(__aarch64__)
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: budget_test <samsung-cli> [command...]\n");
+        return 1;
+    }
+    cli = argv[1];
+    print_header();
+    if (argc > 2) {
+        // Measure one command without a budget
+        Counts counts;
+        std::vector<std::string> command(argv + 2, argv + argc);
+        CHECK(measure(command, nullptr, counts));
+        print_row(join(command), counts, nullptr);
+        return test::result();
+    }
+    for (const auto& check : BUDGETS) {
+        Counts counts;
+        CHECK(measure(split(check.command), check.warm_up, counts));
+        std::string label = check.command;
+        if (check.warm_up != nullptr) label += " (warm)";
+        CHECK(print_row(label, counts, &check.budget));
+    }
+    return test::result();
+#else
+    (void)argc;
+    (void)argv;
+    std::fprintf(stderr, "budget_test needs ptrace register access for x86_64 or aarch64, skipping\n");
+    return test::SKIPPED;
+#endif
+}
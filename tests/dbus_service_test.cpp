@@ -0,0 +1,197 @@
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <poll.h>
+
+#include "dbus.h"
+#include "test.h"
+
+// 'perf serve' on a private dbus-daemon, switching the profile of a fake
+// sysfs tree. Takes the CLI and dbus-daemon paths as arguments.
+
+const std::string NAME = "net.hadess.PowerProfiles";
+const std::string PATH = "/net/hadess/PowerProfiles";
+const std::string PROPERTIES = "org.freedesktop.DBus.Properties";
+const std::string PROFILE = "/sys/firmware/acpi/platform_profile";
+
+std::string root;
+
+std::string platform_profile() { return test::read_file(root + PROFILE); }
+
+// Method call on the service, waiting up to five seconds for the reply or
+// error to it
+bool call(dbus::Connection& bus, const std::string& interface, const std::string& member,
+          const std::string& signature, const std::string& body, dbus::Message& reply) {
+    dbus::Message message;
+    message.type = dbus::METHOD_CALL;
+    message.destination = NAME;
+    message.path = PATH;
+    message.interface = interface;
+    message.member = member;
+    message.signature = signature;
+    uint32_t serial = bus.send(message, body);
+    if (serial == 0) return false;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (std::chrono::steady_clock::now() < deadline) {
+        while (bus.next(reply)) {
+            if ((reply.type == dbus::METHOD_RETURN || reply.type == dbus::ERROR) && reply.reply_serial == serial) {
+                return true;
+            }
+        }
+        pollfd pfd = {bus.fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 100) > 0 && !bus.fill()) return false;
+    }
+    return false;
+}
+
+std::string active_profile(dbus::Connection& bus) {
+    std::string body;
+    dbus::Writer writer(body);
+    writer.string(NAME);
+    writer.string("ActiveProfile");
+    dbus::Message reply;
+    if (!call(bus, PROPERTIES, "Get", "ss", body, reply) || reply.type != dbus::METHOD_RETURN) return "";
+    dbus::Reader reader = reply.body();
+    if (reader.signature() != "s") return "";
+    return reader.string();
+}
+
+// Error name of a failed Set, empty when it succeeded
+std::string set_active_profile(dbus::Connection& bus, const std::string& profile) {
+    std::string body;
+    dbus::Writer writer(body);
+    writer.string(NAME);
+    writer.string("ActiveProfile");
+    writer.signature("s");
+    writer.string(profile);
+    dbus::Message reply;
+    if (!call(bus, PROPERTIES, "Set", "ssv", body, reply)) return "no reply";
+    return reply.type == dbus::ERROR ? reply.error_name : "";
+}
+
+// Cookie of a new hold, 0 when refused
+uint32_t hold(dbus::Connection& bus, const std::string& profile) {
+    std::string body;
+    dbus::Writer writer(body);
+    writer.string(profile);
+    writer.string("testing");
+    writer.string("dbus_service_test");
+    dbus::Message reply;
+    if (!call(bus, NAME, "HoldProfile", "sss", body, reply) || reply.type != dbus::METHOD_RETURN) return 0;
+    return reply.body().u32();
+}
+
+bool release(dbus::Connection& bus, uint32_t cookie) {
+    std::string body;
+    dbus::Writer(body).u32(cookie);
+    dbus::Message reply;
+    return call(bus, NAME, "ReleaseProfile", "u", body, reply) && reply.type == dbus::METHOD_RETURN;
+}
+
+// Poll until the service owns its name, it has to start up first
+bool wait_for_service(dbus::Connection& bus) {
+    std::string body;
+    dbus::Writer(body).string(NAME);
+    for (int i = 0; i < 500; ++i) {
+        dbus::Message reply;
+        if (!bus.call("NameHasOwner", "s", body, reply)) return false;
+        if (reply.body().u32() != 0) return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+void profile_switching(dbus::Connection& bus, const std::string& address) {
+    CHECK(active_profile(bus) == "balanced");
+
+    CHECK(set_active_profile(bus, "performance").empty());
+    CHECK(platform_profile() == "performance");
+    CHECK(active_profile(bus) == "performance");
+    CHECK(set_active_profile(bus, "turbo") == "org.freedesktop.DBus.Error.InvalidArgs");
+    CHECK(platform_profile() == "performance");
+
+    // A hold wins over the chosen profile until it is released
+    uint32_t cookie = hold(bus, "power-saver");
+    CHECK(cookie != 0);
+    CHECK(platform_profile() == "low-power");
+    CHECK(active_profile(bus) == "power-saver");
+    CHECK(hold(bus, "balanced") == 0);
+    CHECK(release(bus, cookie));
+    CHECK(!release(bus, cookie));
+    CHECK(platform_profile() == "performance");
+
+    // and when its holder leaves the bus without releasing it
+    {
+        dbus::Connection other;
+        CHECK(other.open(address));
+        CHECK(hold(other, "power-saver") != 0);
+        CHECK(platform_profile() == "low-power");
+    }
+    for (int i = 0; i < 500 && platform_profile() != "performance"; ++i) usleep(10000);
+    CHECK(platform_profile() == "performance");
+    CHECK(active_profile(bus) == "performance");
+}
+
+void introspection_and_errors(dbus::Connection& bus) {
+    dbus::Message reply;
+    CHECK(call(bus, "org.freedesktop.DBus.Introspectable", "Introspect", "", "", reply));
+    CHECK(reply.type == dbus::METHOD_RETURN && reply.body().string().find("HoldProfile") != std::string::npos);
+    CHECK(call(bus, NAME, "Frobnicate", "", "", reply));
+    CHECK(reply.type == dbus::ERROR && reply.error_name == "org.freedesktop.DBus.Error.UnknownMethod");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::fprintf(stderr, "Usage: dbus_service_test <samsung-cli> <dbus-daemon>\n");
+        return 1;
+    }
+    root = test::make_temp_dir();
+    CHECK(!root.empty());
+    CHECK(test::write_file(root + PROFILE, "balanced\n"));
+    CHECK(test::write_file(root + PROFILE + "_choices", "low-power quiet balanced performance\n"));
+
+    // The daemon prints its address on the pipe once it listens
+    int address_pipe[2];
+    CHECK(pipe(address_pipe) == 0);
+    pid_t daemon = test::spawn({argv[2], "--session", "--nofork", "--nopidfile", "--print-address"}, {},
+                               address_pipe[1]);
+    close(address_pipe[1]);
+    std::string address;
+    char c;
+    while (read(address_pipe[0], &c, 1) == 1 && c != '\n') address += c;
+    close(address_pipe[0]);
+    if (address.empty()) {
+        std::fprintf(stderr, "dbus-daemon didn't start, skipping\n");
+        kill(daemon, SIGTERM);
+        waitpid(daemon, nullptr, 0);
+        test::remove_tree(root);
+        return test::SKIPPED;
+    }
+
+    pid_t service = test::spawn({argv[1], "perf", "serve", "--address", address},
+                                {"SAMSUNG_CLI_BACKEND=sysfs", "SAMSUNG_CLI_ROOT=" + root,
+                                 "SAMSUNG_CLI_STATE_DIR=" + root + "/state"});
+    dbus::Connection bus;
+    CHECK(bus.open(address));
+    bool serving = wait_for_service(bus);
+    CHECK(serving);
+    if (serving) {
+        profile_switching(bus, address);
+        introspection_and_errors(bus);
+    }
+
+    // Stopping is clean and saves the residency
+    kill(service, SIGTERM);
+    int status = 0;
+    CHECK(test::wait_exit(service, status, 5000));
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(test::read_file(root + "/state/profile-stats").find("performance") != std::string::npos);
+
+    kill(daemon, SIGTERM);
+    waitpid(daemon, nullptr, 0);
+    test::remove_tree(root);
+    return test::result();
+}
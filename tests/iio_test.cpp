@@ -0,0 +1,49 @@
+#include "samsung-cli.h"
+#include "test.h"
+
+// Channel layouts as the kernel writes them to scan_elements/*_type
+void scan_types_parse() {
+    iio::ScanType type;
+    CHECK(iio::parse_scan_type("le:s32/32>>0", type));
+    CHECK(!type.big_endian && type.is_signed && type.real_bits == 32 && type.storage_bits == 32 && type.shift == 0);
+    CHECK(iio::parse_scan_type("be:u12/16>>4", type));
+    CHECK(type.big_endian && !type.is_signed && type.real_bits == 12 && type.storage_bits == 16 && type.shift == 4);
+
+    CHECK(!iio::parse_scan_type("le:x32/32>>0", type));
+    CHECK(!iio::parse_scan_type("le:s32/24>>0", type));
+    CHECK(!iio::parse_scan_type("le:s65/64>>0", type));
+    CHECK(!iio::parse_scan_type("le:s32/32", type));
+    CHECK(!iio::parse_scan_type("", type));
+}
+
+void values_decode() {
+    iio::ScanType type;
+    CHECK(iio::parse_scan_type("le:u32/32>>0", type));
+    const unsigned char lux[] = {0x10, 0x27, 0x00, 0x00};
+    CHECK(iio::decode(lux, type) == 10000);
+
+    CHECK(iio::parse_scan_type("le:s32/32>>0", type));
+    const unsigned char minus_one[] = {0xff, 0xff, 0xff, 0xff};
+    CHECK(iio::decode(minus_one, type) == -1);
+
+    // Shifted and masked, in either byte order
+    CHECK(iio::parse_scan_type("be:u12/16>>4", type));
+    const unsigned char big[] = {0xab, 0xcd};
+    CHECK(iio::decode(big, type) == 0xabc);
+    CHECK(iio::parse_scan_type("le:u12/16>>4", type));
+    const unsigned char little[] = {0xcd, 0xab};
+    CHECK(iio::decode(little, type) == 0xabc);
+
+    // Sign extended from the real bits, not the storage
+    CHECK(iio::parse_scan_type("le:s12/16>>4", type));
+    const unsigned char negative[] = {0x00, 0x80};
+    CHECK(iio::decode(negative, type) == -2048);
+    const unsigned char positive[] = {0xf0, 0x7f};
+    CHECK(iio::decode(positive, type) == 2047);
+}
+
+int main() {
+    scan_types_parse();
+    values_decode();
+    return test::result();
+}
@@ -0,0 +1,221 @@
+#include <csignal>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "test.h"
+
+// 'push' on the simulator against listeners bound here. Takes the CLI path
+// as its argument.
+
+// Datagrams must fit an Ethernet MTU after the IP and UDP headers
+const size_t MAX_DATAGRAM = 1432;
+
+std::string cli;
+
+struct Run {
+    int status = -1;
+    std::string output;
+    std::vector<std::string> datagrams;
+};
+
+// Run push with 'args', collecting what arrives on 'listener' meanwhile
+Run push(const std::vector<std::string>& args, int listener) {
+    std::vector<std::string> argv = {cli, "push"};
+    argv.insert(argv.end(), args.begin(), args.end());
+    int output_pipe[2];
+    Run run;
+    if (pipe(output_pipe) != 0) return run;
+    pid_t pid = test::spawn(argv, {"SAMSUNG_CLI_BACKEND=sim", "SAMSUNG_CLI_SIM=seed=1"}, output_pipe[1]);
+    close(output_pipe[1]);
+
+    bool exited = false;
+    for (int waited = 0; !exited && waited < 1000; ++waited) {
+        exited = waitpid(pid, &run.status, WNOHANG) == pid;
+        pollfd pfd = {listener, POLLIN, 0};
+        while (listener >= 0 && poll(&pfd, 1, exited ? 0 : 10) > 0) {
+            char buf[65536];
+            ssize_t n = recv(listener, buf, sizeof(buf), 0);
+            if (n < 0) break;
+            run.datagrams.emplace_back(buf, static_cast<size_t>(n));
+        }
+        if (listener < 0 && !exited) usleep(10000);
+    }
+    if (!exited) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &run.status, 0);
+    }
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(output_pipe[0], buf, sizeof(buf))) > 0) run.output.append(buf, static_cast<size_t>(n));
+    close(output_pipe[0]);
+    return run;
+}
+
+bool starts_with(const std::string& text, const std::string& start) { return text.compare(0, start.size(), start) == 0; }
+
+bool succeeded(const Run& run) { return WIFEXITED(run.status) && WEXITSTATUS(run.status) == 0; }
+
+std::vector<std::string> lines_of(const std::string& text) {
+    std::vector<std::string> lines;
+    size_t start = 0;
+    for (size_t end; (end = text.find('\n', start)) != std::string::npos; start = end + 1) {
+        lines.push_back(text.substr(start, end - start));
+    }
+    return lines;
+}
+
+// Every datagram fits and holds whole lines only
+bool well_framed(const Run& run) {
+    for (const auto& datagram : run.datagrams) {
+        if (datagram.empty() || datagram.size() > MAX_DATAGRAM || datagram.back() != '\n') return false;
+    }
+    return true;
+}
+
+std::vector<std::string> all_lines(const Run& run) {
+    std::vector<std::string> lines;
+    for (const auto& datagram : run.datagrams) {
+        for (const auto& line : lines_of(datagram)) lines.push_back(line);
+    }
+    return lines;
+}
+
+// <prefix>.<name>:<digits>|g
+bool is_statsd_gauge(const std::string& line, const std::string& prefix) {
+    size_t colon = line.find(':');
+    if (!starts_with(line, prefix + ".") || colon == std::string::npos) return false;
+    if (line.size() < colon + 4 || line.compare(line.size() - 2, 2, "|g") != 0) return false;
+    std::string value = line.substr(colon + 1, line.size() - colon - 3);
+    return value.find_first_not_of("-0123456789") == std::string::npos;
+}
+
+int bind_udp(int& port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    // Room for a whole run in the receive queue
+    int size = 1 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&address), &length) != 0) {
+        return -1;
+    }
+    port = ntohs(address.sin_port);
+    return fd;
+}
+
+void statsd_lines_arrive_in_batches(int listener, const std::string& target) {
+    Run run = push({"--to", target, "--prefix", "test", "--interval", "10", "--batch", "3", "--count", "6"}, listener);
+    CHECK(succeeded(run));
+    CHECK(run.datagrams.size() == 2);
+    CHECK(well_framed(run));
+    std::vector<std::string> lines = all_lines(run);
+    CHECK(!lines.empty() && lines.size() % 6 == 0);
+    bool fan = false, rank = false;
+    for (const auto& line : lines) {
+        CHECK(is_statsd_gauge(line, "test"));
+        fan = fan || starts_with(line, "test.fan_speed_rpm:");
+        rank = rank || starts_with(line, "test.profile_rank:");
+    }
+    CHECK(fan);
+    CHECK(rank);
+    CHECK(run.output.find("Sent 2 datagrams, dropped 0") != std::string::npos);
+}
+
+void influx_sends_a_line_per_sample(int listener, const std::string& target) {
+    Run run = push({"--to", target, "--format", "influx", "--interval", "10", "--batch", "4", "--count", "4"},
+                   listener);
+    CHECK(succeeded(run));
+    CHECK(run.datagrams.size() == 1);
+    CHECK(well_framed(run));
+    std::vector<std::string> lines = all_lines(run);
+    CHECK(lines.size() == 4);
+    for (const auto& line : lines) {
+        // measurement,host=<name> field=<n>i,...,profile="<mode>",profile_rank=<n>i <ns>
+        size_t fields = line.find(' ');
+        size_t timestamp = line.rfind(' ');
+        CHECK(starts_with(line, "samsung,host="));
+        CHECK(fields != std::string::npos && timestamp > fields);
+        CHECK(line.find("fan_speed_rpm=") != std::string::npos);
+        CHECK(line.find(",profile=\"balanced\",profile_rank=") != std::string::npos);
+        CHECK(line[timestamp - 1] == 'i');
+        CHECK(line.size() - timestamp - 1 == 19);
+    }
+}
+
+// A batch larger than one datagram is split between lines
+void large_batches_are_split(int listener, const std::string& target) {
+    Run run = push({"--to", target, "--interval", "10", "--batch", "40", "--count", "40"}, listener);
+    CHECK(succeeded(run));
+    CHECK(run.datagrams.size() > 1);
+    CHECK(well_framed(run));
+    std::vector<std::string> lines = all_lines(run);
+    CHECK(!lines.empty() && lines.size() % 40 == 0);
+    for (const auto& line : lines) CHECK(is_statsd_gauge(line, "samsung"));
+}
+
+// Lines that can't fit a datagram are dropped whole
+void oversized_lines_are_dropped(int listener, const std::string& target) {
+    Run run = push({"--to", target, "--prefix", std::string(MAX_DATAGRAM, 'x'), "--interval", "10", "--count", "2"},
+                   listener);
+    CHECK(succeeded(run));
+    CHECK(run.datagrams.empty());
+    CHECK(run.output.find("Sent 0 datagrams, dropped 0") != std::string::npos);
+}
+
+// Nobody listening costs the datagrams, not the loop
+void missing_listener_drops_datagrams() {
+    int port;
+    int fd = bind_udp(port);
+    CHECK(fd >= 0);
+    close(fd);
+    Run run = push({"--to", "udp:127.0.0.1:" + std::to_string(port), "--interval", "10", "--batch", "1", "--count",
+                    "5"},
+                   -1);
+    CHECK(succeeded(run));
+    CHECK(run.output.find("dropped 0") == std::string::npos);
+}
+
+void unix_sockets_work_too(const std::string& dir) {
+    std::string path = dir + "/listener.sock";
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+    CHECK(fd >= 0 && bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0);
+    statsd_lines_arrive_in_batches(fd, "unix:" + path);
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::fprintf(stderr, "Usage: push_test <samsung-cli>\n");
+        return 1;
+    }
+    cli = argv[1];
+
+    int port;
+    int listener = bind_udp(port);
+    CHECK(listener >= 0);
+    const std::string target = "udp:127.0.0.1:" + std::to_string(port);
+    statsd_lines_arrive_in_batches(listener, target);
+    influx_sends_a_line_per_sample(listener, target);
+    large_batches_are_split(listener, target);
+    oversized_lines_are_dropped(listener, target);
+    close(listener);
+    missing_listener_drops_datagrams();
+
+    std::string dir = test::make_temp_dir();
+    CHECK(!dir.empty());
+    unix_sockets_work_too(dir);
+    test::remove_tree(dir);
+    return test::result();
+}
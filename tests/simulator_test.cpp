@@ -0,0 +1,139 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "samsung-cli.h"
+#include "test.h"
+
+// The simulator matches attributes by file name, any directory will do
+const std::string PROFILE = "/sys/firmware/acpi/platform_profile";
+const std::string FAN = "/sys/bus/acpi/devices/PNP0C0B:00/fan_speed_rpm";
+const std::string CAPACITY = "/sys/class/power_supply/BAT1/capacity";
+
+// Select the simulator the way the CLI does, through the environment
+bool use_simulator(const char* spec) {
+    setenv("SAMSUNG_CLI_BACKEND", "sim", 1);
+    setenv("SAMSUNG_CLI_SIM", spec, 1);
+    unsetenv("SAMSUNG_CLI_TRACE");
+    return file_ops::configure_backend();
+}
+
+// Outcome of 'count' reads of 'path', one errno per read
+std::vector<int> read_errors(const std::string& path, int count) {
+    std::vector<int> errors;
+    std::string value;
+    for (int i = 0; i < count; ++i) errors.push_back(file_ops::backend().read(path, value));
+    return errors;
+}
+
+int fan_rpm() {
+    std::string value;
+    if (file_ops::backend().read(FAN, value) != 0) return -1;
+    return std::atoi(value.c_str());
+}
+
+void injected_faults_follow_their_rates() {
+    CHECK(use_simulator("seed=7,ebusy=0.2,eio=0.05"));
+    const int reads = 20000;
+    int busy = 0, io = 0, other = 0;
+    for (int err : read_errors(PROFILE, reads)) {
+        if (err == EBUSY) {
+            busy++;
+        } else if (err == EIO) {
+            io++;
+        } else if (err != 0) {
+            other++;
+        }
+    }
+    // Five standard deviations of the binomial either side
+    CHECK(std::abs(busy - 4000) < 5 * std::sqrt(reads * 0.2 * 0.8));
+    CHECK(std::abs(io - 1000) < 5 * std::sqrt(reads * 0.05 * 0.95));
+    CHECK(other == 0);
+
+    // Battery attributes don't go through ACPI methods and never fail
+    int failed = 0;
+    for (int err : read_errors(CAPACITY, 1000)) failed += err != 0;
+    CHECK(failed == 0);
+
+    // A failed write leaves the attribute as it was
+    for (int i = 0; i < 200; ++i) {
+        std::string before, after;
+        while (file_ops::backend().read(PROFILE, before) != 0) {}
+        const std::string mode = before == "quiet" ? "performance" : "quiet";
+        int err = file_ops::backend().write(PROFILE, mode);
+        CHECK(err == 0 || err == EBUSY || err == EIO);
+        while (file_ops::backend().read(PROFILE, after) != 0) {}
+        CHECK(after == (err == 0 ? mode : before));
+    }
+}
+
+void faults_are_off_by_default() {
+    CHECK(use_simulator(""));
+    int failed = 0;
+    for (int err : read_errors(PROFILE, 1000)) failed += err != 0;
+    CHECK(failed == 0);
+}
+
+void seed_makes_runs_repeatable() {
+    CHECK(use_simulator("seed=42,ebusy=0.3,eio=0.1"));
+    std::vector<int> first = read_errors(PROFILE, 500);
+    CHECK(use_simulator("seed=42,ebusy=0.3,eio=0.1"));
+    CHECK(read_errors(PROFILE, 500) == first);
+    CHECK(use_simulator("seed=43,ebusy=0.3,eio=0.1"));
+    CHECK(read_errors(PROFILE, 500) != first);
+}
+
+// Each fan read costs 100 ms of virtual time, so the n-th read after a
+// profile change sees the first-order lag at n * 0.1 s
+void fan_lags_behind_the_profile() {
+    CHECK(use_simulator("clock=virtual,fan_latency=fixed:100,fan_tau=4"));
+    // Jitter is normal with a 15 rpm deviation
+    const double tolerance = 5 * 15.0;
+    CHECK(std::abs(fan_rpm() - 2800) < tolerance);
+
+    CHECK(file_ops::backend().write(PROFILE, "performance") == 0);
+    int first = fan_rpm();
+    CHECK(first < 3000);
+    int worst = 0;
+    for (int n = 2; n <= 600; ++n) {
+        double expected = 4300 - 1500 * std::exp(-n * 0.1 / 4);
+        worst = std::max(worst, static_cast<int>(std::abs(fan_rpm() - expected)));
+    }
+    CHECK(worst < tolerance);
+
+    // Spinning down starts from wherever the fan is; after one time
+    // constant it has covered 63% of the way
+    CHECK(file_ops::backend().write(PROFILE, "low-power") == 0);
+    int rpm = 0;
+    for (int n = 1; n <= 40; ++n) rpm = fan_rpm();
+    CHECK(std::abs(rpm - 4300 * std::exp(-1.0)) < tolerance);
+
+    // Handles see the same fan as path reads
+    int handle;
+    CHECK(file_ops::backend().open_handle(FAN, false, handle) == 0);
+    char buf[32];
+    size_t length = 0;
+    CHECK(file_ops::backend().read_handle(handle, buf, sizeof(buf) - 1, length) == 0);
+    buf[length] = '\0';
+    CHECK(std::abs(std::atoi(buf) - 4300 * std::exp(-41 * 0.1 / 4)) < tolerance);
+    file_ops::backend().close_handle(handle);
+}
+
+void invalid_options_are_rejected() {
+    CHECK(!use_simulator("ebusy=1.5"));
+    CHECK(!use_simulator("fan_tau=0"));
+    CHECK(!use_simulator("latency=uniform:5:1"));
+    CHECK(!use_simulator("profile=turbo"));
+    CHECK(!use_simulator("seed"));
+}
+
+int main() {
+    injected_faults_follow_their_rates();
+    faults_are_off_by_default();
+    seed_makes_runs_repeatable();
+    fan_lags_behind_the_profile();
+    invalid_options_are_rejected();
+    return test::result();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Just enough to write the tests as plain executables: a failing CHECK is
+// reported with its location and the test carries on, main returns result()
+namespace test {
+    inline int failures = 0;
+
+    // Exit status ctest reports as skipped, for tests missing a tool
+    const int SKIPPED = 77;
+
+    inline int result() {
+        if (failures > 0) std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return failures > 0 ? 1 : 0;
+    }
+
+    // A new empty directory, for remove_tree to delete afterwards
+    inline std::string make_temp_dir() {
+        const char* tmp = std::getenv("TMPDIR");
+        std::string path = std::string(tmp != nullptr ? tmp : "/tmp") + "/samsung-cli-test.XXXXXX";
+        return mkdtemp(&path[0]) != nullptr ? path : "";
+    }
+
+    // Delete a directory tree without following symlinks out of it
+    inline void remove_tree(const std::string& path) {
+        nftw(path.c_str(), [](const char* entry, const struct stat*, int, struct FTW*) { return ::remove(entry); },
+             16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // Write a file, creating the directories leading to it
+    inline bool write_file(const std::string& path, const std::string& content) {
+        for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            mkdir(path.substr(0, slash).c_str(), 0755);
+        }
+        std::ofstream file(path);
+        file << content;
+        return static_cast<bool>(file.flush());
+    }
+
+    // Whole file, with a trailing newline dropped
+    inline std::string read_file(const std::string& path) {
+        std::ifstream file(path);
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!content.empty() && content.back() == '\n') content.pop_back();
+        return content;
+    }
+
+    // Run argv[0], searched in PATH, with 'env' (NAME=value) added to the
+    // environment and stdout on 'out' if it isn't -1
+    inline pid_t spawn(const std::vector<std::string>& argv, const std::vector<std::string>& env = {},
+                       int out = -1) {
+        pid_t pid = fork();
+        if (pid != 0) return pid;
+        for (const auto& entry : env) putenv(const_cast<char*>(entry.c_str()));
+        if (out >= 0) dup2(out, STDOUT_FILENO);
+        std::vector<char*> args;
+        for (const auto& arg : argv) args.push_back(const_cast<char*>(arg.c_str()));
+        args.push_back(nullptr);
+        execvp(args[0], args.data());
+        _exit(127);
+    }
+
+    // Wait up to 'timeout_ms' for a process to exit; false if it didn't
+    inline bool wait_exit(pid_t pid, int& status, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (waitpid(pid, &status, WNOHANG) == 0) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+}
+
+#define CHECK(condition)                                                                      \
+    do {                                                                                      \
+        if (!(condition)) {                                                                   \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++test::failures;                                                                 \
+        }                                                                                     \
+    } while (0)